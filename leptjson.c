@@ -1,9 +1,16 @@
+#if defined(LEPT_ENABLE_STATS) && !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 199309L     /* clock_gettime() */
+#endif
+
 #include "leptjson.h"
 #include <assert.h>  /* assert() */
 #include <stdlib.h>  /* NULL */
 #include <errno.h>   /* errno, ERANGE */
-#include <math.h>    /* HUGE_VAL */
+#include <math.h>    /* HUGE_VAL, floor() */
+#include <limits.h>  /* LONG_MIN, INT_MIN, INT_MAX */
+#include <float.h>   /* DBL_MIN */
 #include <string.h>  /* memcpy() */
+#include <stddef.h>  /* offsetof() */
 #include <stdio.h>
 
 #ifndef LEPT_PARSE_STACK_INIT_SIZE
@@ -14,6 +21,15 @@
 #define LEPT_PARSE_STRINGIFY_INIT_SIZE 256
 #endif
 
+/* scratch stack a lept_parser keeps between calls, by default */
+#ifndef LEPT_PARSER_MAX_RETAINED_SIZE
+#define LEPT_PARSER_MAX_RETAINED_SIZE (1 << 20)
+#endif
+
+#ifndef LEPT_KEY_POOL_INIT_SIZE
+#define LEPT_KEY_POOL_INIT_SIZE 64
+#endif
+
 #define EXPECT(c, ch)       do { assert(*c->json == (ch)); c->json++; } while(0)
 #define ISDIGIT(ch)         ((ch) >= '0' && (ch) <= '9')
 #define ISDIGIT1TO9(ch)     ((ch) >= '1' && (ch) <= '9')
@@ -21,13 +37,176 @@
 #define PUTC(c, ch) do { *(char*)lept_context_push(c, sizeof(char)) = (ch); } while(0)
 #define PUTS(c, s, len)     memcpy(lept_context_push(c, len), s, len)
 
+/*
+ * instrumentation, only built with LEPT_ENABLE_STATS. counters are kept per
+ * thread where the compiler has thread-local storage, shared otherwise.
+ */
+#ifdef LEPT_ENABLE_STATS
+#include <time.h>    /* clock_gettime(), clock() */
+
+#if defined(_MSC_VER)
+#define LEPT_THREAD_LOCAL   __declspec(thread)
+#elif defined(__GNUC__)
+#define LEPT_THREAD_LOCAL   __thread
+#else
+#define LEPT_THREAD_LOCAL
+#endif
+
+static LEPT_THREAD_LOCAL lept_stats lept_stats_local;
+static LEPT_THREAD_LOCAL size_t lept_stats_depth;
+static LEPT_THREAD_LOCAL double lept_stats_parse_start, lept_stats_stringify_start;
+
+/*
+ * seconds from a monotonic wall clock, so each thread times only its own
+ * calls. without one it falls back to clock(), the processor time of the
+ * whole process, which is only right while a single thread is working.
+ */
+#if defined(_WIN32)
+#include <windows.h>    /* QueryPerformanceCounter() */
+static double lept_stats_clock(void) {
+    LARGE_INTEGER t, f;
+    QueryPerformanceCounter(&t);
+    QueryPerformanceFrequency(&f);
+    return (double)t.QuadPart / (double)f.QuadPart;
+}
+#elif defined(CLOCK_MONOTONIC)
+static double lept_stats_clock(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec / 1e9;
+}
+#else
+static double lept_stats_clock(void) {
+    return (double)clock() / CLOCKS_PER_SEC;
+}
+#endif
+
+#define LEPT_STATS_ADD(field, n)    do { lept_stats_local.field += (n); } while(0)
+#define LEPT_STATS_MAX(field, n) \
+    do { if ((n) > lept_stats_local.field) lept_stats_local.field = (n); } while(0)
+#define LEPT_STATS_ALLOC(size) \
+    do { lept_stats_local.allocations++; lept_stats_local.allocated += (size); } while(0)
+/* a realloc counts as a call, and only what it grows by as bytes */
+#define LEPT_STATS_REALLOC(old, size) \
+    do { lept_stats_local.allocations++; if ((size) > (old)) lept_stats_local.allocated += (size) - (old); } while(0)
+#define LEPT_STATS_ENTER() \
+    do { if (++lept_stats_depth > lept_stats_local.max_depth) lept_stats_local.max_depth = lept_stats_depth; } while(0)
+#define LEPT_STATS_LEAVE(v, ret) \
+    do { lept_stats_depth--; if ((ret) == LEPT_PARSE_OK) lept_stats_local.nodes[lept_get_type(v) - LEPT_NULL]++; } while(0)
+#define LEPT_STATS_START(phase)     do { lept_stats_##phase##_start = lept_stats_clock(); } while(0)
+#define LEPT_STATS_STOP(phase) \
+    do { lept_stats_local.phase##_time += lept_stats_clock() - lept_stats_##phase##_start; } while(0)
+#else
+#define LEPT_STATS_ADD(field, n)    do {} while(0)
+#define LEPT_STATS_MAX(field, n)    do {} while(0)
+#define LEPT_STATS_ALLOC(size)      do {} while(0)
+#define LEPT_STATS_REALLOC(old, size) do {} while(0)
+#define LEPT_STATS_ENTER()          do {} while(0)
+#define LEPT_STATS_LEAVE(v, ret)    do {} while(0)
+#define LEPT_STATS_START(phase)     do {} while(0)
+#define LEPT_STATS_STOP(phase)      do {} while(0)
+#endif
+
+#define LEPT_STRINGIFY_CANONICAL    (1 << 8)    /* lept_context.options, next to the parse options */
+
 typedef struct {
     const char* first;
     const char* json;
     char* stack;
     size_t size, top;
+    lept_key_pool* pool;
+    int options;            /* LEPT_PARSE_STRICT_UTF8 ..., LEPT_STRINGIFY_CANONICAL */
 }lept_context;
 
+/*
+ * reference counts of keys and frozen documents, and the slot pointer,
+ * change under several threads, so they go through the compiler's atomic
+ * builtins. without them there is no atomicity, and values sharing keys or
+ * a document must stay in one thread.
+ */
+#if defined(_MSC_VER)
+#include <windows.h>    /* Interlocked*() */
+#define LEPT_ATOMIC_INC(p)              InterlockedIncrement(p)
+#define LEPT_ATOMIC_DEC(p)              InterlockedDecrement(p)
+#define LEPT_ATOMIC_EXCHANGE(p, v)      InterlockedExchangePointer((void* volatile*)(p), (v))
+#define LEPT_ATOMIC_LOAD(p)             InterlockedCompareExchangePointer((void* volatile*)(p), NULL, NULL)
+#define LEPT_ATOMIC_GET(p)              InterlockedCompareExchange(p, 0, 0)
+#define LEPT_ATOMIC_YIELD()             SwitchToThread()
+#elif defined(__GNUC__)
+#define LEPT_ATOMIC_INC(p)              __sync_add_and_fetch(p, 1)
+#define LEPT_ATOMIC_DEC(p)              __sync_sub_and_fetch(p, 1)
+#define LEPT_ATOMIC_EXCHANGE(p, v)      lept_atomic_exchange((void* volatile*)(p), (v))
+#define LEPT_ATOMIC_LOAD(p)             __sync_val_compare_and_swap((void* volatile*)(p), NULL, NULL)
+#define LEPT_ATOMIC_GET(p)              __sync_fetch_and_add(p, 0)
+#if defined(_WIN32)
+#include <windows.h>    /* Sleep() */
+#define LEPT_ATOMIC_YIELD()             Sleep(0)
+#else
+#include <sched.h>      /* sched_yield() */
+#define LEPT_ATOMIC_YIELD()             sched_yield()
+#endif
+
+static void* lept_atomic_exchange(void* volatile* p, void* v) {
+    void* old;
+    do {
+        old = LEPT_ATOMIC_LOAD(p);
+    } while (!__sync_bool_compare_and_swap(p, old, v));
+    return old;
+}
+#else
+#define LEPT_ATOMIC_INC(p)              (++*(p))
+#define LEPT_ATOMIC_DEC(p)              (--*(p))
+#define LEPT_ATOMIC_EXCHANGE(p, v)      lept_atomic_exchange((void* volatile*)(p), (v))
+#define LEPT_ATOMIC_LOAD(p)             (*(void* volatile*)(p))
+#define LEPT_ATOMIC_GET(p)              (*(p))
+#define LEPT_ATOMIC_YIELD()             do {} while(0)
+
+static void* lept_atomic_exchange(void* volatile* p, void* v) {
+    void* old = *p;
+    *p = v;
+    return old;
+}
+#endif
+
+/*
+ * every long member key lives in a lept_key, lept_member.k.p points at s,
+ * keys shorter than LEPT_SHORT_KEY_SIZE are kept inline in lept_member.k.s.
+ * interned keys are shared by all members parsed with the same pool,
+ * the reference count keeps them alive after the pool is destroyed.
+ */
+typedef struct lept_key {
+    volatile long ref;      /* LEPT_ATOMIC_INC()/LEPT_ATOMIC_DEC(), values may be freed on any thread */
+    size_t hash;
+    size_t klen;
+    struct lept_key* next;  /* bucket chain in lept_key_pool */
+    char s[1];
+}lept_key;
+
+#define LEPT_KEY(k)         ((lept_key*)((k) - offsetof(lept_key, s)))
+#define LEPT_MEMBER_KEY(m)  ((m)->klen < LEPT_SHORT_KEY_SIZE ? (m)->k.s : (m)->k.p)
+#define LEPT_IS_SHORT_STRING(v) ((v)->u.s.len < LEPT_SHORT_STRING_SIZE)
+
+/*
+ * an array of numbers only may be kept as plain doubles in lept_value.u.p.
+ * lept_get_type() reports it as LEPT_ARRAY, and anything that wants element
+ * pointers unpacks it first.
+ */
+#define LEPT_PACKED_ARRAY   (LEPT_OBJECT + 1)
+
+struct lept_key_pool {
+    lept_key** bucket;
+    size_t size, count;     /* size is a power of 2 */
+};
+
+/* everything a parse needs that can outlive it */
+struct lept_parser {
+    char* stack;
+    size_t size;
+    size_t max_retained;
+    lept_key_pool* pool;
+    int options;
+};
+
 #if 0
 static void printCur(lept_context* c) {
     /* 13 */
@@ -42,12 +221,160 @@ static void printCur(lept_context* c) {
 #endif
 static int lept_parse_value(lept_context* c, lept_value* v); /* forward declare */
 
+/****** key ******/
+
+/* FNV-1a */
+static size_t lept_hash_bytes(const char* s, size_t len) {
+    size_t h = 2166136261u;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static char* lept_key_new(const char* key, size_t klen, size_t hash) {
+    lept_key* k = (lept_key*) malloc(offsetof(lept_key, s) + klen + 1);
+    assert(k != NULL);
+    LEPT_STATS_ALLOC(offsetof(lept_key, s) + klen + 1);
+    k->ref = 1;
+    k->hash = hash;
+    k->klen = klen;
+    k->next = NULL;
+    memcpy(k->s, key, klen);
+    k->s[klen] = '\0';
+    return k->s;
+}
+
+static void lept_key_release(char* k) {
+    lept_key* key = LEPT_KEY(k);
+    long ref = LEPT_ATOMIC_DEC(&key->ref);
+    assert(ref >= 0);
+    if (ref == 0) {
+        free(key);
+    }
+}
+
+static void lept_member_free_key(lept_member* m) {
+    if (m->klen >= LEPT_SHORT_KEY_SIZE) {
+        lept_key_release(m->k.p);
+    }
+}
+
+/* keys of two members, pointer identity first, then hash */
+static int lept_member_key_equal(const lept_member* lhs, const lept_member* rhs) {
+    if (lhs->klen != rhs->klen) {
+        return 0;
+    }
+    if (lhs->klen < LEPT_SHORT_KEY_SIZE) {
+        return memcmp(lhs->k.s, rhs->k.s, lhs->klen) == 0;
+    }
+    return lhs->k.p == rhs->k.p ||
+           (LEPT_KEY(lhs->k.p)->hash == LEPT_KEY(rhs->k.p)->hash &&
+            memcmp(lhs->k.p, rhs->k.p, lhs->klen) == 0);
+}
+
+static int lept_member_key_is(const lept_member* m, const char* key, size_t klen) {
+    const char* k = LEPT_MEMBER_KEY(m);
+    return m->klen == klen && (k == key || memcmp(k, key, klen) == 0);
+}
+
+lept_key_pool* lept_key_pool_create(void) {
+    lept_key_pool* pool = (lept_key_pool*) malloc(sizeof(lept_key_pool));
+    assert(pool != NULL);
+    pool->size = LEPT_KEY_POOL_INIT_SIZE;
+    pool->count = 0;
+    pool->bucket = (lept_key**) calloc(pool->size, sizeof(lept_key*));
+    assert(pool->bucket != NULL);
+    return pool;
+}
+
+/* values parsed with the pool keep their own references */
+void lept_key_pool_destroy(lept_key_pool* pool) {
+    size_t i;
+    lept_key *k, *next;
+    assert(pool != NULL);
+    for (i = 0; i < pool->size; i++) {
+        for (k = pool->bucket[i]; k != NULL; k = next) {
+            next = k->next;
+            k->next = NULL;
+            lept_key_release(k->s);
+        }
+    }
+    free(pool->bucket);
+    free(pool);
+}
+
+size_t lept_key_pool_size(const lept_key_pool* pool) {
+    assert(pool != NULL);
+    return pool->count;
+}
+
+static void lept_key_pool_rehash(lept_key_pool* pool) {
+    size_t i, size = pool->size * 2;
+    lept_key *k, *next;
+    lept_key** bucket = (lept_key**) calloc(size, sizeof(lept_key*));
+    assert(bucket != NULL);
+    for (i = 0; i < pool->size; i++) {
+        for (k = pool->bucket[i]; k != NULL; k = next) {
+            next = k->next;
+            k->next = bucket[k->hash & (size - 1)];
+            bucket[k->hash & (size - 1)] = k;
+        }
+    }
+    free(pool->bucket);
+    pool->bucket = bucket;
+    pool->size = size;
+}
+
+/* return the pool's copy of key, the caller gets no reference */
+const char* lept_key_pool_intern(lept_key_pool* pool, const char* key, size_t klen) {
+    size_t hash;
+    lept_key* k;
+    char* s;
+    assert(pool != NULL && (key != NULL || klen == 0));
+    hash = lept_hash_bytes(key, klen);
+    for (k = pool->bucket[hash & (pool->size - 1)]; k != NULL; k = k->next) {
+        /* the length first, a shorter key must not be read past its end */
+        if (k->hash == hash && k->klen == klen && memcmp(k->s, key, klen) == 0) {
+            return k->s;
+        }
+    }
+    if (pool->count >= pool->size) {
+        lept_key_pool_rehash(pool);
+    }
+    s = lept_key_new(key, klen, hash);
+    k = LEPT_KEY(s);
+    k->next = pool->bucket[hash & (pool->size - 1)];
+    pool->bucket[hash & (pool->size - 1)] = k;
+    pool->count++;
+    return s;
+}
+
+/* short keys go inline, long ones are interned when a pool is given */
+static void lept_member_set_key(lept_member* m, const char* key, size_t klen, lept_key_pool* pool) {
+    assert(klen <= LEPT_SIZE_MAX);
+    m->klen = (lept_size)klen;
+    if (klen < LEPT_SHORT_KEY_SIZE) {
+        memcpy(m->k.s, key, klen);
+        m->k.s[klen] = '\0';
+    }else if (pool == NULL) {
+        m->k.p = lept_key_new(key, klen, lept_hash_bytes(key, klen));
+    }else {
+        m->k.p = (char*)lept_key_pool_intern(pool, key, klen);
+        LEPT_ATOMIC_INC(&LEPT_KEY(m->k.p)->ref);
+    }
+}
+
 void lept_free(lept_value* v) {
     size_t i;
     assert(v != NULL);
     switch(v->type) {
         case LEPT_STRING:
-            free(v->u.s.s);
+            if (!LEPT_IS_SHORT_STRING(v)) {
+                free(v->u.s.s);
+            }
             break;
         case LEPT_ARRAY:
             for(i = 0; i < v->u.a.size; i++) {
@@ -55,16 +382,19 @@ void lept_free(lept_value* v) {
             }
             free(v->u.a.e);
             v->u.a.e = NULL;
-            v->u.a.size = 0;
+            v->u.a.size = v->u.a.capacity = 0;
+            break;
+        case LEPT_PACKED_ARRAY:
+            free(v->u.p.n);
             break;
         case LEPT_OBJECT:
             for (i = 0; i < v->u.o.size; i++ ) {
-                free(v->u.o.m[i].k);
+                lept_member_free_key(&v->u.o.m[i]);
                 lept_free(&(v->u.o.m[i].v));
             }
             free(v->u.o.m);
             v->u.o.m = NULL;
-            v->u.o.size = 0;
+            v->u.o.size = v->u.o.capacity = 0;
             break;
         default: 
             break;
@@ -73,11 +403,95 @@ void lept_free(lept_value* v) {
 }
 
 
+/* deep copy into a null dst, every container is allocated once with its exact size */
+static void lept_copy_value(lept_value* dst, const lept_value* src) {
+    size_t i, size;
+    switch(src->type) {
+        case LEPT_STRING:
+            lept_set_string(dst, lept_get_string(src), src->u.s.len);
+            break;
+        case LEPT_ARRAY:
+            size = src->u.a.size;
+            dst->u.a.e = NULL;
+            if (size > 0) {
+                dst->u.a.e = (lept_value*) malloc(sizeof(lept_value) * size);
+                LEPT_STATS_ALLOC(sizeof(lept_value) * size);
+                assert(dst->u.a.e != NULL);
+            }
+            for (i = 0; i < size; i++) {
+                lept_init(&dst->u.a.e[i]);
+                lept_copy_value(&dst->u.a.e[i], &src->u.a.e[i]);
+            }
+            dst->u.a.size = dst->u.a.capacity = (lept_size)size;
+            dst->type = LEPT_ARRAY;
+            break;
+        case LEPT_PACKED_ARRAY:
+            lept_set_array_doubles(dst, src->u.p.n, src->u.p.size);
+            break;
+        case LEPT_OBJECT:
+            size = src->u.o.size;
+            dst->u.o.m = NULL;
+            if (size > 0) {
+                dst->u.o.m = (lept_member*) malloc(sizeof(lept_member) * size);
+                LEPT_STATS_ALLOC(sizeof(lept_member) * size);
+                assert(dst->u.o.m != NULL);
+            }
+            for (i = 0; i < size; i++) {
+                lept_member* m = &dst->u.o.m[i];
+                m->klen = src->u.o.m[i].klen;
+                if (m->klen < LEPT_SHORT_KEY_SIZE) {
+                    memcpy(m->k.s, src->u.o.m[i].k.s, m->klen + 1);
+                }else {
+                    m->k.p = lept_key_new(src->u.o.m[i].k.p, m->klen, LEPT_KEY(src->u.o.m[i].k.p)->hash);
+                }
+                lept_init(&m->v);
+                lept_copy_value(&m->v, &src->u.o.m[i].v);
+            }
+            dst->u.o.size = dst->u.o.capacity = (lept_size)size;
+            dst->type = LEPT_OBJECT;
+            break;
+        default:
+            memcpy(dst, src, sizeof(lept_value));
+            break;
+    }
+}
+
+/* src may lie inside dst, so it is copied before dst is freed */
+void lept_copy(lept_value* dst, const lept_value* src) {
+    lept_value tmp;
+    assert(src != NULL && dst != NULL && src != dst);
+    lept_init(&tmp);
+    lept_copy_value(&tmp, src);
+    lept_free(dst);
+    memcpy(dst, &tmp, sizeof(lept_value));
+}
+
+/* O(1), src is left as null. it is detached first, it may lie inside dst */
+void lept_move(lept_value* dst, lept_value* src) {
+    lept_value tmp;
+    assert(dst != NULL && src != NULL && src != dst);
+    memcpy(&tmp, src, sizeof(lept_value));
+    lept_init(src);
+    lept_free(dst);
+    memcpy(dst, &tmp, sizeof(lept_value));
+}
+
+void lept_swap(lept_value* lhs, lept_value* rhs) {
+    assert(lhs != NULL && rhs != NULL);
+    if (lhs != rhs) {
+        lept_value tmp;
+        memcpy(&tmp, lhs, sizeof(lept_value));
+        memcpy(lhs,  rhs, sizeof(lept_value));
+        memcpy(rhs, &tmp, sizeof(lept_value));
+    }
+}
+
+
 /****** getter setter ******/
 
 lept_type lept_get_type(const lept_value* v) {
     assert(v != NULL);
-    return v->type;
+    return v->type == LEPT_PACKED_ARRAY ? LEPT_ARRAY : (lept_type)v->type;
 }
 
 int lept_get_boolean(const lept_value* v) {
@@ -103,7 +517,7 @@ void lept_set_number(lept_value* v, double b) {
 
 const char* lept_get_string(const lept_value* v) {
     assert(v != NULL && v->type == LEPT_STRING);
-    return v->u.s.s;
+    return LEPT_IS_SHORT_STRING(v) ? v->u.ss.s : v->u.s.s;
 }
 
 size_t lept_get_string_length(const lept_value* v) {
@@ -113,34 +527,290 @@ size_t lept_get_string_length(const lept_value* v) {
 
 void lept_set_string(lept_value* v, const char*s, size_t len) {
     assert(v != NULL && (s != NULL || len == 0)) ;
+    assert(len <= LEPT_SIZE_MAX);
     lept_free(v);
-    v->u.s.s = (char*)malloc(len+1);
-    memcpy(v->u.s.s, s, len);
-    v->u.s.s[len] = '\0';
-    v->u.s.len = len;
+    v->u.s.len = (lept_size)len;
+    if (LEPT_IS_SHORT_STRING(v)) {
+        /* no allocation for short strings */
+        if (len > 0) {
+            memcpy(v->u.ss.s, s, len);
+        }
+        v->u.ss.s[len] = '\0';
+    }else {
+        v->u.s.s = (char*)malloc(len+1);
+        LEPT_STATS_ALLOC(len+1);
+        assert(v->u.s.s != NULL);
+        memcpy(v->u.s.s, s, len);
+        v->u.s.s[len] = '\0';
+    }
     v->type = LEPT_STRING;
 }
 
+/* geometric growth, shared by arrays and objects */
+static size_t lept_grow_capacity(size_t capacity) {
+    return capacity < 4 ? 4 : capacity + (capacity >> 1);   /* capacity * 1.5 */
+}
+
+void lept_set_array(lept_value* v, size_t capacity) {
+    assert(v != NULL);
+    assert(capacity <= LEPT_SIZE_MAX);
+    lept_free(v);
+    v->type = LEPT_ARRAY;
+    v->u.a.size = 0;
+    v->u.a.capacity = (lept_size)capacity;
+    v->u.a.e = NULL;
+    if (capacity > 0) {
+        v->u.a.e = (lept_value*) malloc(sizeof(lept_value) * capacity);
+        LEPT_STATS_ALLOC(sizeof(lept_value) * capacity);
+        assert(v->u.a.e != NULL);
+    }
+}
+
+/* a packed array turns back into lept_value elements, other arrays are left as they are */
+void lept_unpack_array(lept_value* v) {
+    double* n;
+    size_t i, size;
+    assert( v!= NULL && (v->type == LEPT_ARRAY || v->type == LEPT_PACKED_ARRAY));
+    n = v->u.p.n;
+    size = v->u.p.size;
+    if (v->type != LEPT_PACKED_ARRAY) {
+        return;
+    }
+    v->u.a.e = (lept_value*) malloc(sizeof(lept_value) * size);
+    LEPT_STATS_ALLOC(sizeof(lept_value) * size);
+    assert(v->u.a.e != NULL);
+    for (i = 0; i < size; i++) {
+        v->u.a.e[i].type = LEPT_NUMBER;
+        v->u.a.e[i].u.n = n[i];
+    }
+    free(n);
+    v->u.a.capacity = (lept_size)size;
+    v->type = LEPT_ARRAY;
+}
+
 size_t      lept_get_array_size(const lept_value* v) {
-    assert( v!= NULL && v->type == LEPT_ARRAY);
+    assert( v!= NULL && (v->type == LEPT_ARRAY || v->type == LEPT_PACKED_ARRAY));
     return v->u.a.size;
 }
 
-lept_value* lept_get_array_element(const lept_value* v , size_t index) {
+size_t      lept_get_array_capacity(const lept_value* v) {
+    assert( v!= NULL && (v->type == LEPT_ARRAY || v->type == LEPT_PACKED_ARRAY));
+    return v->u.a.capacity;
+}
+
+/* NULL unless v is packed, then there are lept_get_array_size(v) doubles */
+const double* lept_get_array_doubles(const lept_value* v) {
+    assert( v!= NULL && (v->type == LEPT_ARRAY || v->type == LEPT_PACKED_ARRAY));
+    return v->type == LEPT_PACKED_ARRAY ? v->u.p.n : NULL;
+}
+
+void lept_set_array_doubles(lept_value* v, const double* n, size_t size) {
+    assert(v != NULL && (n != NULL || size == 0));
+    assert(size <= LEPT_SIZE_MAX);
+    if (size == 0) {
+        lept_set_array(v, 0);
+        return;
+    }
+    lept_free(v);
+    v->u.p.n = (double*) malloc(sizeof(double) * size);
+    LEPT_STATS_ALLOC(sizeof(double) * size);
+    assert(v->u.p.n != NULL);
+    memcpy(v->u.p.n, n, sizeof(double) * size);
+    v->u.p.size = v->u.p.capacity = (lept_size)size;
+    v->type = LEPT_PACKED_ARRAY;
+}
+
+/* packs a non-empty array of numbers only, returns whether v is packed now */
+int lept_pack_array(lept_value* v) {
+    double* n;
+    size_t i, size;
+    assert( v!= NULL && (v->type == LEPT_ARRAY || v->type == LEPT_PACKED_ARRAY));
+    if (v->type == LEPT_PACKED_ARRAY) {
+        return 1;
+    }
+    size = v->u.a.size;
+    for (i = 0; i < size; i++) {
+        if (v->u.a.e[i].type != LEPT_NUMBER) {
+            return 0;
+        }
+    }
+    if (size == 0) {
+        return 0;
+    }
+    n = (double*) malloc(sizeof(double) * size);
+    LEPT_STATS_ALLOC(sizeof(double) * size);
+    assert(n != NULL);
+    for (i = 0; i < size; i++) {
+        n[i] = v->u.a.e[i].u.n;
+    }
+    free(v->u.a.e);
+    v->u.p.n = n;
+    v->u.p.capacity = (lept_size)size;
+    v->type = LEPT_PACKED_ARRAY;
+    return 1;
+}
+
+void lept_reserve_array(lept_value* v, size_t capacity) {
+    assert( v!= NULL && (v->type == LEPT_ARRAY || v->type == LEPT_PACKED_ARRAY));
+    lept_unpack_array(v);
+    assert(capacity <= LEPT_SIZE_MAX);
+    if (v->u.a.capacity < capacity) {
+        v->u.a.e = (lept_value*) realloc(v->u.a.e, sizeof(lept_value) * capacity);
+        LEPT_STATS_REALLOC(sizeof(lept_value) * v->u.a.capacity, sizeof(lept_value) * capacity);
+        assert(v->u.a.e != NULL);
+        v->u.a.capacity = (lept_size)capacity;
+    }
+}
+
+void lept_shrink_array(lept_value* v) {
+    assert( v!= NULL && (v->type == LEPT_ARRAY || v->type == LEPT_PACKED_ARRAY));
+    lept_unpack_array(v);
+    if (v->u.a.capacity > v->u.a.size) {
+        if (v->u.a.size == 0) {
+            free(v->u.a.e);
+            v->u.a.e = NULL;
+        }else {
+            v->u.a.e = (lept_value*) realloc(v->u.a.e, sizeof(lept_value) * v->u.a.size);
+            LEPT_STATS_REALLOC(sizeof(lept_value) * v->u.a.capacity, sizeof(lept_value) * v->u.a.size);
+            assert(v->u.a.e != NULL);
+        }
+        v->u.a.capacity = v->u.a.size;
+    }
+}
+
+void lept_clear_array(lept_value* v) {
+    assert( v!= NULL && (v->type == LEPT_ARRAY || v->type == LEPT_PACKED_ARRAY));
+    lept_unpack_array(v);
+    lept_erase_array_element(v, 0, v->u.a.size);
+}
+
+/* packed elements have no lept_value, read them with lept_peek_array_element() or lept_unpack_array() first */
+lept_value* lept_get_array_element(const lept_value* v, size_t index) {
     assert( v!= NULL && v->type == LEPT_ARRAY);
     assert (index < v->u.a.size);
     return &(v->u.a.e[index]);
 }
 
+/* never changes v, a packed element is written to *number and that is returned */
+const lept_value* lept_peek_array_element(const lept_value* v, size_t index, lept_value* number) {
+    assert( v!= NULL && (v->type == LEPT_ARRAY || v->type == LEPT_PACKED_ARRAY) && number != NULL);
+    assert (index < v->u.a.size);
+    if (v->type == LEPT_PACKED_ARRAY) {
+        number->type = LEPT_NUMBER;
+        number->u.n = v->u.p.n[index];
+        return number;
+    }
+    return &(v->u.a.e[index]);
+}
+
+/* amortised O(1), the new element is null */
+lept_value* lept_pushback_array_element(lept_value* v) {
+    assert( v!= NULL && (v->type == LEPT_ARRAY || v->type == LEPT_PACKED_ARRAY));
+    lept_unpack_array(v);
+    if (v->u.a.size == v->u.a.capacity) {
+        lept_reserve_array(v, lept_grow_capacity(v->u.a.capacity));
+    }
+    lept_init(&v->u.a.e[v->u.a.size]);
+    return &v->u.a.e[v->u.a.size++];
+}
+
+void lept_popback_array_element(lept_value* v) {
+    assert( v!= NULL && (v->type == LEPT_ARRAY || v->type == LEPT_PACKED_ARRAY) && v->u.a.size > 0);
+    lept_unpack_array(v);
+    lept_free(&v->u.a.e[--v->u.a.size]);
+}
+
+lept_value* lept_insert_array_element(lept_value* v, size_t index) {
+    assert( v!= NULL && (v->type == LEPT_ARRAY || v->type == LEPT_PACKED_ARRAY) && index <= v->u.a.size);
+    lept_unpack_array(v);
+    if (v->u.a.size == v->u.a.capacity) {
+        lept_reserve_array(v, lept_grow_capacity(v->u.a.capacity));
+    }
+    memmove(&v->u.a.e[index + 1], &v->u.a.e[index], sizeof(lept_value) * (v->u.a.size - index));
+    v->u.a.size++;
+    lept_init(&v->u.a.e[index]);
+    return &v->u.a.e[index];
+}
+
+void lept_erase_array_element(lept_value* v, size_t index, size_t count) {
+    size_t i;
+    assert( v!= NULL && (v->type == LEPT_ARRAY || v->type == LEPT_PACKED_ARRAY) && index + count <= v->u.a.size);
+    lept_unpack_array(v);
+    for (i = index; i < index + count; i++) {
+        lept_free(&v->u.a.e[i]);
+    }
+    if (count > 0) {
+        memmove(&v->u.a.e[index], &v->u.a.e[index + count],
+                sizeof(lept_value) * (v->u.a.size - index - count));
+        v->u.a.size -= count;
+    }
+}
+
+void lept_set_object(lept_value* v, size_t capacity) {
+    assert(v != NULL);
+    assert(capacity <= LEPT_SIZE_MAX);
+    lept_free(v);
+    v->type = LEPT_OBJECT;
+    v->u.o.size = 0;
+    v->u.o.capacity = (lept_size)capacity;
+    v->u.o.m = NULL;
+    if (capacity > 0) {
+        v->u.o.m = (lept_member*) malloc(sizeof(lept_member) * capacity);
+        LEPT_STATS_ALLOC(sizeof(lept_member) * capacity);
+        assert(v->u.o.m != NULL);
+    }
+}
+
 size_t      lept_get_object_size(const lept_value* v) {
     assert(v != NULL && v->type == LEPT_OBJECT);
     return v->u.o.size;
 }
 
+size_t      lept_get_object_capacity(const lept_value* v) {
+    assert(v != NULL && v->type == LEPT_OBJECT);
+    return v->u.o.capacity;
+}
+
+void lept_reserve_object(lept_value* v, size_t capacity) {
+    assert(v != NULL && v->type == LEPT_OBJECT);
+    assert(capacity <= LEPT_SIZE_MAX);
+    if (v->u.o.capacity < capacity) {
+        v->u.o.m = (lept_member*) realloc(v->u.o.m, sizeof(lept_member) * capacity);
+        LEPT_STATS_REALLOC(sizeof(lept_member) * v->u.o.capacity, sizeof(lept_member) * capacity);
+        assert(v->u.o.m != NULL);
+        v->u.o.capacity = (lept_size)capacity;
+    }
+}
+
+void lept_shrink_object(lept_value* v) {
+    assert(v != NULL && v->type == LEPT_OBJECT);
+    if (v->u.o.capacity > v->u.o.size) {
+        if (v->u.o.size == 0) {
+            free(v->u.o.m);
+            v->u.o.m = NULL;
+        }else {
+            v->u.o.m = (lept_member*) realloc(v->u.o.m, sizeof(lept_member) * v->u.o.size);
+            LEPT_STATS_REALLOC(sizeof(lept_member) * v->u.o.capacity, sizeof(lept_member) * v->u.o.size);
+            assert(v->u.o.m != NULL);
+        }
+        v->u.o.capacity = v->u.o.size;
+    }
+}
+
+void lept_clear_object(lept_value* v) {
+    size_t i;
+    assert(v != NULL && v->type == LEPT_OBJECT);
+    for (i = 0; i < v->u.o.size; i++) {
+        lept_member_free_key(&v->u.o.m[i]);
+        lept_free(&v->u.o.m[i].v);
+    }
+    v->u.o.size = 0;
+}
+
 const char* lept_get_object_key(const lept_value* v, size_t index) {
     assert(v != NULL && v->type == LEPT_OBJECT);
     assert( index < v->u.o.size );
-    return (v->u.o.m[index]).k;
+    return LEPT_MEMBER_KEY(&v->u.o.m[index]);
 }
 
 size_t      lept_get_object_key_length(const lept_value* v, size_t index) {
@@ -159,7 +829,7 @@ int         lept_find_object_index(const lept_value* v, const char* key, size_t
     int i;
     assert(v != NULL && v->type == LEPT_OBJECT && key != NULL);
     for(i = 0;i < v->u.o.size; i++) {
-        if ( klen == v->u.o.m[i].klen && memcmp(v->u.o.m[i].k, key, klen) == 0) {
+        if (lept_member_key_is(&v->u.o.m[i], key, klen)) {
             return i;
         }
     }
@@ -170,35 +840,64 @@ lept_value* lept_find_object_value(const lept_value* v, const char* key, size_t
     int i ;
     assert(v!=NULL && v->type == LEPT_OBJECT && key  != NULL);
     for (i = 0; i< v->u.o.size; i++) {
-        if ((v->u.o.m[i]).klen == klen && memcmp(v->u.o.m[i].k, key, klen) == 0 ) {
+        if (lept_member_key_is(&v->u.o.m[i], key, klen)) {
             return &((v->u.o.m[i]).v);
         }
     }
     return NULL;
 }
 
+/* find-or-insert, a new member is appended with a null value for the caller to fill */
+lept_value* lept_set_object_value(lept_value* v, const char* key, size_t klen) {
+    int index;
+    lept_member* m;
+    assert(v != NULL && v->type == LEPT_OBJECT && key != NULL);
+    if ((index = lept_find_object_index(v, key, klen)) >= 0) {
+        return &v->u.o.m[index].v;
+    }
+    if (v->u.o.size == v->u.o.capacity) {
+        lept_reserve_object(v, lept_grow_capacity(v->u.o.capacity));
+    }
+    m = &v->u.o.m[v->u.o.size++];
+    lept_member_set_key(m, key, klen, NULL);
+    lept_init(&m->v);
+    return &m->v;
+}
+
+void lept_remove_object_value(lept_value* v, size_t index) {
+    assert(v != NULL && v->type == LEPT_OBJECT && index < v->u.o.size);
+    lept_member_free_key(&v->u.o.m[index]);
+    lept_free(&v->u.o.m[index].v);
+    memmove(&v->u.o.m[index], &v->u.o.m[index + 1],
+            sizeof(lept_member) * (v->u.o.size - index - 1));
+    v->u.o.size--;
+}
+
 /* return position of data which was push in */
 static void* lept_context_push(lept_context* c, size_t size) {
     void* ret;
     void* tmp;
+    size_t n;
     int i = 3;
     tmp = NULL;
     assert(size > 0);
     if (c->top + size >= c->size) {
-        if (c->size == 0) {
-            c->size = LEPT_PARSE_STACK_INIT_SIZE;
-        }
-        while(c->top + size >= c->size) {
-            c->size += (c->size >> 1);      /* c->size * 1.5 */
+        n = c->size == 0 ? LEPT_PARSE_STACK_INIT_SIZE : c->size;
+        while(c->top + size >= n) {
+            n += (n >> 1);      /* n * 1.5 */
         }
         while (i--) {
-            tmp = realloc(c->stack, c->size);
+            tmp = realloc(c->stack, n);
             if (tmp != NULL) {
                 break;
             }
         }
         assert(tmp != NULL);
         c->stack = tmp;
+        LEPT_STATS_REALLOC(c->size, n);
+        c->size = n;
+        LEPT_STATS_ADD(stack_reallocs, 1);
+        LEPT_STATS_MAX(stack_peak, c->size);
     }
     ret = c->stack + c->top;
     c->top += size;
@@ -222,6 +921,7 @@ static int lept_parse_literal(lept_context* c, lept_value* v, const char* litera
     EXPECT(c, literal[0]);
     for(i = 0; literal[i+1]; i++) {
         if (c->json[i]  != literal[i+1] ) {
+            c->json += i;
             return LEPT_PARSE_INVALID_VALUE;
         }
     }
@@ -230,6 +930,9 @@ static int lept_parse_literal(lept_context* c, lept_value* v, const char* litera
     return LEPT_PARSE_OK;
 }
 
+/* leave c->json where the number went wrong */
+#define NUMBER_ERROR(ret) do { c->json = p; return ret; } while(0)
+
 static int lept_parse_number(lept_context* c, lept_value* v) {
     /* /todo parse number */
     const char * p = c->json;
@@ -253,7 +956,7 @@ static int lept_parse_number(lept_context* c, lept_value* v) {
                     state = 'D';
                     break;
                 }
-                return LEPT_PARSE_INVALID_VALUE;
+                NUMBER_ERROR( LEPT_PARSE_INVALID_VALUE );
             case 'B':
                 if (*p == '0') {
                     p++;
@@ -265,7 +968,7 @@ static int lept_parse_number(lept_context* c, lept_value* v) {
                     state = 'C';
                     break;
                 }
-                return LEPT_PARSE_INVALID_VALUE;
+                NUMBER_ERROR( LEPT_PARSE_INVALID_VALUE );
             case 'C':
                 if ( ISDIGIT(*p) ) {
                     p++;
@@ -303,7 +1006,7 @@ static int lept_parse_number(lept_context* c, lept_value* v) {
                     state = 'H';
                     break;
                 }
-                return LEPT_PARSE_INVALID_VALUE;
+                NUMBER_ERROR( LEPT_PARSE_INVALID_VALUE );
             case 'F':
                 parsing = 0;
                 break;
@@ -318,7 +1021,7 @@ static int lept_parse_number(lept_context* c, lept_value* v) {
                     state = 'J';
                     break;
                 }
-                return LEPT_PARSE_INVALID_VALUE;
+                NUMBER_ERROR( LEPT_PARSE_INVALID_VALUE );
             case 'H':
                 if ( ISDIGIT(*p) ) {
                     p++;
@@ -338,7 +1041,7 @@ static int lept_parse_number(lept_context* c, lept_value* v) {
                     state = 'J';
                     break;
                 }
-                return LEPT_PARSE_INVALID_VALUE;
+                NUMBER_ERROR( LEPT_PARSE_INVALID_VALUE );
             case 'J':
                 if ( ISDIGIT(*p) ) {
                     p++;
@@ -348,7 +1051,7 @@ static int lept_parse_number(lept_context* c, lept_value* v) {
                 state = 'F';
                 break;
             default :
-                return LEPT_PARSE_INVALID_VALUE;
+                NUMBER_ERROR( LEPT_PARSE_INVALID_VALUE );
         }
     }
 
@@ -403,13 +1106,51 @@ static void lept_encode_utf8(lept_context* c, unsigned u) {
     }
 }
 
-/* if error when parsing string, stack must roll back */
-#define STRING_ERROR(ret) do { c->top = head; return ret; } while(0)
+/*
+ * length of the well-formed UTF-8 sequence at p, 0 if it is not one
+ * (Unicode table 3-7: no overlongs, no surrogates, nothing above U+10FFFF).
+ * a terminating '\0' or the end of input always fails the range check,
+ * so only the caller of a length bounded buffer has to check the bound.
+ */
+static size_t lept_utf8_sequence(const unsigned char* p) {
+    unsigned char lo = 0x80, hi = 0xBF;
+    size_t n, i;
+    if (p[0] < 0x80) {
+        return 1;
+    }else if (p[0] < 0xC2) {
+        return 0;
+    }else if (p[0] < 0xE0) {
+        n = 2;
+    }else if (p[0] < 0xF0) {
+        n = 3;
+        if (p[0] == 0xE0) lo = 0xA0;
+        if (p[0] == 0xED) hi = 0x9F;
+    }else if (p[0] < 0xF5) {
+        n = 4;
+        if (p[0] == 0xF0) lo = 0x90;
+        if (p[0] == 0xF4) hi = 0x8F;
+    }else {
+        return 0;
+    }
+    if (p[1] < lo || p[1] > hi) {
+        return 0;
+    }
+    for (i = 2; i < n; i++) {
+        if ((p[i] & 0xC0) != 0x80) {
+            return 0;
+        }
+    }
+    return n;
+}
+
+/* if error when parsing string, stack must roll back, c->json is left on the bad character */
+#define STRING_ERROR(ret) do { c->top = head; c->json = p - 1; return ret; } while(0)
 
 static int lept_parse_string_raw(lept_context* c, char** str, size_t* len) {
     size_t head;
     unsigned u, u2;
     const char* p;
+    const char* q;
     assert(c!=NULL && str!=NULL && len!=NULL);
     *len = 0;
     head = c->top;
@@ -419,6 +1160,9 @@ static int lept_parse_string_raw(lept_context* c, char** str, size_t* len) {
         char ch = *p++;
         switch(ch) {
             case '\"':
+                if (c->top - head > LEPT_SIZE_MAX) {
+                    STRING_ERROR( LEPT_PARSE_STRING_TOO_LONG );
+                }
                 *len = c->top - head;
                 *str = (char*)lept_context_pop(c, *len);
                 c->json = p;
@@ -426,6 +1170,7 @@ static int lept_parse_string_raw(lept_context* c, char** str, size_t* len) {
             case '\0':
                 STRING_ERROR( LEPT_PARSE_MISS_QUOTATION_MARK);
             case '\\':
+                LEPT_STATS_ADD(escapes, 1);
                 ch = *p++;
                 switch(ch) {
                     case '\"': PUTC(c, '\"');break;
@@ -437,20 +1182,24 @@ static int lept_parse_string_raw(lept_context* c, char** str, size_t* len) {
                     case 'r' : PUTC(c, '\r');break;
                     case 't' : PUTC(c, '\t');break;
                     case 'u' :
-                        if ( (p = lept_parse_hex4(p, &u)) == NULL ) {
+                        if ( (q = lept_parse_hex4(p, &u)) == NULL ) {
                             STRING_ERROR( LEPT_PARSE_INVALID_UNICODE_HEX );
                         }
+                        p = q;
                         if (u >= 0xD800 && u <= 0xDBFF ) {
                             if ( *p++ != '\\' || *p++ != 'u' ) {
                                 STRING_ERROR( LEPT_PARSE_INVALID_UNICODE_SURROGATE );
                             }
-                            if ( (p = lept_parse_hex4(p, &u2)) == NULL ) {
+                            if ( (q = lept_parse_hex4(p, &u2)) == NULL ) {
                                 STRING_ERROR( LEPT_PARSE_INVALID_UNICODE_HEX );
                             }
+                            p = q;
                             if ( u2 < 0xDC00 || u2 > 0xDFFF) {
                                 STRING_ERROR( LEPT_PARSE_INVALID_UNICODE_SURROGATE );
                             }
                             u = (0x10000 + ((u - 0xD800) << 10) + u2 - 0xDC00);
+                        }else if (u >= 0xDC00 && u <= 0xDFFF && (c->options & LEPT_PARSE_STRICT_UTF8)) {
+                            STRING_ERROR( LEPT_PARSE_INVALID_UNICODE_SURROGATE );
                         }
                         lept_encode_utf8(c, u);
                         break;
@@ -462,6 +1211,15 @@ static int lept_parse_string_raw(lept_context* c, char** str, size_t* len) {
                 if ((unsigned char)ch < 0x20) {  /* must change to unsigned char */
                     STRING_ERROR( LEPT_PARSE_INVALID_STRING_CHAR );
                 }
+                if ((unsigned char)ch >= 0x80 && (c->options & LEPT_PARSE_STRICT_UTF8)) {
+                    size_t n = lept_utf8_sequence((const unsigned char*)p - 1);
+                    if (n == 0) {
+                        STRING_ERROR( LEPT_PARSE_INVALID_UTF8 );
+                    }
+                    PUTS(c, p - 1, n);
+                    p += n - 1;
+                    break;
+                }
                 PUTC(c, ch);
                 break;
         }/*end switch*/
@@ -540,11 +1298,56 @@ static int lept_parse_string_old(lept_context* c, lept_value* v) {
 }
 #endif
 
+/* error path: pop every element parsed so far in one go, then free what they own */
+static void lept_context_rollback_array(lept_context* c, size_t size) {
+    lept_value* e = (lept_value*)lept_context_pop(c, sizeof(lept_value) * size);
+    size_t i;
+    for (i = 0; i < size; i++) {
+        if (e[i].type == LEPT_STRING || e[i].type == LEPT_ARRAY || e[i].type == LEPT_OBJECT ||
+            e[i].type == LEPT_PACKED_ARRAY) {
+            lept_free(&e[i]);
+        }
+    }
+}
+
+static void lept_context_rollback_object(lept_context* c, size_t size) {
+    lept_member* m = (lept_member*)lept_context_pop(c, sizeof(lept_member) * size);
+    size_t i;
+    for (i = 0; i < size; i++) {
+        lept_member_free_key(&m[i]);
+        if (m[i].v.type == LEPT_STRING || m[i].v.type == LEPT_ARRAY || m[i].v.type == LEPT_OBJECT ||
+            m[i].v.type == LEPT_PACKED_ARRAY) {
+            lept_free(&m[i].v);
+        }
+    }
+}
+
+/*
+ * with LEPT_PARSE_PACK_NUMBERS the elements go on the stack as bare doubles
+ * while they are all numbers, the first other value turns them into lept_value.
+ */
+static void lept_context_unpack_numbers(lept_context* c, size_t size) {
+    char* base;
+    lept_value e;
+    size_t i;
+    if (size == 0) {
+        return;
+    }
+    lept_context_push(c, (sizeof(lept_value) - sizeof(double)) * size);
+    base = c->stack + c->top - sizeof(lept_value) * size;
+    /* from the back, so no double is overwritten before it is read */
+    e.type = LEPT_NUMBER;
+    for (i = size; i-- > 0; ) {
+        memcpy(&e.u.n, base + sizeof(double) * i, sizeof(double));
+        memcpy(base + sizeof(lept_value) * i, &e, sizeof(lept_value));
+    }
+}
+
 static int lept_parse_array(lept_context* c, lept_value* v) {
     size_t size = 0; /* size of this array */
     int ret;
+    int packed = (c->options & LEPT_PARSE_PACK_NUMBERS) != 0;
     lept_value e;
-    lept_value* tmp;
     assert(c != NULL && v != NULL);
     EXPECT(c, '[');
     lept_parse_whitespace(c);
@@ -552,7 +1355,7 @@ static int lept_parse_array(lept_context* c, lept_value* v) {
         c->json ++;
         v->type = LEPT_ARRAY;
         v->u.a.e = NULL;
-        v->u.a.size = 0;
+        v->u.a.size = v->u.a.capacity = 0;
         return LEPT_PARSE_OK;
     }
     if (*c->json == ',') {
@@ -561,101 +1364,100 @@ static int lept_parse_array(lept_context* c, lept_value* v) {
     for(;;) {
         lept_init(&e);
         lept_parse_whitespace(c);
-        tmp = NULL;
         if ((ret = lept_parse_value(c, &e)) != LEPT_PARSE_OK) {
-            /* roll back */
-            while(size--) {
-                tmp = lept_context_pop(c, sizeof(lept_value));
-                lept_free(tmp);
-            }
-            return ret;
+            break;
+        }
+        if (packed && e.type != LEPT_NUMBER) {
+            lept_context_unpack_numbers(c, size);
+            packed = 0;
         }
         size ++;
-        memcpy(lept_context_push(c, sizeof(lept_value)), &e, sizeof(lept_value));
+        if (packed) {
+            memcpy(lept_context_push(c, sizeof(double)), &e.u.n, sizeof(double));
+        }else {
+            memcpy(lept_context_push(c, sizeof(lept_value)), &e, sizeof(lept_value));
+        }
         lept_parse_whitespace(c);
         if (*c->json == ',') {
             c->json ++;
             continue;
+        }else if ( *c->json == ']' && packed) {
+            c->json ++;
+            v->type = LEPT_PACKED_ARRAY;
+            v->u.p.size = v->u.p.capacity = (lept_size)size;
+            v->u.p.n = (double*) malloc(sizeof(double) * size);
+            LEPT_STATS_ALLOC(sizeof(double) * size);
+            assert(v->u.p.n != NULL);
+            memcpy(v->u.p.n, lept_context_pop(c, sizeof(double) * size), sizeof(double) * size);
+            return LEPT_PARSE_OK;
         }else if ( *c->json == ']'){
             c->json ++;
             v->type = LEPT_ARRAY;
-            v->u.a.size = size;
+            v->u.a.size = v->u.a.capacity = (lept_size)size;
             v->u.a.e = (lept_value*) malloc(sizeof(lept_value)*size);
+            LEPT_STATS_ALLOC(sizeof(lept_value)*size);
             assert(v->u.a.e != NULL);
             memcpy(v->u.a.e,
                    lept_context_pop(c, sizeof(lept_value)*size ),
                    sizeof(lept_value)*size );
             return LEPT_PARSE_OK;
         }else {
-            /* roll back */
-            while(size--) {
-                tmp = lept_context_pop(c, sizeof(lept_value));
-                lept_free(tmp);
-            }
-            return LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
+            ret = LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
+            break;
         }
     }
+    /* roll back */
+    if (packed) {
+        lept_context_pop(c, sizeof(double) * size);
+    }else {
+        lept_context_rollback_array(c, size);
+    }
+    return ret;
 }
 
 static int lept_parse_object (lept_context* c, lept_value* v) {
     size_t size;
     int ret;
-    lept_member* tmp;
     assert(c != NULL && v != NULL);
     size = 0;
     lept_init(v);
-    /* printf("parse lept_object\n"); */
     EXPECT(c, '{');
     lept_parse_whitespace(c);
     if (*c->json == '}') {
         c->json++;
         v->type = LEPT_OBJECT;
-        v->u.o.size = 0;
+        v->u.o.size = v->u.o.capacity = 0;
         v->u.o.m = NULL;
         return LEPT_PARSE_OK;
     }
     for (;;) {
         lept_member m;
         char * str;
-        lept_parse_whitespace(c);
+        size_t klen;
         /* parse lept_member */
-        /* printf("  parse lept_member -- ");printCur(c); */
-        if ((ret = lept_parse_string_raw(c, &str, &(m.klen))) != LEPT_PARSE_OK ) {
-            /* roll back */
-            while(size--) {
-               tmp = lept_context_pop(c, sizeof(lept_member));
-               free(tmp->k);
-               lept_free(&(tmp->v));
-            }
-            return ret;
+        if (*c->json != '\"') {
+            ret = LEPT_PARSE_MISS_KEY;
+            break;
+        }
+        if ((ret = lept_parse_string_raw(c, &str, &klen)) != LEPT_PARSE_OK ) {
+            break;
         }
         /* set key */
-        m.k = (char*) malloc(m.klen+1);
-        memcpy(m.k, str, m.klen);
-        m.k[m.klen] = '\0';
+        lept_member_set_key(&m, str, klen, c->pool);
         lept_parse_whitespace(c);
-        if ((*c->json ++) != ':') {
-            /* roll back */
-            while(size--) {
-               tmp = lept_context_pop(c, sizeof(lept_member));
-               free(tmp->k);
-               lept_free(&(tmp->v));
-            }
-            return LEPT_PARSE_MISS_COLON;
+        if (*c->json != ':') {
+            lept_member_free_key(&m);
+            ret = LEPT_PARSE_MISS_COLON;
+            break;
         }
+        c->json++;
         lept_parse_whitespace(c);
+        lept_init(&m.v);
         if((ret = lept_parse_value(c, &(m.v))) != LEPT_PARSE_OK) {
-            /* roll back */
-            while(size--) {
-               tmp = lept_context_pop(c, sizeof(lept_member));
-               free(tmp->k);
-               lept_free(&(tmp->v));
-            }
-            return ret;
+            lept_member_free_key(&m);
+            break;
         }
-        /* parse lept_member ok */
         /* push lept_member */
-        /* printf("  OK - push lept_member\n"); */
         size ++ ;
         memcpy(lept_context_push(c, sizeof(lept_member)), &m, sizeof(lept_member));
 
@@ -667,69 +1469,524 @@ static int lept_parse_object (lept_context* c, lept_value* v) {
         }else if ( *c->json == '}') {
             c->json++;
             v->type = LEPT_OBJECT;
-            v->u.o.size = size;
+            v->u.o.size = v->u.o.capacity = (lept_size)size;
             v->u.o.m = (lept_member*) malloc(sizeof(lept_member) * size);
+            LEPT_STATS_ALLOC(sizeof(lept_member) * size);
+            assert(v->u.o.m != NULL);
             memcpy( v->u.o.m,
                     lept_context_pop(c, sizeof(lept_member)*size),
                     sizeof(lept_member)*size );
             return LEPT_PARSE_OK;
         }else {
-            /* roll back */
-            while(size--) {
-                tmp = lept_context_pop(c, sizeof(lept_member));
-                free(tmp->k);
-                lept_free(&(tmp->v));
-            }
-            return LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET;
+            ret = LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET;
+            break;
         }
     }
+    /* roll back */
+    lept_context_rollback_object(c, size);
+    return ret;
 }
 
 static int lept_parse_value(lept_context* c, lept_value* v) {
+    int ret;
+    LEPT_STATS_ENTER();
     switch (*c->json) {
-        case 'n':  return lept_parse_literal(c, v, "null", LEPT_NULL);
-        case 'f':  return lept_parse_literal(c, v, "false", LEPT_FALSE);
-        case 't':  return lept_parse_literal(c, v, "true", LEPT_TRUE);
-        case '\0': return LEPT_PARSE_EXPECT_VALUE;
-        case '\"': return lept_parse_string(c, v);
-        case '[' : return lept_parse_array(c, v);
-        case '{' : return lept_parse_object(c, v);
+        case 'n':  ret = lept_parse_literal(c, v, "null", LEPT_NULL); break;
+        case 'f':  ret = lept_parse_literal(c, v, "false", LEPT_FALSE); break;
+        case 't':  ret = lept_parse_literal(c, v, "true", LEPT_TRUE); break;
+        case '\0': ret = LEPT_PARSE_EXPECT_VALUE; break;
+        case '\"': ret = lept_parse_string(c, v); break;
+        case '[' : ret = lept_parse_array(c, v); break;
+        case '{' : ret = lept_parse_object(c, v); break;
         /* default:   return LEPT_PARSE_INVALID_VALUE; */
-        default: return lept_parse_number(c, v);
+        default: ret = lept_parse_number(c, v); break;
+    }
+    LEPT_STATS_LEAVE(v, ret);
+    return ret;
+}
+
+/* line and column are only worked out when the parse failed */
+static void lept_parse_report(const lept_context* c, int ret, lept_parse_result* result) {
+    const char* p;
+    result->code = ret;
+    result->offset = result->line = result->column = 0;
+    if (ret != LEPT_PARSE_OK) {
+        result->offset = c->json - c->first;
+        result->line = result->column = 1;
+        for (p = c->first; p < c->json; p++) {
+            if (*p == '\n') {
+                result->line++;
+                result->column = 1;
+            }else {
+                result->column++;
+            }
+        }
+    }
+}
+
+static int lept_parse_root(lept_context* c, lept_value* v, lept_parse_result* result) {
+    int ret;
+    LEPT_STATS_START(parse);
+    lept_init(v);
+    lept_parse_whitespace(c);
+    if ( (ret = lept_parse_value(c, v)) == LEPT_PARSE_OK ) {
+        lept_parse_whitespace(c);
+        if ( *(c->json) != '\0') {
+            lept_free(v);
+            ret = LEPT_PARSE_ROOT_NOT_SINGULAR;
+        }
     }
+    assert(c->top == 0);
+    if (result != NULL) {
+        lept_parse_report(c, ret, result);
+    }
+    LEPT_STATS_ADD(parsed, 1);
+    LEPT_STATS_ADD(bytes_in, c->json - c->first);
+    LEPT_STATS_STOP(parse);
+    return ret;
 }
 
 /* parse API */
 int lept_parse(lept_value* v, const char* json) {
-    int ret = -1;
+    return lept_parse_interned(v, json, NULL);
+}
+
+int lept_parse_ex(lept_value* v, const char* json, lept_parse_result* result) {
+    int ret;
     lept_context c;
-    assert(v != NULL);
+    assert(v != NULL && json != NULL);
     c.json = json;
     c.first = json;
     c.stack = NULL;
     c.size = c.top = 0;
-    lept_init(v);
-    lept_parse_whitespace(&c);
-    if ( (ret = lept_parse_value(&c, v)) == LEPT_PARSE_OK ) {
-        /* to do */
-        lept_parse_whitespace(&c);
-        if ( *(c.json) != '\0') {
-            return LEPT_PARSE_ROOT_NOT_SINGULAR;
-        }
-    }
-    assert(c.top == 0);
+    c.pool = NULL;
+    c.options = 0;
+    ret = lept_parse_root(&c, v, result);
+    free(c.stack);
+    return ret;
+}
+
+int lept_parse_interned(lept_value* v, const char* json, lept_key_pool* pool) {
+    int ret;
+    lept_context c;
+    assert(v != NULL && json != NULL);
+    c.json = json;
+    c.first = json;
+    c.stack = NULL;
+    c.size = c.top = 0;
+    c.pool = pool;
+    c.options = 0;
+    ret = lept_parse_root(&c, v, NULL);
     free(c.stack);
     return ret;
 }
 
+/* parser API */
+lept_parser* lept_parser_create(void) {
+    lept_parser* p = (lept_parser*) malloc(sizeof(lept_parser));
+    assert(p != NULL);
+    p->stack = NULL;
+    p->size = 0;
+    p->max_retained = LEPT_PARSER_MAX_RETAINED_SIZE;
+    p->pool = NULL;
+    p->options = 0;
+    return p;
+}
+
+void lept_parser_destroy(lept_parser* p) {
+    assert(p != NULL);
+    free(p->stack);
+    free(p);
+}
+
+/* drop the scratch stack if it grew past what the parser may keep */
+void lept_parser_reset(lept_parser* p) {
+    assert(p != NULL);
+    if (p->size > p->max_retained) {
+        free(p->stack);
+        p->stack = NULL;
+        p->size = 0;
+    }
+}
+
+void lept_parser_set_max_retained(lept_parser* p, size_t size) {
+    assert(p != NULL);
+    p->max_retained = size;
+    lept_parser_reset(p);
+}
+
+size_t lept_parser_get_retained(const lept_parser* p) {
+    assert(p != NULL);
+    return p->size;
+}
+
+void lept_parser_set_options(lept_parser* p, int options) {
+    assert(p != NULL);
+    p->options = options;
+}
+
+/* the pool is borrowed, it must outlive the parser's use of it */
+void lept_parser_set_key_pool(lept_parser* p, lept_key_pool* pool) {
+    assert(p != NULL);
+    p->pool = pool;
+}
+
+int lept_parser_parse(lept_parser* p, lept_value* v, const char* json) {
+    return lept_parser_parse_ex(p, v, json, NULL);
+}
+
+int lept_parser_parse_ex(lept_parser* p, lept_value* v, const char* json, lept_parse_result* result) {
+    int ret;
+    lept_context c;
+    assert(p != NULL && v != NULL && json != NULL);
+    c.json = json;
+    c.first = json;
+    c.stack = p->stack;
+    c.size = p->size;
+    c.top = 0;
+    c.pool = p->pool;
+    c.options = p->options;
+    ret = lept_parse_root(&c, v, result);
+    p->stack = c.stack;
+    p->size = c.size;
+    lept_parser_reset(p);
+    return ret;
+}
+
+/****** validate ******/
+
+#ifndef LEPT_VALIDATE_MAX_DEPTH
+#define LEPT_VALIDATE_MAX_DEPTH 1024
+#endif
+
+/* word at a time tests, a size_t holds sizeof(size_t) bytes */
+#define LEPT_ONES           ((size_t)-1 / 255)      /* 0x0101...01 */
+#define LEPT_HIGHS          (LEPT_ONES * 0x80)      /* 0x8080...80 */
+#define LEPT_HAS_LESS(w, n) (((w) - LEPT_ONES * (n)) & ~(w) & LEPT_HIGHS)
+#define LEPT_HAS_BYTE(w, b) LEPT_HAS_LESS((w) ^ (LEPT_ONES * (b)), 1)
+
+#define ISWHITESPACE(ch)    ((ch) == ' ' || (ch) == '\t' || (ch) == '\n' || (ch) == '\r')
+
+static const char* lept_validate_whitespace(const char* p, const char* end) {
+    while (p < end && ISWHITESPACE(*p))
+        p++;
+    return p;
+}
+
+static const char* lept_validate_hex4(const char* p, const char* end, unsigned* u) {
+    if (end - p < 4) {
+        return NULL;
+    }
+    return lept_parse_hex4(p, u);
+}
+
+/* p is just past the opening quote */
+static int lept_validate_string(const char** pp, const char* end, int options) {
+    const char* p = *pp;
+    unsigned u, u2;
+    size_t w, n;
+    /* in strict mode non-ASCII bytes leave the fast path too */
+    size_t high = (options & LEPT_PARSE_STRICT_UTF8) ? LEPT_HIGHS : 0;
+    for (;;) {
+        /* skip plain characters a word at a time */
+        while ((size_t)(end - p) >= sizeof(size_t)) {
+            memcpy(&w, p, sizeof(size_t));
+            if (LEPT_HAS_BYTE(w, '\"') | LEPT_HAS_BYTE(w, '\\') | LEPT_HAS_LESS(w, 0x20) | (w & high)) {
+                break;
+            }
+            p += sizeof(size_t);
+        }
+        if (p == end) {
+            *pp = p;
+            return LEPT_PARSE_MISS_QUOTATION_MARK;
+        }
+        switch (*p) {
+            case '\"':
+                *pp = p + 1;
+                return LEPT_PARSE_OK;
+            case '\\':
+                if (++p == end) {
+                    *pp = p;
+                    return LEPT_PARSE_MISS_QUOTATION_MARK;
+                }
+                switch (*p++) {
+                    case '\"': case '\\': case '/': case 'b':
+                    case 'f':  case 'n':  case 'r': case 't':
+                        break;
+                    case 'u':
+                        if ((p = lept_validate_hex4(p, end, &u)) == NULL) {
+                            *pp = end;
+                            return LEPT_PARSE_INVALID_UNICODE_HEX;
+                        }
+                        if (u >= 0xD800 && u <= 0xDBFF) {
+                            if (end - p < 2 || p[0] != '\\' || p[1] != 'u') {
+                                *pp = p;
+                                return LEPT_PARSE_INVALID_UNICODE_SURROGATE;
+                            }
+                            if ((p = lept_validate_hex4(p + 2, end, &u2)) == NULL) {
+                                *pp = end;
+                                return LEPT_PARSE_INVALID_UNICODE_HEX;
+                            }
+                            if (u2 < 0xDC00 || u2 > 0xDFFF) {
+                                *pp = p;
+                                return LEPT_PARSE_INVALID_UNICODE_SURROGATE;
+                            }
+                        }else if (u >= 0xDC00 && u <= 0xDFFF && (options & LEPT_PARSE_STRICT_UTF8)) {
+                            *pp = p;
+                            return LEPT_PARSE_INVALID_UNICODE_SURROGATE;
+                        }
+                        break;
+                    default:
+                        *pp = p - 1;
+                        return LEPT_PARSE_INVALID_STRING_ESCAPE;
+                }
+                break;
+            default:
+                if ((unsigned char)*p < 0x20) {
+                    *pp = p;
+                    return LEPT_PARSE_INVALID_STRING_CHAR;
+                }
+                if (high && (unsigned char)*p >= 0x80) {
+                    /* copy a possibly truncated sequence so the check never reads past end */
+                    unsigned char seq[4] = { 0, 0, 0, 0 };
+                    memcpy(seq, p, (size_t)(end - p) < 4 ? (size_t)(end - p) : 4);
+                    if ((n = lept_utf8_sequence(seq)) == 0) {
+                        *pp = p;
+                        return LEPT_PARSE_INVALID_UTF8;
+                    }
+                    p += n;
+                    break;
+                }
+                p++;
+                break;
+        }
+    }
+}
+
+/*
+ * same grammar as lept_parse_number. e10 is the decimal exponent of the first
+ * significant digit, strtod() is only needed to tell whether a number
+ * overflows when that is right at the limit, and then it gets the whole text.
+ */
+static int lept_validate_number(const char** pp, const char* end) {
+    const char* p = *pp;
+    const char* first = p;
+    long e10 = -1, exp = 0;
+    int zero = 1, esign = 1;
+    if (p < end && *p == '-') {
+        p++;
+    }
+    if (p < end && *p == '0') {
+        p++;
+    }else if (p < end && ISDIGIT1TO9(*p)) {
+        zero = 0;
+        for (; p < end && ISDIGIT(*p); p++)
+            e10++;
+    }else {
+        *pp = p;
+        return LEPT_PARSE_INVALID_VALUE;
+    }
+    if (p < end && *p == '.') {
+        if (++p == end || !ISDIGIT(*p)) {
+            *pp = p;
+            return LEPT_PARSE_INVALID_VALUE;
+        }
+        for (; p < end && ISDIGIT(*p); p++) {
+            if (zero) {
+                if (*p == '0') {
+                    e10--;
+                }else {
+                    zero = 0;
+                }
+            }
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < end && (*p == '+' || *p == '-')) {
+            esign = (*p++ == '-') ? -1 : 1;
+        }
+        if (p == end || !ISDIGIT(*p)) {
+            *pp = p;
+            return LEPT_PARSE_INVALID_VALUE;
+        }
+        for (; p < end && ISDIGIT(*p); p++) {
+            if (exp < 100000) {
+                exp = exp * 10 + (*p - '0');
+            }
+        }
+    }
+    *pp = p;
+    if (!zero) {
+        e10 += esign * exp;
+        if (e10 > 308) {
+            return LEPT_PARSE_NUMBER_TOO_BIG;
+        }
+        if (e10 == 308) {
+            /* the text is not terminated, copy it, all of it */
+            char buffer[64];
+            char* text = buffer;
+            size_t n = (size_t)(p - first);
+            double d;
+            if (n >= sizeof(buffer)) {
+                text = (char*)malloc(n + 1);
+                LEPT_STATS_ALLOC(n + 1);
+                assert(text != NULL);
+            }
+            memcpy(text, first, n);
+            text[n] = '\0';
+            errno = 0;
+            d = strtod(text, NULL);
+            if (text != buffer) {
+                free(text);
+            }
+            if (errno == ERANGE && (d == HUGE_VAL || d == -HUGE_VAL)) {
+                return LEPT_PARSE_NUMBER_TOO_BIG;
+            }
+        }
+    }
+    return LEPT_PARSE_OK;
+}
+
+static int lept_validate_literal(const char** pp, const char* end, const char* literal, size_t len) {
+    const char* p = *pp;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        if (p + i == end || p[i] != literal[i]) {
+            *pp = p + i;
+            return LEPT_PARSE_INVALID_VALUE;
+        }
+    }
+    *pp = p + len;
+    return LEPT_PARSE_OK;
+}
+
+/*
+ * check json[0, len) against the same grammar as lept_parse without building
+ * anything. containers are tracked by a fixed bit stack, 1 for objects.
+ */
+int lept_validate(const char* json, size_t len) {
+    return lept_validate_ex(json, len, 0);
+}
+
+int lept_validate_ex(const char* json, size_t len, int options) {
+    unsigned char stack[(LEPT_VALIDATE_MAX_DEPTH + 7) / 8];
+    const char* p = json;
+    const char* end = json + len;
+    size_t depth = 0;
+    int ret;
+    assert(json != NULL || len == 0);
+
+#define VALIDATE_IS_OBJECT()    (stack[(depth - 1) >> 3] & (1u << ((depth - 1) & 7)))
+#define VALIDATE_PUSH(object) \
+    do { \
+        if (depth == LEPT_VALIDATE_MAX_DEPTH) \
+            return LEPT_PARSE_TOO_DEEP; \
+        if (object) stack[depth >> 3] |= (unsigned char)(1u << (depth & 7)); \
+        else        stack[depth >> 3] &= (unsigned char)~(1u << (depth & 7)); \
+        depth++; \
+    } while(0)
+
+    p = lept_validate_whitespace(p, end);
+value:
+    if (p == end) {
+        return LEPT_PARSE_EXPECT_VALUE;
+    }
+    switch (*p) {
+        case 'n':  ret = lept_validate_literal(&p, end, "null", 4);  break;
+        case 't':  ret = lept_validate_literal(&p, end, "true", 4);  break;
+        case 'f':  ret = lept_validate_literal(&p, end, "false", 5); break;
+        case '\0': return LEPT_PARSE_EXPECT_VALUE;
+        case '\"':
+            p++;
+            ret = lept_validate_string(&p, end, options);
+            break;
+        case '[':
+            VALIDATE_PUSH(0);
+            p = lept_validate_whitespace(p + 1, end);
+            if (p < end && *p == ']') {
+                p++;
+                depth--;
+                ret = LEPT_PARSE_OK;
+                break;
+            }
+            if (p < end && *p == ',') {
+                return LEPT_PARSE_EXPECT_VALUE;
+            }
+            goto value;
+        case '{':
+            VALIDATE_PUSH(1);
+            p = lept_validate_whitespace(p + 1, end);
+            if (p < end && *p == '}') {
+                p++;
+                depth--;
+                ret = LEPT_PARSE_OK;
+                break;
+            }
+            goto key;
+        default:
+            ret = lept_validate_number(&p, end);
+            break;
+    }
+    if (ret != LEPT_PARSE_OK) {
+        return ret;
+    }
+    /* a value is complete, see what follows it */
+    for (;;) {
+        p = lept_validate_whitespace(p, end);
+        if (depth == 0) {
+            return p == end ? LEPT_PARSE_OK : LEPT_PARSE_ROOT_NOT_SINGULAR;
+        }
+        if (VALIDATE_IS_OBJECT()) {
+            if (p < end && *p == ',') {
+                p = lept_validate_whitespace(p + 1, end);
+                goto key;
+            }
+            if (p == end || *p != '}') {
+                return LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET;
+            }
+        }else {
+            if (p < end && *p == ',') {
+                p = lept_validate_whitespace(p + 1, end);
+                goto value;
+            }
+            if (p == end || *p != ']') {
+                return LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
+            }
+        }
+        p++;
+        depth--;
+    }
+key:
+    if (p == end || *p != '\"') {
+        return LEPT_PARSE_MISS_KEY;
+    }
+    p++;
+    if ((ret = lept_validate_string(&p, end, options)) != LEPT_PARSE_OK) {
+        return ret;
+    }
+    p = lept_validate_whitespace(p, end);
+    if (p == end || *p != ':') {
+        return LEPT_PARSE_MISS_COLON;
+    }
+    p = lept_validate_whitespace(p + 1, end);
+    goto value;
+
+#undef VALIDATE_IS_OBJECT
+#undef VALIDATE_PUSH
+}
+
 static int lept_stringify_value(lept_context* c, const lept_value* v);
-/* stringify API */
-int lept_stringify(const lept_value* v, char** json, size_t* length) {
+
+static int lept_stringify_with(const lept_value* v, char** json, size_t* length, int options) {
     int ret;
     lept_context c;
     assert(v!= NULL && json != NULL);
+    LEPT_STATS_START(stringify);
     c.stack = (char*)malloc(c.size = LEPT_PARSE_STRINGIFY_INIT_SIZE);
+    LEPT_STATS_ALLOC(c.size);
     c.top = 0;
+    c.options = options;
     if ((ret = lept_stringify_value(&c, v)) != LEPT_STRINGIFY_OK) {
         if (length) {
             *length = 0;
@@ -741,11 +1998,24 @@ int lept_stringify(const lept_value* v, char** json, size_t* length) {
     if (length) {
         *length = c.top;
     }
+    LEPT_STATS_ADD(stringified, 1);
+    LEPT_STATS_ADD(bytes_out, c.top);
+    LEPT_STATS_STOP(stringify);
     PUTC(&c, '\0');
     *json = c.stack;
     return LEPT_STRINGIFY_OK;
 }
 
+/* stringify API */
+int lept_stringify(const lept_value* v, char** json, size_t* length) {
+    return lept_stringify_with(v, json, length, 0);
+}
+
+/* RFC 8785 (JCS): sorted keys, shortest numbers, minimal escapes. equal values give equal bytes */
+int lept_stringify_canonical(const lept_value* v, char** json, size_t* length) {
+    return lept_stringify_with(v, json, length, LEPT_STRINGIFY_CANONICAL);
+}
+
 static int lept_stringify_string(lept_context* c , const char* str, size_t len) {
     size_t i;
     char buffer[7];
@@ -764,7 +2034,7 @@ static int lept_stringify_string(lept_context* c , const char* str, size_t len)
             case '\t' :     PUTS(c, "\\t", 2);  break;
             default :
                 if (ch < 0x20) {
-                    sprintf(buffer, "\\u%04X", ch);
+                    sprintf(buffer, (c->options & LEPT_STRINGIFY_CANONICAL) ? "\\u%04x" : "\\u%04X", ch);
                     PUTS(c, buffer, 6);
                 }else {
                     PUTC(c, str[i]);
@@ -776,18 +2046,168 @@ static int lept_stringify_string(lept_context* c , const char* str, size_t len)
     return LEPT_STRINGIFY_OK;
 }
 
-static int lept_stringify_value(lept_context* c, const lept_value* v) {
-    size_t i, length;
+/*
+ * shortest digits that read back as the same double, laid out the way
+ * ECMAScript Number.prototype.toString() does. buffer holds at least 32 chars.
+ */
+static size_t lept_stringify_number_canonical(char* buffer, double n) {
+    char digits[32];
+    char* p = buffer;
+    const char* q;
+    int precision, exponent, k, i;
+    if (n == 0.0) {
+        *p = '0';       /* -0 too */
+        return 1;
+    }
+    if (n < 0) {
+        *p++ = '-';
+        n = -n;
+    }
+    /*
+     * a normal double that has a representation of 15 digits or less rounds
+     * to it at 15 digits, past that 16 may do and 17 always does.
+     * subnormals have fewer bits, so their search starts from one digit.
+     */
+    for (precision = n < DBL_MIN ? 0 : 14; ; precision++) {
+        sprintf(digits, "%.*e", precision, n);
+        if (precision == 16 || strtod(digits, NULL) == n) {
+            break;
+        }
+    }
+    /* "d.ddde+x" to bare digits and the position of the decimal point */
+    exponent = atoi(strchr(digits, 'e') + 1) + 1;
+    for (k = 0, q = digits; *q != 'e'; q++) {
+        if (*q != '.') {
+            digits[k++] = *q;
+        }
+    }
+    while (k > 1 && digits[k - 1] == '0') {
+        k--;
+    }
+    if (k <= exponent && exponent <= 21) {
+        memcpy(p, digits, k);
+        for (p += k, i = k; i < exponent; i++) {
+            *p++ = '0';
+        }
+    }else if (0 < exponent && exponent <= 21) {
+        memcpy(p, digits, exponent);
+        p += exponent;
+        *p++ = '.';
+        memcpy(p, digits + exponent, k - exponent);
+        p += k - exponent;
+    }else if (-6 < exponent && exponent <= 0) {
+        *p++ = '0';
+        *p++ = '.';
+        for (i = exponent; i < 0; i++) {
+            *p++ = '0';
+        }
+        memcpy(p, digits, k);
+        p += k;
+    }else {
+        *p++ = digits[0];
+        if (k > 1) {
+            *p++ = '.';
+            memcpy(p, digits + 1, k - 1);
+            p += k - 1;
+        }
+        p += sprintf(p, "e%c%d", exponent > 0 ? '+' : '-', exponent > 0 ? exponent - 1 : 1 - exponent);
+    }
+    return p - buffer;
+}
+
+/*
+ * keys in UTF-16 code unit order. that is UTF-8 byte order, except that
+ * characters past U+FFFF are surrogate pairs in UTF-16 and come before U+E000.
+ * so a 4 byte lead is weighed between 0xED and 0xEE.
+ */
+#define LEPT_UTF16_WEIGHT(ch)   ((ch) >= 0xF0 ? 0xED * 2 + 1 : (ch) * 2)
+
+static int lept_member_key_compare_utf16(const void* lhs, const void* rhs) {
+    const lept_member* l = *(const lept_member* const*)lhs;
+    const lept_member* r = *(const lept_member* const*)rhs;
+    const unsigned char* lk = (const unsigned char*)LEPT_MEMBER_KEY(l);
+    const unsigned char* rk = (const unsigned char*)LEPT_MEMBER_KEY(r);
+    size_t i, n = l->klen < r->klen ? l->klen : r->klen;
+    for (i = 0; i < n; i++) {
+        if (lk[i] != rk[i]) {
+            return LEPT_UTF16_WEIGHT(lk[i]) < LEPT_UTF16_WEIGHT(rk[i]) ? -1 : 1;
+        }
+    }
+    if (l->klen != r->klen) {
+        return l->klen < r->klen ? -1 : 1;
+    }
+    return l < r ? -1 : l > r;  /* duplicate keys keep their order */
+}
+
+/* members go out through a sorted view, the object itself is not touched */
+static int lept_stringify_object_canonical(lept_context* c, const lept_value* v) {
+    const lept_member** view;
+    size_t i, size = v->u.o.size;
+    int ret = LEPT_STRINGIFY_OK;
+    view = (const lept_member**) malloc(sizeof(const lept_member*) * size);
+    LEPT_STATS_ALLOC(sizeof(const lept_member*) * size);
+    assert(view != NULL);
+    for (i = 0; i < size; i++) {
+        view[i] = &v->u.o.m[i];
+    }
+    /* objects written out canonically before are sorted already */
+    for (i = 1; i < size && lept_member_key_compare_utf16(&view[i - 1], &view[i]) < 0; i++)
+        ;
+    if (i < size) {
+        qsort(view, size, sizeof(const lept_member*), lept_member_key_compare_utf16);
+    }
+    PUTC(c, '{');
+    for (i = 0; i < size && ret == LEPT_STRINGIFY_OK; i++) {
+        if (i > 0) {
+            PUTC(c, ',');
+        }
+        if ((ret = lept_stringify_string(c, LEPT_MEMBER_KEY(view[i]), view[i]->klen)) == LEPT_STRINGIFY_OK) {
+            PUTC(c, ':');
+            ret = lept_stringify_value(c, &view[i]->v);
+        }
+    }
+    PUTC(c, '}');
+    free(view);
+    return ret;
+}
+
+/* JSON has no infinity or NaN, and RFC 8785 forbids them */
+static int lept_stringify_number(lept_context* c, double n) {
     char* buffer;
+    size_t length;
+    if (n != n || n - n != 0) {
+        return LEPT_STRINGIFY_INVALID_TYPE;
+    }
+    buffer = lept_context_push(c, 32);
+    if (c->options & LEPT_STRINGIFY_CANONICAL) {
+        length = lept_stringify_number_canonical(buffer, n);
+    }else {
+        length = sprintf(buffer, "%.17g", n);
+    }
+    c->top -= (32 - length) ;
+    return LEPT_STRINGIFY_OK;
+}
+
+static int lept_stringify_value(lept_context* c, const lept_value* v) {
+    size_t i;
     int ret;
     switch(v->type) {
         case LEPT_NULL:     PUTS(c, "null", 4);     break;
         case LEPT_FALSE:    PUTS(c, "false", 5);    break;
         case LEPT_TRUE:     PUTS(c, "true", 4);     break;
         case LEPT_NUMBER:
-            buffer = lept_context_push(c, 32);
-            length = sprintf(buffer, "%.17g", v->u.n);
-            c->top -= (32 - length) ;
+            return lept_stringify_number(c, v->u.n);
+        case LEPT_PACKED_ARRAY:
+            PUTC(c, '[');
+            for (i = 0; i < v->u.p.size; i++) {
+                if (i > 0) {
+                    PUTC(c, ',');
+                }
+                if ((ret = lept_stringify_number(c, v->u.p.n[i])) != LEPT_STRINGIFY_OK) {
+                    return ret;
+                }
+            }
+            PUTC(c, ']');
             break;
         case LEPT_ARRAY:
             PUTC(c,'[');
@@ -802,12 +2222,15 @@ static int lept_stringify_value(lept_context* c, const lept_value* v) {
             PUTC(c, ']');
             break;
         case LEPT_OBJECT:
+            if ((c->options & LEPT_STRINGIFY_CANONICAL) && v->u.o.size > 1) {
+                return lept_stringify_object_canonical(c, v);
+            }
             PUTC(c,'{');
             for (i = 0; i< v->u.o.size; i++) {
                 if (i > 0) {
                     PUTC(c, ',');
                 }
-                if ((ret = lept_stringify_string(c, v->u.o.m[i].k, v->u.o.m[i].klen)) != LEPT_STRINGIFY_OK ) {
+                if ((ret = lept_stringify_string(c, LEPT_MEMBER_KEY(&v->u.o.m[i]), v->u.o.m[i].klen)) != LEPT_STRINGIFY_OK ) {
                     return ret;
                 }
                 PUTC(c, ':');
@@ -818,7 +2241,7 @@ static int lept_stringify_value(lept_context* c, const lept_value* v) {
             PUTC(c, '}');
             break;
         case LEPT_STRING:
-            if ((ret = lept_stringify_string(c, v->u.s.s, v->u.s.len)) != LEPT_STRINGIFY_OK) {
+            if ((ret = lept_stringify_string(c, lept_get_string(v), v->u.s.len)) != LEPT_STRINGIFY_OK) {
                 return ret;
             }
             break;
@@ -830,13 +2253,36 @@ static int lept_stringify_value(lept_context* c, const lept_value* v) {
 /* you must free json by yourself */
 
 
+/* packed or not, element by element */
+static int lept_is_equal_packed(const lept_value* lhs, const lept_value* rhs) {
+    size_t i;
+    if (lhs->type != LEPT_PACKED_ARRAY) {
+        const lept_value* t = lhs;
+        lhs = rhs;
+        rhs = t;
+    }
+    if (lhs->u.p.size != rhs->u.a.size) {
+        return 0;
+    }
+    for (i = 0; i < lhs->u.p.size; i++) {
+        if (rhs->type == LEPT_PACKED_ARRAY ? lhs->u.p.n[i] != rhs->u.p.n[i] :
+            rhs->u.a.e[i].type != LEPT_NUMBER || lhs->u.p.n[i] != rhs->u.a.e[i].u.n) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
 /* compare API */
 int lept_is_equal(const lept_value* lhs, const lept_value* rhs) {
     size_t i;
     assert(lhs != NULL && rhs != NULL);
-    if (lhs->type != rhs->type) {
+    if (lept_get_type(lhs) != lept_get_type(rhs)) {
         return 0;
     } 
+    if (lhs->type == LEPT_PACKED_ARRAY || rhs->type == LEPT_PACKED_ARRAY) {
+        return lept_is_equal_packed(lhs, rhs);
+    }
     switch(lhs->type) {
         case LEPT_ARRAY:
             if (lhs->u.a.size != rhs->u.a.size) {
@@ -853,18 +2299,3455 @@ int lept_is_equal(const lept_value* lhs, const lept_value* rhs) {
                 return 0;
             }
             for (i = 0; i < lhs->u.o.size; i++) {
-                if (lhs->u.o.m[i].klen != rhs->u.o.m[i].klen ||
-                    memcmp(lhs->u.o.m[i].k, rhs->u.o.m[i].k, lhs->u.o.m[i].klen) != 0 ||
+                if (!lept_member_key_equal(&lhs->u.o.m[i], &rhs->u.o.m[i]) ||
                     !lept_is_equal(&(lhs->u.o.m[i].v), &(rhs->u.o.m[i].v)) ) {
                     return 0;
                 }
             }
             return 1;
         case LEPT_STRING:
-            return lhs->u.s.len == rhs->u.s.len && memcmp(lhs->u.s.s, rhs->u.s.s, lhs->u.s.len) == 0;
+            return lhs->u.s.len == rhs->u.s.len &&
+                   memcmp(lept_get_string(lhs), lept_get_string(rhs), lhs->u.s.len) == 0;
         case LEPT_NUMBER:
             return lhs->u.n == rhs->u.n;
         default: 
             return 1;
     }
 }
+
+
+/****** hash ******/
+
+#define LEPT_HASH_HALF      (sizeof(size_t) * 4)
+
+/* fmix style finaliser, the constants fit any size_t */
+static size_t lept_hash_mix(size_t h) {
+    h ^= h >> LEPT_HASH_HALF;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> LEPT_HASH_HALF;
+    return h;
+}
+
+/* a word at a time, unlike lept_hash_bytes() this is meant for long strings */
+static size_t lept_hash_words(const char* s, size_t len, size_t h) {
+    size_t w;
+    h ^= len * 0x9E3779B9u;
+    for (; len >= sizeof(size_t); s += sizeof(size_t), len -= sizeof(size_t)) {
+        memcpy(&w, s, sizeof(size_t));
+        h = lept_hash_mix(h ^ w) + 0x9E3779B9u;
+    }
+    if (len > 0) {
+        w = 0;
+        memcpy(&w, s, len);
+        h = lept_hash_mix(h ^ w);
+    }
+    return h;
+}
+
+/*
+ * equal values by lept_is_equal_unordered() hash equal. members are summed so
+ * the order of an object does not matter, elements are chained so it does.
+ * the result depends on the byte order of the machine.
+ */
+static size_t lept_hash_number(double n) {
+    n = n == 0.0 ? 0.0 : n;     /* -0 == 0 */
+    return lept_hash_words((const char*)&n, sizeof(double), LEPT_NUMBER);
+}
+
+size_t lept_hash(const lept_value* v) {
+    size_t i, h;
+    assert(v != NULL);
+    switch (v->type) {
+        case LEPT_NUMBER:
+            return lept_hash_number(v->u.n);
+        case LEPT_PACKED_ARRAY:
+            h = lept_hash_mix(LEPT_ARRAY + v->u.p.size);
+            for (i = 0; i < v->u.p.size; i++) {
+                h = lept_hash_mix(h ^ lept_hash_number(v->u.p.n[i])) + 0x9E3779B9u;
+            }
+            return h;
+        case LEPT_STRING:
+            return lept_hash_words(lept_get_string(v), v->u.s.len, LEPT_STRING);
+        case LEPT_ARRAY:
+            h = lept_hash_mix(LEPT_ARRAY + v->u.a.size);
+            for (i = 0; i < v->u.a.size; i++) {
+                h = lept_hash_mix(h ^ lept_hash(&v->u.a.e[i])) + 0x9E3779B9u;
+            }
+            return h;
+        case LEPT_OBJECT:
+            h = 0;
+            for (i = 0; i < v->u.o.size; i++) {
+                const lept_member* m = &v->u.o.m[i];
+                h += lept_hash_mix(lept_hash_words(LEPT_MEMBER_KEY(m), m->klen, LEPT_OBJECT) ^ lept_hash(&m->v));
+            }
+            return lept_hash_mix(h ^ (LEPT_OBJECT + v->u.o.size));
+        default:
+            return lept_hash_mix(v->type);
+    }
+}
+
+/* any total order will do, ties keep the order of the members in memory */
+static int lept_member_key_compare(const void* lhs, const void* rhs) {
+    const lept_member* l = *(const lept_member* const*)lhs;
+    const lept_member* r = *(const lept_member* const*)rhs;
+    int ret;
+    if (l->klen != r->klen) {
+        return l->klen < r->klen ? -1 : 1;
+    }
+    if ((ret = memcmp(LEPT_MEMBER_KEY(l), LEPT_MEMBER_KEY(r), l->klen)) != 0) {
+        return ret;
+    }
+    return l < r ? -1 : l > r;
+}
+
+static int lept_is_equal_object_unordered(const lept_value* lhs, const lept_value* rhs) {
+    const lept_member** view;
+    size_t i, size = lhs->u.o.size;
+    int ret = 1;
+    /* same key order, the common case, needs no sorting */
+    for (i = 0; i < size && lept_member_key_equal(&lhs->u.o.m[i], &rhs->u.o.m[i]); i++)
+        ;
+    if (i == size) {
+        for (i = 0; i < size; i++) {
+            if (!lept_is_equal_unordered(&lhs->u.o.m[i].v, &rhs->u.o.m[i].v)) {
+                return 0;
+            }
+        }
+        return 1;
+    }
+    /* sorted views of both objects, the values themselves are left alone */
+    view = (const lept_member**) malloc(sizeof(const lept_member*) * size * 2);
+    LEPT_STATS_ALLOC(sizeof(const lept_member*) * size * 2);
+    assert(view != NULL);
+    for (i = 0; i < size; i++) {
+        view[i] = &lhs->u.o.m[i];
+        view[size + i] = &rhs->u.o.m[i];
+    }
+    qsort(view, size, sizeof(const lept_member*), lept_member_key_compare);
+    qsort(view + size, size, sizeof(const lept_member*), lept_member_key_compare);
+    for (i = 0; i < size && ret; i++) {
+        ret = lept_member_key_equal(view[i], view[size + i]) &&
+              lept_is_equal_unordered(&view[i]->v, &view[size + i]->v);
+    }
+    free(view);
+    return ret;
+}
+
+/* like lept_is_equal(), but members may come in any order */
+int lept_is_equal_unordered(const lept_value* lhs, const lept_value* rhs) {
+    size_t i;
+    assert(lhs != NULL && rhs != NULL);
+    if (lept_get_type(lhs) != lept_get_type(rhs)) {
+        return 0;
+    }
+    if (lhs->type == LEPT_PACKED_ARRAY || rhs->type == LEPT_PACKED_ARRAY) {
+        return lept_is_equal_packed(lhs, rhs);
+    }
+    switch (lhs->type) {
+        case LEPT_ARRAY:
+            if (lhs->u.a.size != rhs->u.a.size) {
+                return 0;
+            }
+            for (i = 0; i < lhs->u.a.size; i++) {
+                if (!lept_is_equal_unordered(&lhs->u.a.e[i], &rhs->u.a.e[i])) {
+                    return 0;
+                }
+            }
+            return 1;
+        case LEPT_OBJECT:
+            return lhs->u.o.size == rhs->u.o.size && lept_is_equal_object_unordered(lhs, rhs);
+        default:
+            return lept_is_equal(lhs, rhs);
+    }
+}
+
+
+/****** JSON pointer (RFC 6901) ******/
+
+#define LEPT_POINTER_NO_INDEX ((size_t)-1)
+
+/* one reference token, unescaped, with everything lookup needs worked out up front */
+typedef struct {
+    const char* key;
+    size_t klen;
+    size_t hash;
+    size_t index;       /* LEPT_POINTER_NO_INDEX when the token is not an array index */
+}lept_pointer_token;
+
+/* one allocation: this header, the tokens, then their NUL terminated keys */
+struct lept_pointer {
+    size_t size;
+    lept_pointer_token* token;
+};
+
+/* "0" or [1-9][0-9]*, anything else (including "-") never matches an element */
+static size_t lept_pointer_index(const char* s, size_t len) {
+    size_t i, index = 0;
+    if (len == 0 || (len > 1 && s[0] == '0')) {
+        return LEPT_POINTER_NO_INDEX;
+    }
+    for (i = 0; i < len; i++) {
+        if (!ISDIGIT(s[i]) || index > (LEPT_POINTER_NO_INDEX - 1 - (s[i] - '0')) / 10) {
+            return LEPT_POINTER_NO_INDEX;
+        }
+        index = index * 10 + (s[i] - '0');
+    }
+    return index;
+}
+
+lept_pointer* lept_pointer_compile(const char* path, size_t len) {
+    lept_pointer* p;
+    char* buffer;
+    size_t i, size = 0;
+    assert(path != NULL || len == 0);
+    if (len > 0 && path[0] != '/') {
+        return NULL;
+    }
+    for (i = 0; i < len; i++) {
+        if (path[i] == '/') {
+            size++;
+        }else if (path[i] == '~' && (i + 1 == len || (path[i + 1] != '0' && path[i + 1] != '1'))) {
+            return NULL;
+        }
+    }
+    /* unescaped keys are never longer than the path, each gets a '\0' */
+    p = (lept_pointer*) malloc(sizeof(lept_pointer) + sizeof(lept_pointer_token) * size + len + size);
+    LEPT_STATS_ALLOC(sizeof(lept_pointer) + sizeof(lept_pointer_token) * size + len + size);
+    assert(p != NULL);
+    p->size = size;
+    p->token = (lept_pointer_token*)(p + 1);
+    buffer = (char*)(p->token + size);
+    for (i = 0, size = 0; i < len; size++) {
+        lept_pointer_token* t = &p->token[size];
+        t->key = buffer;
+        for (i++; i < len && path[i] != '/'; i++) {
+            if (path[i] == '~') {
+                *buffer++ = path[++i] == '0' ? '~' : '/';
+            }else {
+                *buffer++ = path[i];
+            }
+        }
+        t->klen = buffer - t->key;
+        *buffer++ = '\0';
+        t->hash = lept_hash_bytes(t->key, t->klen);
+        t->index = lept_pointer_index(t->key, t->klen);
+    }
+    return p;
+}
+
+void lept_pointer_free(lept_pointer* p) {
+    free(p);
+}
+
+size_t lept_pointer_get_size(const lept_pointer* p) {
+    assert(p != NULL);
+    return p->size;
+}
+
+const char* lept_pointer_get_token(const lept_pointer* p, size_t index, size_t* klen) {
+    assert(p != NULL && index < p->size);
+    if (klen != NULL) {
+        *klen = p->token[index].klen;
+    }
+    return p->token[index].key;
+}
+
+/* long keys carry their hash, so most mismatches never reach memcmp() */
+static lept_value* lept_pointer_member(const lept_value* v, const lept_pointer_token* t) {
+    size_t i;
+    for (i = 0; i < v->u.o.size; i++) {
+        const lept_member* m = &v->u.o.m[i];
+        if (m->klen != t->klen) {
+            continue;
+        }
+        if (m->klen < LEPT_SHORT_KEY_SIZE) {
+            if (memcmp(m->k.s, t->key, t->klen) == 0) {
+                return &v->u.o.m[i].v;
+            }
+        }else if (LEPT_KEY(m->k.p)->hash == t->hash && memcmp(m->k.p, t->key, t->klen) == 0) {
+            return &v->u.o.m[i].v;
+        }
+    }
+    return NULL;
+}
+
+/* a packed element is written to *number, or is not found when number is NULL */
+static const lept_value* lept_pointer_walk(const lept_value* v, const lept_pointer* p, lept_value* number) {
+    size_t i;
+    assert(v != NULL && p != NULL);
+    for (i = 0; i < p->size && v != NULL; i++) {
+        const lept_pointer_token* t = &p->token[i];
+        switch (v->type) {
+            case LEPT_OBJECT:
+                v = lept_pointer_member(v, t);
+                break;
+            case LEPT_PACKED_ARRAY:
+                v = number != NULL && t->index < v->u.p.size ? lept_peek_array_element(v, t->index, number) : NULL;
+                break;
+            case LEPT_ARRAY:
+                v = t->index < v->u.a.size ? &v->u.a.e[t->index] : NULL;
+                break;
+            default:
+                v = NULL;
+                break;
+        }
+    }
+    return v;
+}
+
+/* no parsing and no allocation, NULL when the path does not resolve or ends in a packed array */
+lept_value* lept_pointer_get(const lept_value* v, const lept_pointer* p) {
+    return (lept_value*)lept_pointer_walk(v, p, NULL);
+}
+
+/* never changes v, an element of a packed array is written to *number and that is returned */
+const lept_value* lept_pointer_peek(const lept_value* v, const lept_pointer* p, lept_value* number) {
+    assert(number != NULL);
+    return lept_pointer_walk(v, p, number);
+}
+
+
+/****** projected parse ******/
+
+/* the path indices still alive at this depth sit on the context stack at base */
+#define PROJECT_PATH(i)     (paths[((const size_t*)(c->stack + base))[i]])
+
+static int lept_parse_projected_value(lept_context* c, lept_value* v,
+    const lept_pointer* const* paths, size_t base, size_t count, size_t depth, int* found);
+
+/*
+ * step over one value by bracket and quote counting only, nothing is decoded.
+ * a skipped subtree is therefore not checked beyond its brackets matching.
+ * the open brackets go on the context stack, so it nests as deep as lept_parse.
+ */
+#define SKIP_ERROR(ret) do { c->top = head; c->json = p; return ret; } while(0)
+
+static int lept_skip_value(lept_context* c) {
+    const char* p = c->json;
+    const char* q;
+    size_t head = c->top;
+    do {
+        switch (*p) {
+            case '\0':
+                SKIP_ERROR(c->top > head ? LEPT_PARSE_INVALID_VALUE : LEPT_PARSE_EXPECT_VALUE);
+            case '\"':
+                for (p++; *p != '\"'; p++) {
+                    if (*p == '\0') {
+                        SKIP_ERROR(LEPT_PARSE_MISS_QUOTATION_MARK);
+                    }
+                    if (*p == '\\' && p[1] != '\0') {
+                        p++;
+                    }
+                }
+                p++;
+                break;
+            case '[':
+            case '{':
+                *(char*)lept_context_push(c, 1) = *p++;
+                break;
+            case ']':
+            case '}':
+                if (c->top == head) {
+                    SKIP_ERROR(LEPT_PARSE_INVALID_VALUE);
+                }
+                if (*(char*)lept_context_pop(c, 1) != (*p == ']' ? '[' : '{')) {
+                    SKIP_ERROR(*p == ']' ? LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET : LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET);
+                }
+                p++;
+                break;
+            default:
+                if (c->top > head) {
+                    p++;
+                    break;
+                }
+                /* a bare literal or number runs up to the next delimiter */
+                for (q = p; *p != '\0' && strchr(",]} \t\n\r", *p) == NULL; p++)
+                    ;
+                if (p == q) {
+                    SKIP_ERROR(LEPT_PARSE_INVALID_VALUE);
+                }
+                break;
+        }
+    } while (c->top > head);
+    c->json = p;
+    return LEPT_PARSE_OK;
+}
+
+static int lept_pointer_token_is(const lept_pointer_token* t, const char* key, size_t klen) {
+    return t->klen == klen && memcmp(t->key, key, klen) == 0;
+}
+
+static int lept_parse_projected_array(lept_context* c, lept_value* v,
+    const lept_pointer* const* paths, size_t base, size_t count, size_t depth) {
+    size_t i, index, head, path, size = 0;
+    int ret, found;
+    lept_value e;
+    EXPECT(c, '[');
+    lept_parse_whitespace(c);
+    if (*c->json == ']') {
+        c->json++;
+        lept_set_array(v, 0);
+        return LEPT_PARSE_OK;
+    }
+    if (*c->json == ',') {
+        return LEPT_PARSE_EXPECT_VALUE;
+    }
+    for (index = 0;; index++) {
+        lept_parse_whitespace(c);
+        head = c->top;
+        for (i = 0; i < count; i++) {
+            if (PROJECT_PATH(i)->token[depth].index == index) {
+                /* the push may move the stack, read the index first */
+                path = ((const size_t*)(c->stack + base))[i];
+                *(size_t*)lept_context_push(c, sizeof(size_t)) = path;
+            }
+        }
+        found = 0;
+        if (c->top == head) {
+            ret = lept_skip_value(c);
+        }else {
+            lept_init(&e);
+            ret = lept_parse_projected_value(c, &e, paths, head, (c->top - head) / sizeof(size_t), depth + 1, &found);
+            c->top = head;
+        }
+        if (ret != LEPT_PARSE_OK) {
+            break;
+        }
+        if (found) {
+            /* keep the requested index, elements in between become null */
+            for (; size < index; size++) {
+                lept_init((lept_value*)lept_context_push(c, sizeof(lept_value)));
+            }
+            size++;
+            memcpy(lept_context_push(c, sizeof(lept_value)), &e, sizeof(lept_value));
+        }
+        lept_parse_whitespace(c);
+        if (*c->json == ',') {
+            c->json++;
+            continue;
+        }else if (*c->json == ']') {
+            c->json++;
+            lept_set_array(v, size);
+            v->u.a.size = (lept_size)size;
+            if (size > 0) {
+                memcpy(v->u.a.e, lept_context_pop(c, sizeof(lept_value) * size), sizeof(lept_value) * size);
+            }
+            return LEPT_PARSE_OK;
+        }else {
+            ret = LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
+            break;
+        }
+    }
+    /* roll back */
+    lept_context_rollback_array(c, size);
+    return ret;
+}
+
+static int lept_parse_projected_object(lept_context* c, lept_value* v,
+    const lept_pointer* const* paths, size_t base, size_t count, size_t depth) {
+    size_t i, head, matched, path, size = 0;
+    int ret, found;
+    EXPECT(c, '{');
+    lept_parse_whitespace(c);
+    if (*c->json == '}') {
+        c->json++;
+        lept_set_object(v, 0);
+        return LEPT_PARSE_OK;
+    }
+    for (;;) {
+        lept_member m;
+        char* str;
+        size_t klen;
+        if (*c->json != '\"') {
+            ret = LEPT_PARSE_MISS_KEY;
+            break;
+        }
+        if ((ret = lept_parse_string_raw(c, &str, &klen)) != LEPT_PARSE_OK) {
+            break;
+        }
+        for (i = 0, matched = 0; i < count; i++) {
+            matched += lept_pointer_token_is(&PROJECT_PATH(i)->token[depth], str, klen);
+        }
+        lept_parse_whitespace(c);
+        if (*c->json != ':') {
+            ret = LEPT_PARSE_MISS_COLON;
+            break;
+        }
+        c->json++;
+        lept_parse_whitespace(c);
+        if (matched == 0) {
+            if ((ret = lept_skip_value(c)) != LEPT_PARSE_OK) {
+                break;
+            }
+        }else {
+            /* str lives in the popped part of the stack, take the key before pushing */
+            lept_member_set_key(&m, str, klen, c->pool);
+            head = c->top;
+            for (i = 0; i < count; i++) {
+                if (lept_pointer_token_is(&PROJECT_PATH(i)->token[depth], LEPT_MEMBER_KEY(&m), klen)) {
+                    path = ((const size_t*)(c->stack + base))[i];
+                    *(size_t*)lept_context_push(c, sizeof(size_t)) = path;
+                }
+            }
+            lept_init(&m.v);
+            ret = lept_parse_projected_value(c, &m.v, paths, head, matched, depth + 1, &found);
+            c->top = head;
+            if (ret != LEPT_PARSE_OK) {
+                lept_member_free_key(&m);
+                break;
+            }
+            if (found) {
+                size++;
+                memcpy(lept_context_push(c, sizeof(lept_member)), &m, sizeof(lept_member));
+            }else {
+                lept_member_free_key(&m);
+            }
+        }
+        lept_parse_whitespace(c);
+        if (*c->json == ',') {
+            c->json++;
+            lept_parse_whitespace(c);
+            continue;
+        }else if (*c->json == '}') {
+            c->json++;
+            lept_set_object(v, size);
+            v->u.o.size = (lept_size)size;
+            if (size > 0) {
+                memcpy(v->u.o.m, lept_context_pop(c, sizeof(lept_member) * size), sizeof(lept_member) * size);
+            }
+            return LEPT_PARSE_OK;
+        }else {
+            ret = LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET;
+            break;
+        }
+    }
+    /* roll back */
+    lept_context_rollback_object(c, size);
+    return ret;
+}
+
+/*
+ * *found is 0 when no requested path reaches a value through this one, v is
+ * null then. a container is kept only for what is found inside it.
+ */
+static int lept_parse_projected_value(lept_context* c, lept_value* v,
+    const lept_pointer* const* paths, size_t base, size_t count, size_t depth, int* found) {
+    size_t i;
+    int ret;
+    *found = 1;
+    if (count == 0) {
+        *found = 0;
+        return lept_skip_value(c);
+    }
+    for (i = 0; i < count; i++) {
+        if (PROJECT_PATH(i)->size == depth) {
+            return lept_parse_value(c, v);
+        }
+    }
+    switch (*c->json) {
+        case '[':
+            ret = lept_parse_projected_array(c, v, paths, base, count, depth);
+            break;
+        case '{':
+            ret = lept_parse_projected_object(c, v, paths, base, count, depth);
+            break;
+        default:
+            *found = 0;
+            return lept_skip_value(c);
+    }
+    if (ret == LEPT_PARSE_OK && (v->type == LEPT_OBJECT ? v->u.o.size : v->u.a.size) == 0) {
+        *found = 0;
+        lept_free(v);
+    }
+    return ret;
+}
+
+int lept_parse_projected(lept_value* v, const char* json, const lept_pointer* const* paths, size_t n) {
+    int ret, found;
+    size_t i;
+    lept_context c;
+    assert(v != NULL && json != NULL && (paths != NULL || n == 0));
+    c.json = json;
+    c.first = json;
+    c.stack = NULL;
+    c.size = c.top = 0;
+    c.pool = NULL;
+    c.options = 0;
+    LEPT_STATS_START(parse);
+    lept_init(v);
+    for (i = 0; i < n; i++) {
+        assert(paths[i] != NULL);
+        *(size_t*)lept_context_push(&c, sizeof(size_t)) = i;
+    }
+    lept_parse_whitespace(&c);
+    if ((ret = lept_parse_projected_value(&c, v, paths, 0, n, 0, &found)) == LEPT_PARSE_OK) {
+        lept_parse_whitespace(&c);
+        if (*c.json != '\0') {
+            lept_free(v);
+            ret = LEPT_PARSE_ROOT_NOT_SINGULAR;
+        }
+    }
+    LEPT_STATS_ADD(parsed, 1);
+    LEPT_STATS_ADD(bytes_in, c.json - c.first);
+    LEPT_STATS_STOP(parse);
+    c.top = 0;
+    free(c.stack);
+    return ret;
+}
+
+
+
+/****** binary ******/
+
+/*
+ * leptjson binary format, all integers little endian:
+ *   document  "LJB" 0x01, then one value
+ *   value     a tag byte, lept_type - LEPT_NULL, then
+ *     number  the 8 bytes of a finite IEEE 754 double
+ *     string  varint length, the bytes, '\0'
+ *     array   varint count, 4 byte body size, the elements
+ *     object  varint count, 4 byte body size, for each member
+ *             varint key length, the key, '\0', the value
+ * varints are LEB128. the body size lets a reader step over a container.
+ */
+#define LEPT_BINARY_MAGIC       "LJB\1"
+#define LEPT_BINARY_MAGIC_SIZE  4
+#define LEPT_BINARY_TAG(type)   ((unsigned char)((type) - LEPT_NULL))
+
+/* copy a double in or out of the buffer, reversing it on big endian machines */
+static void lept_binary_copy_double(void* dst, const void* src) {
+    unsigned char* d = (unsigned char*)dst;
+    const unsigned char* s = (const unsigned char*)src;
+    unsigned one = 1;
+    size_t i;
+    if (*(const unsigned char*)&one == 1) {
+        memcpy(d, s, sizeof(double));
+    }else {
+        for (i = 0; i < sizeof(double); i++) {
+            d[i] = s[sizeof(double) - 1 - i];
+        }
+    }
+}
+
+static void lept_binary_put_varint(lept_context* c, size_t n) {
+    while (n >= 0x80) {
+        PUTC(c, (char)((n & 0x7F) | 0x80));
+        n >>= 7;
+    }
+    PUTC(c, (char)n);
+}
+
+/* the decoder rejects infinity and NaN, so they are never written */
+static int lept_binary_put_number(lept_context* c, double n) {
+    if (n != n || n - n != 0) {
+        return LEPT_STRINGIFY_INVALID_TYPE;
+    }
+    PUTC(c, (char)LEPT_BINARY_TAG(LEPT_NUMBER));
+    lept_binary_copy_double(lept_context_push(c, sizeof(double)), &n);
+    return LEPT_STRINGIFY_OK;
+}
+
+static int lept_binary_put_value(lept_context* c, const lept_value* v);
+
+/* the body size is filled in once the body is written */
+static int lept_binary_put_container(lept_context* c, const lept_value* v) {
+    size_t i, head, size;
+    unsigned char* p;
+    int ret;
+    lept_binary_put_varint(c, v->type == LEPT_OBJECT ? v->u.o.size : v->u.a.size);
+    head = c->top;
+    lept_context_push(c, 4);
+    if (v->type == LEPT_PACKED_ARRAY) {
+        for (i = 0; i < v->u.p.size; i++) {
+            if ((ret = lept_binary_put_number(c, v->u.p.n[i])) != LEPT_STRINGIFY_OK) {
+                return ret;
+            }
+        }
+    }else if (v->type == LEPT_ARRAY) {
+        for (i = 0; i < v->u.a.size; i++) {
+            if ((ret = lept_binary_put_value(c, &v->u.a.e[i])) != LEPT_STRINGIFY_OK) {
+                return ret;
+            }
+        }
+    }else {
+        for (i = 0; i < v->u.o.size; i++) {
+            const lept_member* m = &v->u.o.m[i];
+            lept_binary_put_varint(c, m->klen);
+            if (m->klen > 0) {
+                PUTS(c, LEPT_MEMBER_KEY(m), m->klen);
+            }
+            PUTC(c, '\0');
+            if ((ret = lept_binary_put_value(c, &m->v)) != LEPT_STRINGIFY_OK) {
+                return ret;
+            }
+        }
+    }
+    size = c->top - head - 4;
+    assert(size <= 0xFFFFFFFFul);
+    p = (unsigned char*)c->stack + head;
+    p[0] = (unsigned char)size;
+    p[1] = (unsigned char)(size >> 8);
+    p[2] = (unsigned char)(size >> 16);
+    p[3] = (unsigned char)(size >> 24);
+    return LEPT_STRINGIFY_OK;
+}
+
+static int lept_binary_put_value(lept_context* c, const lept_value* v) {
+    if (v->type == LEPT_NUMBER) {
+        return lept_binary_put_number(c, v->u.n);
+    }
+    PUTC(c, (char)LEPT_BINARY_TAG(lept_get_type(v)));
+    switch (v->type) {
+        case LEPT_STRING:
+            lept_binary_put_varint(c, v->u.s.len);
+            if (v->u.s.len > 0) {
+                PUTS(c, lept_get_string(v), v->u.s.len);
+            }
+            PUTC(c, '\0');
+            break;
+        case LEPT_ARRAY:
+        case LEPT_PACKED_ARRAY:
+        case LEPT_OBJECT:
+            return lept_binary_put_container(c, v);
+        default:
+            break;
+    }
+    return LEPT_STRINGIFY_OK;
+}
+
+/* you must free buffer by yourself */
+int lept_encode_binary(const lept_value* v, char** buffer, size_t* length) {
+    lept_context c;
+    int ret;
+    assert(v != NULL && buffer != NULL);
+    c.stack = NULL;
+    c.size = c.top = 0;
+    PUTS(&c, LEPT_BINARY_MAGIC, LEPT_BINARY_MAGIC_SIZE);
+    if ((ret = lept_binary_put_value(&c, v)) != LEPT_STRINGIFY_OK) {
+        if (length) {
+            *length = 0;
+        }
+        *buffer = NULL;
+        free(c.stack);
+        return ret;
+    }
+    if (length) {
+        *length = c.top;
+    }
+    *buffer = c.stack;
+    return LEPT_STRINGIFY_OK;
+}
+
+static const unsigned char* lept_binary_varint(const unsigned char* p, const unsigned char* end, size_t* n) {
+    size_t shift;
+    *n = 0;
+    for (shift = 0; p < end && shift < sizeof(size_t) * 8; shift += 7) {
+        *n |= (size_t)(*p & 0x7F) << shift;
+        if (!(*p++ & 0x80)) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static size_t lept_binary_body_size(const unsigned char* p) {
+    return (size_t)p[0] | (size_t)p[1] << 8 | (size_t)p[2] << 16 | (size_t)p[3] << 24;
+}
+
+/* everything after the check trusts the buffer, so the check trusts nothing */
+static const unsigned char* lept_binary_check(const unsigned char* p, const unsigned char* end, size_t depth) {
+    size_t i, n, klen, body;
+    const unsigned char* body_end;
+    double d;
+    int type;
+    if (p == end || *p > LEPT_BINARY_TAG(LEPT_OBJECT)) {
+        return NULL;
+    }
+    switch (type = *p++ + LEPT_NULL) {
+        case LEPT_NUMBER:
+            if ((size_t)(end - p) < sizeof(double)) {
+                return NULL;
+            }
+            /* JSON has no NaN nor infinity */
+            lept_binary_copy_double(&d, p);
+            return d != d || d - d != 0 ? NULL : p + sizeof(double);
+        case LEPT_STRING:
+            if ((p = lept_binary_varint(p, end, &n)) == NULL || (size_t)(end - p) <= n || p[n] != '\0') {
+                return NULL;
+            }
+            return p + n + 1;
+        case LEPT_ARRAY:
+        case LEPT_OBJECT:
+            /* every element takes a byte at least, so count <= body size */
+            if (depth == LEPT_VALIDATE_MAX_DEPTH || (p = lept_binary_varint(p, end, &n)) == NULL ||
+                end - p < 4 || (body = lept_binary_body_size(p)) > (size_t)(end - p - 4) || n > body) {
+                return NULL;
+            }
+            p += 4;
+            body_end = p + body;
+            for (i = 0; i < n; i++) {
+                if (type == LEPT_OBJECT) {
+                    if ((p = lept_binary_varint(p, body_end, &klen)) == NULL ||
+                        (size_t)(body_end - p) <= klen || p[klen] != '\0') {
+                        return NULL;
+                    }
+                    p += klen + 1;
+                }
+                if ((p = lept_binary_check(p, body_end, depth + 1)) == NULL) {
+                    return NULL;
+                }
+            }
+            return p == body_end ? p : NULL;
+        default:
+            return p;
+    }
+}
+
+static const unsigned char* lept_binary_check_document(const char* buffer, size_t length) {
+    const unsigned char* p = (const unsigned char*)buffer;
+    const unsigned char* end = p + length;
+    if (length < LEPT_BINARY_MAGIC_SIZE || memcmp(p, LEPT_BINARY_MAGIC, LEPT_BINARY_MAGIC_SIZE) != 0) {
+        return NULL;
+    }
+    p += LEPT_BINARY_MAGIC_SIZE;
+    return lept_binary_check(p, end, 0) == end ? p : NULL;
+}
+
+/* the rest reads checked buffers only */
+static const unsigned char* lept_binary_read_varint(const unsigned char* p, size_t* n) {
+    size_t shift = 0;
+    *n = 0;
+    do {
+        *n |= (size_t)(*p & 0x7F) << shift;
+        shift += 7;
+    } while (*p++ & 0x80);
+    return p;
+}
+
+static const unsigned char* lept_binary_skip(const unsigned char* p) {
+    size_t n;
+    switch (*p++ + LEPT_NULL) {
+        case LEPT_NUMBER:
+            return p + sizeof(double);
+        case LEPT_STRING:
+            p = lept_binary_read_varint(p, &n);
+            return p + n + 1;
+        case LEPT_ARRAY:
+        case LEPT_OBJECT:
+            p = lept_binary_read_varint(p, &n);
+            return p + 4 + lept_binary_body_size(p);
+        default:
+            return p;
+    }
+}
+
+static const unsigned char* lept_binary_decode_value(const unsigned char* p, lept_value* v) {
+    size_t i, n, klen;
+    double d;
+    switch (*p++ + LEPT_NULL) {
+        case LEPT_NULL:     lept_init(v); break;
+        case LEPT_FALSE:    lept_set_boolean(v, 0); break;
+        case LEPT_TRUE:     lept_set_boolean(v, 1); break;
+        case LEPT_NUMBER:
+            lept_binary_copy_double(&d, p);
+            lept_set_number(v, d);
+            p += sizeof(double);
+            break;
+        case LEPT_STRING:
+            p = lept_binary_read_varint(p, &n);
+            lept_set_string(v, (const char*)p, n);
+            p += n + 1;
+            break;
+        case LEPT_ARRAY:
+            p = lept_binary_read_varint(p, &n) + 4;
+            lept_set_array(v, n);
+            for (i = 0; i < n; i++) {
+                lept_init(&v->u.a.e[i]);
+                p = lept_binary_decode_value(p, &v->u.a.e[i]);
+            }
+            v->u.a.size = (lept_size)n;
+            break;
+        case LEPT_OBJECT:
+            p = lept_binary_read_varint(p, &n) + 4;
+            lept_set_object(v, n);
+            for (i = 0; i < n; i++) {
+                lept_member* m = &v->u.o.m[i];
+                p = lept_binary_read_varint(p, &klen);
+                lept_member_set_key(m, (const char*)p, klen, NULL);
+                lept_init(&m->v);
+                p = lept_binary_decode_value(p + klen + 1, &m->v);
+            }
+            v->u.o.size = (lept_size)n;
+            break;
+    }
+    return p;
+}
+
+/* no text to scan, no numbers to convert and no escapes to undo */
+int lept_decode_binary(lept_value* v, const char* buffer, size_t length) {
+    const unsigned char* p;
+    assert(v != NULL && (buffer != NULL || length == 0));
+    lept_init(v);
+    if ((p = lept_binary_check_document(buffer, length)) == NULL) {
+        return LEPT_PARSE_INVALID_BINARY;
+    }
+    lept_binary_decode_value(p, v);
+    return LEPT_PARSE_OK;
+}
+
+/* zero-copy reads, the buffer is checked once here and must outlive the views */
+int lept_binary_view_init(lept_binary_view* view, const char* buffer, size_t length) {
+    assert(view != NULL && (buffer != NULL || length == 0));
+    view->p = (const char*)lept_binary_check_document(buffer, length);
+    return view->p != NULL ? LEPT_PARSE_OK : LEPT_PARSE_INVALID_BINARY;
+}
+
+lept_type lept_binary_get_type(const lept_binary_view* view) {
+    assert(view != NULL && view->p != NULL);
+    return (lept_type)(*(const unsigned char*)view->p + LEPT_NULL);
+}
+
+int lept_binary_get_boolean(const lept_binary_view* view) {
+    assert(view != NULL && view->p != NULL &&
+        (lept_binary_get_type(view) == LEPT_TRUE || lept_binary_get_type(view) == LEPT_FALSE));
+    return lept_binary_get_type(view) == LEPT_TRUE;
+}
+
+double lept_binary_get_number(const lept_binary_view* view) {
+    double d;
+    assert(view != NULL && view->p != NULL && lept_binary_get_type(view) == LEPT_NUMBER);
+    lept_binary_copy_double(&d, view->p + 1);
+    return d;
+}
+
+/* points into the buffer, and is '\0' terminated */
+const char* lept_binary_get_string(const lept_binary_view* view, size_t* len) {
+    size_t n;
+    const unsigned char* p;
+    assert(view != NULL && view->p != NULL && lept_binary_get_type(view) == LEPT_STRING);
+    p = lept_binary_read_varint((const unsigned char*)view->p + 1, &n);
+    if (len != NULL) {
+        *len = n;
+    }
+    return (const char*)p;
+}
+
+size_t lept_binary_get_size(const lept_binary_view* view) {
+    size_t n;
+    assert(view != NULL && view->p != NULL &&
+        (lept_binary_get_type(view) == LEPT_ARRAY || lept_binary_get_type(view) == LEPT_OBJECT));
+    lept_binary_read_varint((const unsigned char*)view->p + 1, &n);
+    return n;
+}
+
+/* steps over the elements before index, each step is O(1) */
+int lept_binary_get_element(const lept_binary_view* view, size_t index, lept_binary_view* e) {
+    size_t n;
+    const unsigned char* p;
+    assert(view != NULL && view->p != NULL && e != NULL && lept_binary_get_type(view) == LEPT_ARRAY);
+    p = lept_binary_read_varint((const unsigned char*)view->p + 1, &n) + 4;
+    if (index >= n) {
+        return 0;
+    }
+    while (index--) {
+        p = lept_binary_skip(p);
+    }
+    e->p = (const char*)p;
+    return 1;
+}
+
+int lept_binary_get_member(const lept_binary_view* view, size_t index, const char** key, size_t* klen, lept_binary_view* value) {
+    size_t n, len;
+    const unsigned char* p;
+    assert(view != NULL && view->p != NULL && value != NULL && lept_binary_get_type(view) == LEPT_OBJECT);
+    p = lept_binary_read_varint((const unsigned char*)view->p + 1, &n) + 4;
+    if (index >= n) {
+        return 0;
+    }
+    for (;;) {
+        p = lept_binary_read_varint(p, &len);
+        if (index-- == 0) {
+            break;
+        }
+        p = lept_binary_skip(p + len + 1);
+    }
+    if (key != NULL) {
+        *key = (const char*)p;
+    }
+    if (klen != NULL) {
+        *klen = len;
+    }
+    value->p = (const char*)p + len + 1;
+    return 1;
+}
+
+int lept_binary_find_member(const lept_binary_view* view, const char* key, size_t klen, lept_binary_view* value) {
+    size_t i, n, len;
+    const unsigned char* p;
+    assert(view != NULL && view->p != NULL && value != NULL && lept_binary_get_type(view) == LEPT_OBJECT);
+    assert(key != NULL || klen == 0);
+    p = lept_binary_read_varint((const unsigned char*)view->p + 1, &n) + 4;
+    for (i = 0; i < n; i++) {
+        p = lept_binary_read_varint(p, &len);
+        if (len == klen && memcmp(p, key, klen) == 0) {
+            value->p = (const char*)p + len + 1;
+            return 1;
+        }
+        p = lept_binary_skip(p + len + 1);
+    }
+    return 0;
+}
+
+
+/****** stats ******/
+
+#ifdef LEPT_ENABLE_STATS
+/* the counters of the calling thread */
+void lept_stats_get(lept_stats* stats) {
+    assert(stats != NULL);
+    *stats = lept_stats_local;
+}
+
+void lept_stats_reset(void) {
+    memset(&lept_stats_local, 0, sizeof(lept_stats));
+}
+
+/* add stats into total, e.g. to sum up what each thread got from lept_stats_get() */
+void lept_stats_merge(lept_stats* total, const lept_stats* stats) {
+    size_t i;
+    assert(total != NULL && stats != NULL);
+    total->parsed += stats->parsed;
+    total->stringified += stats->stringified;
+    total->bytes_in += stats->bytes_in;
+    total->bytes_out += stats->bytes_out;
+    for (i = 0; i < sizeof(stats->nodes) / sizeof(stats->nodes[0]); i++) {
+        total->nodes[i] += stats->nodes[i];
+    }
+    total->allocations += stats->allocations;
+    total->allocated += stats->allocated;
+    total->stack_reallocs += stats->stack_reallocs;
+    if (stats->stack_peak > total->stack_peak) {
+        total->stack_peak = stats->stack_peak;
+    }
+    if (stats->max_depth > total->max_depth) {
+        total->max_depth = stats->max_depth;
+    }
+    total->escapes += stats->escapes;
+    total->parse_time += stats->parse_time;
+    total->stringify_time += stats->stringify_time;
+}
+#endif
+
+
+/****** columns ******/
+
+#define LEPT_COLUMN_SET_NULL(col, row)  ((col)->nulls[(row) >> 3] |= (unsigned char)(1u << ((row) & 7)))
+
+/* one row of one column, a missing or mistyped value is a null */
+static void lept_column_put(lept_column* col, size_t row, const lept_value* f, size_t* capacity) {
+    size_t len, n;
+    switch (col->type) {
+        case LEPT_COLUMN_DOUBLE:
+            col->data.d[row] = 0.0;
+            if (f != NULL && f->type == LEPT_NUMBER) {
+                col->data.d[row] = f->u.n;
+                return;
+            }
+            break;
+        case LEPT_COLUMN_LONG:
+            col->data.l[row] = 0;
+            /* only integers that fit, nothing is rounded */
+            if (f != NULL && f->type == LEPT_NUMBER && f->u.n >= (double)LONG_MIN &&
+                f->u.n < -(double)LONG_MIN && (double)(long)f->u.n == f->u.n) {
+                col->data.l[row] = (long)f->u.n;
+                return;
+            }
+            break;
+        case LEPT_COLUMN_BOOLEAN:
+            col->data.b[row] = 0;
+            if (f != NULL && (f->type == LEPT_TRUE || f->type == LEPT_FALSE)) {
+                col->data.b[row] = f->type == LEPT_TRUE;
+                return;
+            }
+            break;
+        case LEPT_COLUMN_STRING:
+            col->data.offsets[row + 1] = col->data.offsets[row];
+            if (f != NULL && f->type == LEPT_STRING) {
+                len = f->u.s.len;
+                if (col->data.offsets[row] + len > *capacity) {
+                    for (n = *capacity; col->data.offsets[row] + len > n; ) {
+                        n = lept_grow_capacity(n);
+                    }
+                    col->bytes = (char*) realloc(col->bytes, n);
+                    LEPT_STATS_REALLOC(*capacity, n);
+                    assert(col->bytes != NULL);
+                    *capacity = n;
+                }
+                if (len > 0) {
+                    memcpy(col->bytes + col->data.offsets[row], lept_get_string(f), len);
+                }
+                col->data.offsets[row + 1] += len;
+                return;
+            }
+            break;
+        default:
+            assert(0);
+    }
+    LEPT_COLUMN_SET_NULL(col, row);
+}
+
+/*
+ * one pass over an array of objects, every column is filled row by row.
+ * the member a key was found at is tried first in the next record, so
+ * records with the same layout are matched without a lookup.
+ * returns the number of rows, free the columns with lept_free_columns().
+ */
+size_t lept_to_columns(const lept_value* v, lept_column* columns, size_t n) {
+    size_t i, j, rows, size, *state;
+    int k;
+    assert(v != NULL && (v->type == LEPT_ARRAY || v->type == LEPT_PACKED_ARRAY) && (columns != NULL || n == 0));
+    rows = v->u.a.size;
+    for (j = 0; j < n; j++) {
+        lept_column* col = &columns[j];
+        size_t width = col->type == LEPT_COLUMN_DOUBLE ? sizeof(double) :
+                       col->type == LEPT_COLUMN_LONG ? sizeof(long) :
+                       col->type == LEPT_COLUMN_BOOLEAN ? sizeof(unsigned char) : sizeof(size_t);
+        assert(col->key != NULL || col->klen == 0);
+        /* strings keep one offset more than there are rows */
+        size = width * (rows + (col->type == LEPT_COLUMN_STRING)) + 1;
+        col->data.d = (double*) malloc(size);
+        LEPT_STATS_ALLOC(size);
+        assert(col->data.d != NULL);
+        col->bytes = NULL;
+        col->nulls = (unsigned char*) calloc(rows / 8 + 1, 1);
+        LEPT_STATS_ALLOC(rows / 8 + 1);
+        assert(col->nulls != NULL);
+        if (col->type == LEPT_COLUMN_STRING) {
+            col->data.offsets[0] = 0;
+        }
+    }
+    if (n == 0) {
+        return rows;
+    }
+    /* per column: the member index of the last hit, and the string capacity */
+    state = (size_t*) calloc(n * 2, sizeof(size_t));
+    LEPT_STATS_ALLOC(n * 2 * sizeof(size_t));
+    assert(state != NULL);
+    for (i = 0; i < rows; i++) {
+        /* a packed array has no objects, every row is null */
+        const lept_value* r = v->type == LEPT_ARRAY ? &v->u.a.e[i] : NULL;
+        for (j = 0; j < n; j++) {
+            lept_column* col = &columns[j];
+            const lept_value* f = NULL;
+            if (r != NULL && r->type == LEPT_OBJECT) {
+                if (state[j] < r->u.o.size && lept_member_key_is(&r->u.o.m[state[j]], col->key, col->klen)) {
+                    f = &r->u.o.m[state[j]].v;
+                }else if ((k = lept_find_object_index(r, col->key, col->klen)) >= 0) {
+                    state[j] = (size_t)k;
+                    f = &r->u.o.m[k].v;
+                }
+            }
+            lept_column_put(col, i, f, &state[n + j]);
+        }
+    }
+    free(state);
+    return rows;
+}
+
+void lept_free_columns(lept_column* columns, size_t n) {
+    size_t j;
+    assert(columns != NULL || n == 0);
+    for (j = 0; j < n; j++) {
+        free(columns[j].data.d);
+        free(columns[j].bytes);
+        free(columns[j].nulls);
+        columns[j].data.d = NULL;
+        columns[j].bytes = NULL;
+        columns[j].nulls = NULL;
+    }
+}
+
+
+/****** typed decoding ******/
+
+/*
+ * the fields sit in an open addressing table of mask + 1 slots, at least
+ * twice the number of fields. a key is found by probing from its hash until
+ * it matches or an empty slot is hit, which at half load takes one or two
+ * compares. building it cannot fail, whatever the keys hash to.
+ */
+struct lept_decoder {
+    size_t size;
+    size_t mask;
+    lept_field* field;
+    size_t* klen;
+    size_t* slot;       /* field index, size when empty */
+};
+
+static size_t lept_decoder_hash(const char* key, size_t klen) {
+    size_t h = 2166136261u;
+    size_t i;
+    for (i = 0; i < klen; i++) {
+        h ^= (unsigned char)key[i];
+        h *= 16777619u;
+    }
+    return lept_hash_mix(h);
+}
+
+/* the keys are not copied, the table is usually static anyway */
+lept_decoder* lept_decoder_create(const lept_field* fields, size_t n) {
+    lept_decoder* d;
+    size_t i, j, h, slots;
+    assert(fields != NULL || n == 0);
+    for (i = 0; i < n; i++) {
+        assert(fields[i].key != NULL);
+        assert(fields[i].type != LEPT_FIELD_OBJECT || fields[i].nested != NULL);
+        assert(fields[i].type != LEPT_FIELD_STRING || fields[i].size > 0);
+        for (j = 0; j < i; j++) {
+            if (strcmp(fields[i].key, fields[j].key) == 0) {
+                return NULL;
+            }
+        }
+    }
+    for (slots = 1; slots < n * 2; slots <<= 1)
+        ;
+    /* one block: header, fields, key lengths, slots */
+    d = (lept_decoder*) malloc(sizeof(lept_decoder) + sizeof(lept_field) * n + sizeof(size_t) * (n + slots));
+    LEPT_STATS_ALLOC(sizeof(lept_decoder) + sizeof(lept_field) * n + sizeof(size_t) * (n + slots));
+    assert(d != NULL);
+    d->size = n;
+    d->field = (lept_field*)(d + 1);
+    d->klen = (size_t*)(d->field + n);
+    d->slot = d->klen + n;
+    d->mask = slots - 1;
+    for (i = 0; i < slots; i++) {
+        d->slot[i] = n;
+    }
+    for (i = 0; i < n; i++) {
+        d->field[i] = fields[i];
+        d->klen[i] = strlen(fields[i].key);
+        h = lept_decoder_hash(fields[i].key, d->klen[i]) & d->mask;
+        while (d->slot[h] != n) {
+            h = (h + 1) & d->mask;
+        }
+        d->slot[h] = i;
+    }
+    return d;
+}
+
+void lept_decoder_destroy(lept_decoder* d) {
+    free(d);
+}
+
+static const lept_field* lept_decoder_find(const lept_decoder* d, const char* key, size_t klen) {
+    size_t h = lept_decoder_hash(key, klen) & d->mask;
+    size_t i;
+    /* the table is never full, so an empty slot ends the probe */
+    while ((i = d->slot[h]) != d->size) {
+        if (d->klen[i] == klen && memcmp(d->field[i].key, key, klen) == 0) {
+            return &d->field[i];
+        }
+        h = (h + 1) & d->mask;
+    }
+    return NULL;
+}
+
+static int lept_decode_object(lept_context* c, const lept_decoder* d, char* out);
+
+/* null leaves the field as it was, anything else must match its type */
+static int lept_decode_field(lept_context* c, const lept_field* f, char* out) {
+    lept_value v;
+    char* s;
+    size_t len;
+    long l;
+    int ret, i;
+    lept_init(&v);
+    if (*c->json == 'n') {
+        return lept_parse_literal(c, &v, "null", LEPT_NULL);
+    }
+    out += f->offset;
+    switch (f->type) {
+        case LEPT_FIELD_DOUBLE:
+        case LEPT_FIELD_LONG:
+        case LEPT_FIELD_INT:
+            if (*c->json != '-' && !ISDIGIT(*c->json)) {
+                return LEPT_PARSE_TYPE_MISMATCH;
+            }
+            if ((ret = lept_parse_number(c, &v)) != LEPT_PARSE_OK) {
+                return ret;
+            }
+            if (f->type == LEPT_FIELD_DOUBLE) {
+                memcpy(out, &v.u.n, sizeof(double));
+                return LEPT_PARSE_OK;
+            }
+            /* integers must fit, nothing is rounded */
+            if (!(v.u.n >= (double)LONG_MIN && v.u.n < -(double)LONG_MIN) || (double)(long)v.u.n != v.u.n ||
+                (f->type == LEPT_FIELD_INT && (v.u.n < INT_MIN || v.u.n > INT_MAX))) {
+                return LEPT_PARSE_TYPE_MISMATCH;
+            }
+            if (f->type == LEPT_FIELD_LONG) {
+                l = (long)v.u.n;
+                memcpy(out, &l, sizeof(long));
+            }else {
+                i = (int)v.u.n;
+                memcpy(out, &i, sizeof(int));
+            }
+            return LEPT_PARSE_OK;
+        case LEPT_FIELD_BOOLEAN:
+            if (*c->json != 't' && *c->json != 'f') {
+                return LEPT_PARSE_TYPE_MISMATCH;
+            }
+            if ((ret = *c->json == 't' ? lept_parse_literal(c, &v, "true", LEPT_TRUE) :
+                                         lept_parse_literal(c, &v, "false", LEPT_FALSE)) != LEPT_PARSE_OK) {
+                return ret;
+            }
+            i = v.type == LEPT_TRUE;
+            memcpy(out, &i, sizeof(int));
+            return LEPT_PARSE_OK;
+        case LEPT_FIELD_STRING:
+            if (*c->json != '\"') {
+                return LEPT_PARSE_TYPE_MISMATCH;
+            }
+            if ((ret = lept_parse_string_raw(c, &s, &len)) != LEPT_PARSE_OK) {
+                return ret;
+            }
+            if (len >= f->size) {
+                return LEPT_PARSE_STRING_TOO_LONG;
+            }
+            memcpy(out, s, len);
+            out[len] = '\0';
+            return LEPT_PARSE_OK;
+        case LEPT_FIELD_OBJECT:
+            return lept_decode_object(c, f->nested, out);
+        default:
+            assert(0);
+            return LEPT_PARSE_TYPE_MISMATCH;
+    }
+}
+
+/* members without a field are skipped, nothing is allocated but the scratch stack */
+static int lept_decode_object(lept_context* c, const lept_decoder* d, char* out) {
+    const lept_field* f;
+    char* key;
+    size_t klen;
+    int ret;
+    if (*c->json != '{') {
+        return *c->json == '\0' ? LEPT_PARSE_EXPECT_VALUE : LEPT_PARSE_TYPE_MISMATCH;
+    }
+    c->json++;
+    lept_parse_whitespace(c);
+    if (*c->json == '}') {
+        c->json++;
+        return LEPT_PARSE_OK;
+    }
+    for (;;) {
+        if (*c->json != '\"') {
+            return LEPT_PARSE_MISS_KEY;
+        }
+        if ((ret = lept_parse_string_raw(c, &key, &klen)) != LEPT_PARSE_OK) {
+            return ret;
+        }
+        /* the key is only good until the stack is pushed again */
+        f = lept_decoder_find(d, key, klen);
+        lept_parse_whitespace(c);
+        if (*c->json != ':') {
+            return LEPT_PARSE_MISS_COLON;
+        }
+        c->json++;
+        lept_parse_whitespace(c);
+        if ((ret = f != NULL ? lept_decode_field(c, f, out) : lept_skip_value(c)) != LEPT_PARSE_OK) {
+            return ret;
+        }
+        lept_parse_whitespace(c);
+        if (*c->json == ',') {
+            c->json++;
+            lept_parse_whitespace(c);
+        }else if (*c->json == '}') {
+            c->json++;
+            return LEPT_PARSE_OK;
+        }else {
+            return LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET;
+        }
+    }
+}
+
+/* straight into the caller's struct, which may be partly written when it fails */
+int lept_decode(const lept_decoder* d, void* out, const char* json, lept_parse_result* result) {
+    int ret;
+    lept_context c;
+    assert(d != NULL && out != NULL && json != NULL);
+    c.json = json;
+    c.first = json;
+    c.stack = NULL;
+    c.size = c.top = 0;
+    c.pool = NULL;
+    c.options = 0;
+    lept_parse_whitespace(&c);
+    if ((ret = lept_decode_object(&c, d, (char*)out)) == LEPT_PARSE_OK) {
+        lept_parse_whitespace(&c);
+        if (*c.json != '\0') {
+            ret = LEPT_PARSE_ROOT_NOT_SINGULAR;
+        }
+    }
+    if (result != NULL) {
+        lept_parse_report(&c, ret, result);
+    }
+    c.top = 0;
+    free(c.stack);
+    return ret;
+}
+
+
+/****** schema validation ******/
+
+#define LEPT_SCHEMA_BIT(t)      (1u << ((t) - LEPT_NULL))
+#define LEPT_SCHEMA_INTEGER     (1u << 7)   /* next to the LEPT_SCHEMA_BIT() of each lept_type */
+#define LEPT_SCHEMA_NEVER       (1u << 8)   /* the false schema, matches no type */
+
+#define LEPT_SCHEMA_HAS_MINIMUM             (1u << 0)
+#define LEPT_SCHEMA_HAS_MAXIMUM             (1u << 1)
+#define LEPT_SCHEMA_HAS_EXCLUSIVE_MINIMUM   (1u << 2)
+#define LEPT_SCHEMA_HAS_EXCLUSIVE_MAXIMUM   (1u << 3)
+#define LEPT_SCHEMA_HAS_MIN_LENGTH          (1u << 4)
+#define LEPT_SCHEMA_HAS_MAX_LENGTH          (1u << 5)
+#define LEPT_SCHEMA_HAS_MIN_ITEMS           (1u << 6)
+#define LEPT_SCHEMA_HAS_MAX_ITEMS           (1u << 7)
+#define LEPT_SCHEMA_HAS_ENUM                (1u << 8)
+
+/* one (sub)schema, node 0 is the root so 0 also means "no schema" below */
+typedef struct {
+    unsigned types;             /* LEPT_SCHEMA_BIT() of each type, 0 for any type */
+    unsigned checks;            /* LEPT_SCHEMA_HAS_* */
+    double minimum, maximum;
+    double exclusive_minimum, exclusive_maximum;   /* kept apart, a schema may give both kinds */
+    size_t min_length, max_length;
+    size_t min_items, max_items;
+    size_t property, nproperty; /* range in lept_schema.property */
+    size_t value, nvalue;       /* enum, range in lept_schema.value */
+    size_t items;
+}lept_schema_node;
+
+typedef struct {
+    lept_pointer_token token;   /* looked up like a pointer step */
+    size_t node;                /* 0 when the member is only required */
+    int required;
+}lept_schema_property;
+
+/* one block: header, nodes, properties, enum values and the keys */
+struct lept_schema {
+    lept_schema_node* node;
+    lept_schema_property* property;
+    lept_value* value;
+    size_t nvalue;
+};
+
+/* sizes worked out by the first pass, cursors in the second */
+typedef struct {
+    size_t node, property, value, bytes;
+}lept_schema_count;
+
+static unsigned lept_schema_type(const lept_value* name) {
+    static const char* const names[] = { "null", "boolean", "number", "string", "array", "object", "integer" };
+    static const unsigned bits[] = {
+        LEPT_SCHEMA_BIT(LEPT_NULL), LEPT_SCHEMA_BIT(LEPT_FALSE) | LEPT_SCHEMA_BIT(LEPT_TRUE), LEPT_SCHEMA_BIT(LEPT_NUMBER),
+        LEPT_SCHEMA_BIT(LEPT_STRING), LEPT_SCHEMA_BIT(LEPT_ARRAY), LEPT_SCHEMA_BIT(LEPT_OBJECT), LEPT_SCHEMA_INTEGER
+    };
+    size_t i;
+    if (name->type != LEPT_STRING) {
+        return 0;
+    }
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (lept_get_string_length(name) == strlen(names[i]) && memcmp(lept_get_string(name), names[i], strlen(names[i])) == 0) {
+            return bits[i];
+        }
+    }
+    return 0;
+}
+
+static int lept_schema_is_length(const lept_value* v) {
+    return v->type == LEPT_NUMBER && v->u.n >= 0.0 && v->u.n < -(double)LONG_MIN && (double)(long)v->u.n == v->u.n;
+}
+
+/* checks the form of every keyword we know, the others are ignored */
+static int lept_schema_measure(const lept_value* schema, lept_schema_count* count) {
+    size_t i, j;
+    count->node++;
+    if (schema->type == LEPT_TRUE || schema->type == LEPT_FALSE) {
+        return 1;
+    }
+    if (schema->type != LEPT_OBJECT) {
+        return 0;
+    }
+    for (i = 0; i < schema->u.o.size; i++) {
+        const lept_member* m = &schema->u.o.m[i];
+        const lept_value* v = &m->v;
+        if (lept_member_key_is(m, "type", 4)) {
+            if (v->type == LEPT_ARRAY) {
+                for (j = 0; j < v->u.a.size; j++) {
+                    if (lept_schema_type(&v->u.a.e[j]) == 0) {
+                        return 0;
+                    }
+                }
+            }else if (lept_schema_type(v) == 0) {
+                return 0;
+            }
+        }else if (lept_member_key_is(m, "properties", 10)) {
+            if (v->type != LEPT_OBJECT) {
+                return 0;
+            }
+            count->property += v->u.o.size;
+            for (j = 0; j < v->u.o.size; j++) {
+                count->bytes += v->u.o.m[j].klen + 1;
+                if (!lept_schema_measure(&v->u.o.m[j].v, count)) {
+                    return 0;
+                }
+            }
+        }else if (lept_member_key_is(m, "required", 8)) {
+            if (v->type != LEPT_ARRAY) {
+                return 0;
+            }
+            count->property += v->u.a.size;
+            for (j = 0; j < v->u.a.size; j++) {
+                if (v->u.a.e[j].type != LEPT_STRING) {
+                    return 0;
+                }
+                count->bytes += lept_get_string_length(&v->u.a.e[j]) + 1;
+            }
+        }else if (lept_member_key_is(m, "items", 5)) {
+            /* the tuple form is not supported */
+            if (!lept_schema_measure(v, count)) {
+                return 0;
+            }
+        }else if (lept_member_key_is(m, "enum", 4)) {
+            if (v->type != LEPT_ARRAY && v->type != LEPT_PACKED_ARRAY) {
+                return 0;
+            }
+            count->value += v->u.a.size;
+        }else if (lept_member_key_is(m, "minimum", 7) || lept_member_key_is(m, "maximum", 7) ||
+                  lept_member_key_is(m, "exclusiveMinimum", 16) || lept_member_key_is(m, "exclusiveMaximum", 16)) {
+            if (v->type != LEPT_NUMBER) {
+                return 0;
+            }
+        }else if (lept_member_key_is(m, "minLength", 9) || lept_member_key_is(m, "maxLength", 9) ||
+                  lept_member_key_is(m, "minItems", 8) || lept_member_key_is(m, "maxItems", 8)) {
+            if (!lept_schema_is_length(v)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+static void lept_schema_set_key(lept_schema* s, lept_schema_count* cursor, lept_schema_property* p, const char* key, size_t klen) {
+    char* buffer = (char*)(s->value + s->nvalue) + cursor->bytes;
+    memcpy(buffer, key, klen);
+    buffer[klen] = '\0';
+    cursor->bytes += klen + 1;
+    p->token.key = buffer;
+    p->token.klen = klen;
+    p->token.hash = lept_hash_bytes(buffer, klen);
+    p->token.index = LEPT_POINTER_NO_INDEX;
+    p->node = 0;
+    p->required = 0;
+}
+
+/* trusts what lept_schema_measure() has checked, returns the node index */
+static size_t lept_schema_build(lept_schema* s, const lept_value* schema, lept_schema_count* cursor) {
+    size_t index = cursor->node++;
+    lept_schema_node* n = &s->node[index];
+    const lept_value* properties = NULL;
+    size_t i, j;
+    memset(n, 0, sizeof(lept_schema_node));
+    if (schema->type != LEPT_OBJECT) {
+        n->types = schema->type == LEPT_FALSE ? LEPT_SCHEMA_NEVER : 0;
+        return index;
+    }
+    n->property = cursor->property;
+    /* the member names first, the nodes after, so the range stays in one piece */
+    for (i = 0; i < schema->u.o.size; i++) {
+        if (lept_member_key_is(&schema->u.o.m[i], "properties", 10)) {
+            properties = &schema->u.o.m[i].v;
+            for (j = 0; j < properties->u.o.size; j++) {
+                const lept_member* m = &properties->u.o.m[j];
+                lept_schema_set_key(s, cursor, &s->property[n->property + n->nproperty++], LEPT_MEMBER_KEY(m), m->klen);
+            }
+        }
+    }
+    for (i = 0; i < schema->u.o.size; i++) {
+        const lept_member* m = &schema->u.o.m[i];
+        const lept_value* v = &m->v;
+        if (lept_member_key_is(m, "type", 4)) {
+            if (v->type == LEPT_ARRAY) {
+                for (j = 0; j < v->u.a.size; j++) {
+                    n->types |= lept_schema_type(&v->u.a.e[j]);
+                }
+            }else {
+                n->types = lept_schema_type(v);
+            }
+        }else if (lept_member_key_is(m, "required", 8)) {
+            for (j = 0; j < v->u.a.size; j++) {
+                const char* key = lept_get_string(&v->u.a.e[j]);
+                size_t klen = lept_get_string_length(&v->u.a.e[j]), k;
+                for (k = 0; k < n->nproperty; k++) {
+                    const lept_pointer_token* t = &s->property[n->property + k].token;
+                    if (t->klen == klen && memcmp(t->key, key, klen) == 0) {
+                        break;
+                    }
+                }
+                if (k == n->nproperty) {
+                    lept_schema_set_key(s, cursor, &s->property[n->property + n->nproperty++], key, klen);
+                }
+                s->property[n->property + k].required = 1;
+            }
+        }else if (lept_member_key_is(m, "enum", 4)) {
+            n->checks |= LEPT_SCHEMA_HAS_ENUM;
+            n->value = cursor->value;
+            n->nvalue = v->u.a.size;
+            for (j = 0; j < n->nvalue; j++) {
+                lept_init(&s->value[cursor->value]);
+                if (v->type == LEPT_PACKED_ARRAY) {
+                    lept_set_number(&s->value[cursor->value++], v->u.p.n[j]);
+                }else {
+                    lept_copy(&s->value[cursor->value++], &v->u.a.e[j]);
+                }
+            }
+        }else if (lept_member_key_is(m, "minimum", 7)) {
+            n->checks |= LEPT_SCHEMA_HAS_MINIMUM;
+            n->minimum = v->u.n;
+        }else if (lept_member_key_is(m, "maximum", 7)) {
+            n->checks |= LEPT_SCHEMA_HAS_MAXIMUM;
+            n->maximum = v->u.n;
+        }else if (lept_member_key_is(m, "exclusiveMinimum", 16)) {
+            n->checks |= LEPT_SCHEMA_HAS_EXCLUSIVE_MINIMUM;
+            n->exclusive_minimum = v->u.n;
+        }else if (lept_member_key_is(m, "exclusiveMaximum", 16)) {
+            n->checks |= LEPT_SCHEMA_HAS_EXCLUSIVE_MAXIMUM;
+            n->exclusive_maximum = v->u.n;
+        }else if (lept_member_key_is(m, "minLength", 9)) {
+            n->checks |= LEPT_SCHEMA_HAS_MIN_LENGTH;
+            n->min_length = (size_t)v->u.n;
+        }else if (lept_member_key_is(m, "maxLength", 9)) {
+            n->checks |= LEPT_SCHEMA_HAS_MAX_LENGTH;
+            n->max_length = (size_t)v->u.n;
+        }else if (lept_member_key_is(m, "minItems", 8)) {
+            n->checks |= LEPT_SCHEMA_HAS_MIN_ITEMS;
+            n->min_items = (size_t)v->u.n;
+        }else if (lept_member_key_is(m, "maxItems", 8)) {
+            n->checks |= LEPT_SCHEMA_HAS_MAX_ITEMS;
+            n->max_items = (size_t)v->u.n;
+        }
+    }
+    cursor->property += n->nproperty;
+    if (properties != NULL) {
+        for (j = 0; j < properties->u.o.size; j++) {
+            i = lept_schema_build(s, &properties->u.o.m[j].v, cursor);
+            s->property[n->property + j].node = i;
+        }
+    }
+    for (i = 0; i < schema->u.o.size; i++) {
+        if (lept_member_key_is(&schema->u.o.m[i], "items", 5)) {
+            j = lept_schema_build(s, &schema->u.o.m[i].v, cursor);
+            s->node[index].items = j;
+        }
+    }
+    return index;
+}
+
+/* NULL if a known keyword has the wrong form */
+lept_schema* lept_schema_compile(const lept_value* schema) {
+    lept_schema* s;
+    lept_schema_count count;
+    assert(schema != NULL);
+    memset(&count, 0, sizeof(count));
+    if (!lept_schema_measure(schema, &count)) {
+        return NULL;
+    }
+    s = (lept_schema*) malloc(sizeof(lept_schema) + sizeof(lept_schema_node) * count.node +
+        sizeof(lept_schema_property) * count.property + sizeof(lept_value) * count.value + count.bytes);
+    LEPT_STATS_ALLOC(sizeof(lept_schema) + sizeof(lept_schema_node) * count.node +
+        sizeof(lept_schema_property) * count.property + sizeof(lept_value) * count.value + count.bytes);
+    assert(s != NULL);
+    s->node = (lept_schema_node*)(s + 1);
+    s->property = (lept_schema_property*)(s->node + count.node);
+    s->value = (lept_value*)(s->property + count.property);
+    s->nvalue = count.value;
+    memset(&count, 0, sizeof(count));
+    lept_schema_build(s, schema, &count);
+    return s;
+}
+
+void lept_schema_free(lept_schema* s) {
+    size_t i;
+    if (s != NULL) {
+        for (i = 0; i < s->nvalue; i++) {
+            lept_free(&s->value[i]);
+        }
+        free(s);
+    }
+}
+
+/* the way down, on the C stack, only written out when something fails */
+typedef struct lept_schema_frame {
+    const struct lept_schema_frame* parent;
+    const char* key;        /* NULL for an array element */
+    size_t klen;
+    size_t index;
+}lept_schema_frame;
+
+typedef struct {
+    const lept_schema* s;
+    char* path;
+    size_t size;
+    size_t len;
+}lept_schema_context;
+
+static void lept_schema_path_putc(lept_schema_context* c, char ch) {
+    if (c->len + 1 < c->size) {
+        c->path[c->len++] = ch;
+    }
+}
+
+static void lept_schema_path(lept_schema_context* c, const lept_schema_frame* f) {
+    char index[24];
+    size_t i;
+    if (f->parent == NULL) {
+        return;
+    }
+    lept_schema_path(c, f->parent);
+    lept_schema_path_putc(c, '/');
+    if (f->key == NULL) {
+        sprintf(index, "%lu", (unsigned long)f->index);
+        for (i = 0; index[i] != '\0'; i++) {
+            lept_schema_path_putc(c, index[i]);
+        }
+        return;
+    }
+    for (i = 0; i < f->klen; i++) {
+        switch (f->key[i]) {
+            case '~': lept_schema_path_putc(c, '~'); lept_schema_path_putc(c, '0'); break;
+            case '/': lept_schema_path_putc(c, '~'); lept_schema_path_putc(c, '1'); break;
+            default:  lept_schema_path_putc(c, f->key[i]);
+        }
+    }
+}
+
+static int lept_schema_fail(lept_schema_context* c, const lept_schema_frame* f, int ret) {
+    if (c->path != NULL && c->size > 0) {
+        c->len = 0;
+        lept_schema_path(c, f);
+        c->path[c->len] = '\0';
+    }
+    return ret;
+}
+
+static int lept_schema_is_integer(double n) {
+    return floor(n) == n;
+}
+
+/* code points, not bytes */
+static size_t lept_schema_length(const char* s, size_t len) {
+    size_t i, n = 0;
+    for (i = 0; i < len; i++) {
+        n += ((unsigned char)s[i] & 0xC0) != 0x80;
+    }
+    return n;
+}
+
+static int lept_schema_check(lept_schema_context* c, const lept_schema_node* n, const lept_value* v, const lept_schema_frame* f) {
+    lept_schema_frame child;
+    lept_value e;
+    const lept_value* m;
+    lept_type type = lept_get_type(v);
+    size_t i, len;
+    int ret;
+    if (n->types != 0 && (n->types & LEPT_SCHEMA_BIT(type)) == 0 &&
+        !(type == LEPT_NUMBER && (n->types & LEPT_SCHEMA_INTEGER) && lept_schema_is_integer(v->u.n))) {
+        return lept_schema_fail(c, f, LEPT_SCHEMA_TYPE);
+    }
+    if (n->checks & LEPT_SCHEMA_HAS_ENUM) {
+        for (i = 0; i < n->nvalue && !lept_is_equal_unordered(&c->s->value[n->value + i], v); i++)
+            ;
+        if (i == n->nvalue) {
+            return lept_schema_fail(c, f, LEPT_SCHEMA_ENUM);
+        }
+    }
+    child.parent = f;
+    switch (type) {
+        case LEPT_NUMBER:
+            if (((n->checks & LEPT_SCHEMA_HAS_MINIMUM) && v->u.n < n->minimum) ||
+                ((n->checks & LEPT_SCHEMA_HAS_EXCLUSIVE_MINIMUM) && v->u.n <= n->exclusive_minimum)) {
+                return lept_schema_fail(c, f, LEPT_SCHEMA_MINIMUM);
+            }
+            if (((n->checks & LEPT_SCHEMA_HAS_MAXIMUM) && v->u.n > n->maximum) ||
+                ((n->checks & LEPT_SCHEMA_HAS_EXCLUSIVE_MAXIMUM) && v->u.n >= n->exclusive_maximum)) {
+                return lept_schema_fail(c, f, LEPT_SCHEMA_MAXIMUM);
+            }
+            break;
+        case LEPT_STRING:
+            if (n->checks & (LEPT_SCHEMA_HAS_MIN_LENGTH | LEPT_SCHEMA_HAS_MAX_LENGTH)) {
+                len = lept_schema_length(lept_get_string(v), lept_get_string_length(v));
+                if ((n->checks & LEPT_SCHEMA_HAS_MIN_LENGTH) && len < n->min_length) {
+                    return lept_schema_fail(c, f, LEPT_SCHEMA_MIN_LENGTH);
+                }
+                if ((n->checks & LEPT_SCHEMA_HAS_MAX_LENGTH) && len > n->max_length) {
+                    return lept_schema_fail(c, f, LEPT_SCHEMA_MAX_LENGTH);
+                }
+            }
+            break;
+        case LEPT_ARRAY:
+            if ((n->checks & LEPT_SCHEMA_HAS_MIN_ITEMS) && v->u.a.size < n->min_items) {
+                return lept_schema_fail(c, f, LEPT_SCHEMA_MIN_ITEMS);
+            }
+            if ((n->checks & LEPT_SCHEMA_HAS_MAX_ITEMS) && v->u.a.size > n->max_items) {
+                return lept_schema_fail(c, f, LEPT_SCHEMA_MAX_ITEMS);
+            }
+            if (n->items == 0) {
+                break;
+            }
+            child.key = NULL;
+            child.klen = 0;
+            /* packed elements are checked through a number on the stack */
+            lept_init(&e);
+            for (i = 0; i < v->u.a.size; i++) {
+                child.index = i;
+                if (v->type == LEPT_PACKED_ARRAY) {
+                    lept_set_number(&e, v->u.p.n[i]);
+                    m = &e;
+                }else {
+                    m = &v->u.a.e[i];
+                }
+                if ((ret = lept_schema_check(c, &c->s->node[n->items], m, &child)) != LEPT_SCHEMA_OK) {
+                    return ret;
+                }
+            }
+            break;
+        case LEPT_OBJECT:
+            for (i = 0; i < n->nproperty; i++) {
+                const lept_schema_property* p = &c->s->property[n->property + i];
+                child.key = p->token.key;
+                child.klen = p->token.klen;
+                child.index = 0;
+                if ((m = lept_pointer_member(v, &p->token)) == NULL) {
+                    if (p->required) {
+                        return lept_schema_fail(c, &child, LEPT_SCHEMA_REQUIRED);
+                    }
+                }else if (p->node != 0 && (ret = lept_schema_check(c, &c->s->node[p->node], m, &child)) != LEPT_SCHEMA_OK) {
+                    return ret;
+                }
+            }
+            break;
+        default:
+            break;
+    }
+    return LEPT_SCHEMA_OK;
+}
+
+int lept_schema_validate(const lept_schema* s, const lept_value* v, char* path, size_t size) {
+    lept_schema_context c;
+    lept_schema_frame root;
+    assert(s != NULL && v != NULL);
+    c.s = s;
+    c.path = path;
+    c.size = size;
+    c.len = 0;
+    root.parent = NULL;
+    root.key = NULL;
+    root.klen = root.index = 0;
+    if (path != NULL && size > 0) {
+        path[0] = '\0';
+    }
+    return lept_schema_check(&c, &s->node[0], v, &root);
+}
+
+
+/****** queries ******/
+
+#define LEPT_QUERY_MEMBER       0
+#define LEPT_QUERY_INDEX        1
+#define LEPT_QUERY_WILDCARD     2
+#define LEPT_QUERY_SLICE        3
+#define LEPT_QUERY_FILTER       4
+
+#define LEPT_QUERY_HAS_START    1
+#define LEPT_QUERY_HAS_END      2
+
+/* comparisons in a filter */
+#define LEPT_QUERY_EXISTS       0
+#define LEPT_QUERY_EQ           1
+#define LEPT_QUERY_NE           2
+#define LEPT_QUERY_LT           3
+#define LEPT_QUERY_LE           4
+#define LEPT_QUERY_GT           5
+#define LEPT_QUERY_GE           6
+
+typedef struct {
+    int kind;
+    int descend;                /* ".." in front, the selector is tried at every level */
+    lept_pointer_token token;   /* LEPT_QUERY_MEMBER */
+    long start, end, step;      /* LEPT_QUERY_INDEX uses start only */
+    unsigned bounds;            /* LEPT_QUERY_HAS_* of a slice */
+    size_t term, nterm;         /* LEPT_QUERY_FILTER, range in lept_query.term */
+}lept_query_step;
+
+/* "@.path op literal", terms joined by && unless either is set */
+typedef struct {
+    size_t path, npath;         /* member and index steps from @ */
+    int op;
+    int either;                 /* starts a new || group */
+    int type;                   /* lept_type of the literal */
+    double n;
+    const char* s;
+    size_t len;
+}lept_query_term;
+
+/* one block: header, the main steps then the filter steps, terms, names */
+struct lept_query {
+    size_t size;                /* main steps */
+    lept_query_step* step;
+    lept_query_term* term;
+};
+
+/* the same code counts the first time (q is NULL) and fills in the second */
+typedef struct {
+    const char* p;
+    lept_query* q;
+    size_t size, nstep, nterm;  /* main steps, filter steps, terms */
+    char* buffer;
+    size_t bytes;
+    lept_query_step step;       /* written to while counting */
+    lept_query_term term;
+}lept_query_compiler;
+
+#define QUERY_IS_NAME(ch)   (ISDIGIT(ch) || ((ch) >= 'a' && (ch) <= 'z') || ((ch) >= 'A' && (ch) <= 'Z') || \
+                             (ch) == '_' || (unsigned char)(ch) >= 0x80)
+
+static void lept_query_whitespace(lept_query_compiler* c) {
+    while (*c->p == ' ' || *c->p == '\t' || *c->p == '\n' || *c->p == '\r')
+        c->p++;
+}
+
+static lept_query_step* lept_query_add_step(lept_query_compiler* c, int filter) {
+    lept_query_step* s = &c->step;
+    if (c->q != NULL) {
+        s = filter ? &c->q->step[c->q->size + c->nstep] : &c->q->step[c->size];
+    }
+    c->nstep += filter != 0;
+    c->size += filter == 0;
+    memset(s, 0, sizeof(lept_query_step));
+    return s;
+}
+
+static char* lept_query_add_bytes(lept_query_compiler* c, size_t len) {
+    char* s = c->q != NULL ? c->buffer + c->bytes : NULL;
+    c->bytes += len;
+    return s;
+}
+
+static void lept_query_set_name(lept_query_compiler* c, lept_query_step* s, const char* name, size_t len) {
+    char* key = lept_query_add_bytes(c, len + 1);
+    s->kind = LEPT_QUERY_MEMBER;
+    s->token.klen = len;
+    s->token.index = LEPT_POINTER_NO_INDEX;
+    if (key != NULL) {
+        memcpy(key, name, len);
+        key[len] = '\0';
+        s->token.key = key;
+        s->token.hash = lept_hash_bytes(key, len);
+    }
+}
+
+/* 'name' or "name", only the quote and the backslash can be escaped */
+static int lept_query_quoted(lept_query_compiler* c, const char** s, size_t* len) {
+    char quote = *c->p++;
+    const char* start = c->p;
+    char* out;
+    size_t n = 0;
+    for (; *c->p != quote; c->p++, n++) {
+        if (*c->p == '\0') {
+            return 0;
+        }
+        if (*c->p == '\\') {
+            c->p++;
+            if (*c->p != quote && *c->p != '\\') {
+                return 0;
+            }
+        }
+    }
+    c->p++;
+    out = lept_query_add_bytes(c, n + 1);
+    if (out != NULL) {
+        for (n = 0; start + 1 < c->p; start++) {
+            if (*start == '\\') {
+                start++;
+            }
+            out[n++] = *start;
+        }
+        out[n] = '\0';
+    }
+    *s = out;
+    *len = n;
+    return 1;
+}
+
+static int lept_query_integer(lept_query_compiler* c, long* n) {
+    int negative = *c->p == '-';
+    *n = 0;
+    c->p += negative;
+    if (!ISDIGIT(*c->p)) {
+        return 0;
+    }
+    for (; ISDIGIT(*c->p); c->p++) {
+        if (*n > (LONG_MAX - (*c->p - '0')) / 10) {
+            return 0;
+        }
+        *n = *n * 10 + (*c->p - '0');
+    }
+    if (negative) {
+        *n = -*n;
+    }
+    return 1;
+}
+
+static int lept_query_number(lept_query_compiler* c, double* n) {
+    const char* p = c->p;
+    if (*p == '-') p++;
+    if (!ISDIGIT(*p)) return 0;
+    while (ISDIGIT(*p)) p++;
+    if (*p == '.') {
+        p++;
+        if (!ISDIGIT(*p)) return 0;
+        while (ISDIGIT(*p)) p++;
+    }
+    if (*p == 'e' || *p == 'E') {
+        p++;
+        if (*p == '+' || *p == '-') p++;
+        if (!ISDIGIT(*p)) return 0;
+        while (ISDIGIT(*p)) p++;
+    }
+    *n = strtod(c->p, NULL);
+    c->p = p;
+    return 1;
+}
+
+/* @ followed by .name, ['name'] or [n], one value at most */
+static int lept_query_relative(lept_query_compiler* c, lept_query_term* t) {
+    lept_query_step* s;
+    const char* name;
+    size_t len;
+    if (*c->p++ != '@') {
+        return 0;
+    }
+    t->path = c->nstep;
+    for (t->npath = 0; *c->p == '.' || *c->p == '['; t->npath++) {
+        s = lept_query_add_step(c, 1);
+        if (*c->p++ == '.') {
+            for (name = c->p; QUERY_IS_NAME(*c->p); c->p++)
+                ;
+            if (c->p == name) {
+                return 0;
+            }
+            lept_query_set_name(c, s, name, c->p - name);
+            continue;
+        }
+        lept_query_whitespace(c);
+        if (*c->p == '\'' || *c->p == '\"') {
+            if (!lept_query_quoted(c, &name, &len)) {
+                return 0;
+            }
+            s->kind = LEPT_QUERY_MEMBER;
+            s->token.key = name;
+            s->token.klen = len;
+            s->token.index = LEPT_POINTER_NO_INDEX;
+            if (name != NULL) {
+                s->token.hash = lept_hash_bytes(name, len);
+            }
+        }else {
+            s->kind = LEPT_QUERY_INDEX;
+            if (!lept_query_integer(c, &s->start)) {
+                return 0;
+            }
+        }
+        lept_query_whitespace(c);
+        if (*c->p++ != ']') {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int lept_query_term_parse(lept_query_compiler* c, lept_query_term* t) {
+    static const char* const ops[] = { "==", "!=", "<=", ">=", "<", ">" };
+    static const int codes[] = { LEPT_QUERY_EQ, LEPT_QUERY_NE, LEPT_QUERY_LE, LEPT_QUERY_GE, LEPT_QUERY_LT, LEPT_QUERY_GT };
+    size_t i;
+    if (!lept_query_relative(c, t)) {
+        return 0;
+    }
+    lept_query_whitespace(c);
+    for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (strncmp(c->p, ops[i], strlen(ops[i])) == 0) {
+            break;
+        }
+    }
+    if (i == sizeof(ops) / sizeof(ops[0])) {
+        t->op = LEPT_QUERY_EXISTS;
+        return 1;
+    }
+    t->op = codes[i];
+    c->p += strlen(ops[i]);
+    lept_query_whitespace(c);
+    if (*c->p == '\'' || *c->p == '\"') {
+        t->type = LEPT_STRING;
+        return lept_query_quoted(c, &t->s, &t->len);
+    }
+    if (strncmp(c->p, "true", 4) == 0)  { c->p += 4; t->type = LEPT_TRUE;  return 1; }
+    if (strncmp(c->p, "false", 5) == 0) { c->p += 5; t->type = LEPT_FALSE; return 1; }
+    if (strncmp(c->p, "null", 4) == 0)  { c->p += 4; t->type = LEPT_NULL;  return 1; }
+    t->type = LEPT_NUMBER;
+    return lept_query_number(c, &t->n);
+}
+
+/* after "[?", with or without the parentheses around it */
+static int lept_query_filter(lept_query_compiler* c, lept_query_step* s) {
+    lept_query_term* t;
+    int paren, either = 0;
+    lept_query_whitespace(c);
+    if ((paren = *c->p == '(') != 0) {
+        c->p++;
+    }
+    s->kind = LEPT_QUERY_FILTER;
+    s->term = c->nterm;
+    for (;;) {
+        t = c->q != NULL ? &c->q->term[c->nterm] : &c->term;
+        c->nterm++;
+        s->nterm++;
+        memset(t, 0, sizeof(lept_query_term));
+        t->either = either;
+        lept_query_whitespace(c);
+        if (!lept_query_term_parse(c, t)) {
+            return 0;
+        }
+        lept_query_whitespace(c);
+        if (strncmp(c->p, "&&", 2) == 0 || strncmp(c->p, "||", 2) == 0) {
+            either = *c->p == '|';
+            c->p += 2;
+        }else {
+            break;
+        }
+    }
+    if (paren && *c->p++ != ')') {
+        return 0;
+    }
+    return 1;
+}
+
+static int lept_query_bracket(lept_query_compiler* c, lept_query_step* s) {
+    const char* name;
+    size_t len;
+    lept_query_whitespace(c);
+    if (*c->p == '\'' || *c->p == '\"') {
+        if (!lept_query_quoted(c, &name, &len)) {
+            return 0;
+        }
+        s->kind = LEPT_QUERY_MEMBER;
+        s->token.key = name;
+        s->token.klen = len;
+        s->token.index = LEPT_POINTER_NO_INDEX;
+        if (name != NULL) {
+            s->token.hash = lept_hash_bytes(name, len);
+        }
+    }else if (*c->p == '*') {
+        c->p++;
+        s->kind = LEPT_QUERY_WILDCARD;
+    }else if (*c->p == '?') {
+        c->p++;
+        if (!lept_query_filter(c, s)) {
+            return 0;
+        }
+    }else {
+        /* n, or start:end:step with any part left out */
+        s->kind = LEPT_QUERY_INDEX;
+        s->step = 1;
+        if (*c->p != ':') {
+            if (!lept_query_integer(c, &s->start)) {
+                return 0;
+            }
+            s->bounds |= LEPT_QUERY_HAS_START;
+            lept_query_whitespace(c);
+        }
+        if (*c->p == ':') {
+            s->kind = LEPT_QUERY_SLICE;
+            c->p++;
+            lept_query_whitespace(c);
+            if (*c->p == '-' || ISDIGIT(*c->p)) {
+                if (!lept_query_integer(c, &s->end)) {
+                    return 0;
+                }
+                s->bounds |= LEPT_QUERY_HAS_END;
+                lept_query_whitespace(c);
+            }
+            if (*c->p == ':') {
+                c->p++;
+                lept_query_whitespace(c);
+                if ((*c->p == '-' || ISDIGIT(*c->p)) && !lept_query_integer(c, &s->step)) {
+                    return 0;
+                }
+            }
+        }
+    }
+    lept_query_whitespace(c);
+    return *c->p++ == ']';
+}
+
+static int lept_query_parse(lept_query_compiler* c) {
+    lept_query_step* s;
+    const char* name;
+    if (*c->p++ != '$') {
+        return 0;
+    }
+    while (*c->p != '\0') {
+        s = lept_query_add_step(c, 0);
+        if (c->p[0] == '.' && c->p[1] == '.') {
+            s->descend = 1;
+            c->p += 2;
+            if (*c->p == '[') {
+                c->p++;
+                if (!lept_query_bracket(c, s)) {
+                    return 0;
+                }
+                continue;
+            }
+        }else if (*c->p == '.') {
+            c->p++;
+        }else if (*c->p == '[') {
+            c->p++;
+            if (!lept_query_bracket(c, s)) {
+                return 0;
+            }
+            continue;
+        }else {
+            return 0;
+        }
+        if (*c->p == '*') {
+            c->p++;
+            s->kind = LEPT_QUERY_WILDCARD;
+            continue;
+        }
+        for (name = c->p; QUERY_IS_NAME(*c->p); c->p++)
+            ;
+        if (c->p == name) {
+            return 0;
+        }
+        lept_query_set_name(c, s, name, c->p - name);
+    }
+    return 1;
+}
+
+/* NULL if the query is not understood */
+lept_query* lept_query_compile(const char* query) {
+    lept_query_compiler c;
+    lept_query* q;
+    assert(query != NULL);
+    memset(&c, 0, sizeof(c));
+    c.p = query;
+    if (!lept_query_parse(&c)) {
+        return NULL;
+    }
+    q = (lept_query*) malloc(sizeof(lept_query) + sizeof(lept_query_step) * (c.size + c.nstep) +
+        sizeof(lept_query_term) * c.nterm + c.bytes);
+    LEPT_STATS_ALLOC(sizeof(lept_query) + sizeof(lept_query_step) * (c.size + c.nstep) +
+        sizeof(lept_query_term) * c.nterm + c.bytes);
+    assert(q != NULL);
+    q->size = c.size;
+    q->step = (lept_query_step*)(q + 1);
+    q->term = (lept_query_term*)(q->step + c.size + c.nstep);
+    c.buffer = (char*)(q->term + c.nterm);
+    c.p = query;
+    c.q = q;
+    c.size = c.nstep = c.nterm = c.bytes = 0;
+    lept_query_parse(&c);
+    return q;
+}
+
+void lept_query_free(lept_query* q) {
+    free(q);
+}
+
+typedef struct {
+    const lept_query* q;
+    lept_query_callback callback;
+    void* context;
+    size_t count;
+    int stop;
+}lept_query_context;
+
+#define LEPT_QUERY_IS_ARRAY(v)  ((v)->type == LEPT_ARRAY || (v)->type == LEPT_PACKED_ARRAY)
+
+/* a negative index counts from the end, NULL when out of range */
+static const lept_value* lept_query_element(const lept_value* v, long index, lept_value* number) {
+    size_t i;
+    if (!LEPT_QUERY_IS_ARRAY(v)) {
+        return NULL;
+    }
+    if (index < 0) {
+        if ((size_t)-(index + 1) >= v->u.a.size) {
+            return NULL;
+        }
+        i = v->u.a.size - (size_t)-(index + 1) - 1;
+    }else if ((i = (size_t)index) >= v->u.a.size) {
+        return NULL;
+    }
+    return lept_peek_array_element(v, i, number);
+}
+
+static int lept_query_compare(const lept_query_term* t, const lept_value* v) {
+    int cmp;
+    size_t len;
+    if (t->op == LEPT_QUERY_EXISTS) {
+        return v != NULL;
+    }
+    /* different types are never equal nor ordered */
+    if (v == NULL || (int)v->type != t->type) {
+        return t->op == LEPT_QUERY_NE;
+    }
+    if (v->type == LEPT_NUMBER) {
+        cmp = v->u.n < t->n ? -1 : v->u.n > t->n;
+    }else if (v->type == LEPT_STRING) {
+        len = lept_get_string_length(v);
+        if ((cmp = memcmp(lept_get_string(v), t->s, len < t->len ? len : t->len)) == 0) {
+            cmp = len < t->len ? -1 : len > t->len;
+        }
+    }else {
+        cmp = 0;
+    }
+    switch (t->op) {
+        case LEPT_QUERY_EQ: return cmp == 0;
+        case LEPT_QUERY_NE: return cmp != 0;
+        case LEPT_QUERY_LT: return cmp < 0;
+        case LEPT_QUERY_LE: return cmp <= 0;
+        case LEPT_QUERY_GT: return cmp > 0;
+        default:            return cmp >= 0;
+    }
+}
+
+/* && binds tighter than || */
+static int lept_query_test(const lept_query* q, const lept_query_step* s, const lept_value* v) {
+    const lept_query_term* t;
+    const lept_query_step* p;
+    const lept_value* e;
+    lept_value number;
+    size_t i, j;
+    int all = 1;
+    for (i = 0; i < s->nterm; i++) {
+        t = &q->term[s->term + i];
+        if (t->either) {
+            if (all) {
+                return 1;
+            }
+            all = 1;
+        }
+        if (!all) {
+            continue;
+        }
+        for (e = v, j = 0; j < t->npath && e != NULL; j++) {
+            p = &q->step[q->size + t->path + j];
+            if (p->kind == LEPT_QUERY_MEMBER) {
+                e = e->type == LEPT_OBJECT ? lept_pointer_member(e, &p->token) : NULL;
+            }else {
+                e = lept_query_element(e, p->start, &number);
+            }
+        }
+        all = lept_query_compare(t, e);
+    }
+    return all;
+}
+
+static void lept_query_match(lept_query_context* c, size_t index, const lept_value* v);
+
+/* the slice bounds are clamped as in RFC 9535, a step past end stops without overflowing */
+static void lept_query_slice(lept_query_context* c, size_t index, const lept_value* v) {
+    const lept_query_step* s = &c->q->step[index];
+    long size = (long)v->u.a.size, start, end, i;
+    lept_value number;
+    if (s->step == 0) {
+        return;
+    }
+    if (s->step > 0) {
+        start = !(s->bounds & LEPT_QUERY_HAS_START) ? 0 : s->start < 0 ? s->start + size : s->start;
+        end = !(s->bounds & LEPT_QUERY_HAS_END) ? size : s->end < 0 ? s->end + size : s->end;
+        start = start < 0 ? 0 : start > size ? size : start;
+        end = end < 0 ? 0 : end > size ? size : end;
+        for (i = start; i < end && !c->stop; i = s->step < end - i ? i + s->step : end) {
+            lept_query_match(c, index + 1, lept_peek_array_element(v, (size_t)i, &number));
+        }
+    }else {
+        start = !(s->bounds & LEPT_QUERY_HAS_START) ? size - 1 : s->start < 0 ? s->start + size : s->start;
+        end = !(s->bounds & LEPT_QUERY_HAS_END) ? -1 : s->end < 0 ? s->end + size : s->end;
+        start = start < -1 ? -1 : start >= size ? size - 1 : start;
+        end = end < -1 ? -1 : end >= size ? size - 1 : end;
+        for (i = start; i > end && !c->stop; i = s->step > end - i ? i + s->step : end) {
+            lept_query_match(c, index + 1, lept_peek_array_element(v, (size_t)i, &number));
+        }
+    }
+}
+
+/* the children of v picked by the step at index, each goes on to the next step */
+static void lept_query_select(lept_query_context* c, size_t index, const lept_value* v) {
+    const lept_query_step* s = &c->q->step[index];
+    const lept_value* e;
+    lept_value number;
+    size_t i;
+    switch (s->kind) {
+        case LEPT_QUERY_MEMBER:
+            if (v->type == LEPT_OBJECT && (e = lept_pointer_member(v, &s->token)) != NULL) {
+                lept_query_match(c, index + 1, e);
+            }
+            break;
+        case LEPT_QUERY_INDEX:
+            if ((e = lept_query_element(v, s->start, &number)) != NULL) {
+                lept_query_match(c, index + 1, e);
+            }
+            break;
+        case LEPT_QUERY_SLICE:
+            if (LEPT_QUERY_IS_ARRAY(v)) {
+                lept_query_slice(c, index, v);
+            }
+            break;
+        default:
+            if (v->type == LEPT_OBJECT) {
+                for (i = 0; i < v->u.o.size && !c->stop; i++) {
+                    e = &v->u.o.m[i].v;
+                    if (s->kind == LEPT_QUERY_WILDCARD || lept_query_test(c->q, s, e)) {
+                        lept_query_match(c, index + 1, e);
+                    }
+                }
+            }else if (LEPT_QUERY_IS_ARRAY(v)) {
+                for (i = 0; i < v->u.a.size && !c->stop; i++) {
+                    e = lept_peek_array_element(v, i, &number);
+                    if (s->kind == LEPT_QUERY_WILDCARD || lept_query_test(c->q, s, e)) {
+                        lept_query_match(c, index + 1, e);
+                    }
+                }
+            }
+            break;
+    }
+}
+
+static void lept_query_match(lept_query_context* c, size_t index, const lept_value* v) {
+    lept_value number;
+    size_t i;
+    if (c->stop) {
+        return;
+    }
+    if (index == c->q->size) {
+        c->count++;
+        c->stop = c->callback != NULL && c->callback(v, c->context) != 0;
+        return;
+    }
+    lept_query_select(c, index, v);
+    /* "..": the same step again one level down */
+    if (c->q->step[index].descend) {
+        if (v->type == LEPT_OBJECT) {
+            for (i = 0; i < v->u.o.size && !c->stop; i++) {
+                lept_query_match(c, index, &v->u.o.m[i].v);
+            }
+        }else if (LEPT_QUERY_IS_ARRAY(v)) {
+            for (i = 0; i < v->u.a.size && !c->stop; i++) {
+                lept_query_match(c, index, lept_peek_array_element(v, i, &number));
+            }
+        }
+    }
+}
+
+/*
+ * calls back with every match in document order, nothing is allocated.
+ * a non-zero return from the callback stops the walk. a NULL callback
+ * just counts. v is never changed, an element of a packed array is passed
+ * as a number that only lives until the callback returns.
+ */
+size_t lept_query_run(const lept_query* q, const lept_value* v, lept_query_callback callback, void* context) {
+    lept_query_context c;
+    assert(q != NULL && v != NULL);
+    c.q = q;
+    c.callback = callback;
+    c.context = context;
+    c.count = 0;
+    c.stop = 0;
+    lept_query_match(&c, 0, v);
+    return c.count;
+}
+
+
+/****** patch ******/
+
+#define LEPT_PATCH_PUT          0
+#define LEPT_PATCH_TAKE         1
+
+/* where the value of a PUT goes back to when it is undone */
+#define LEPT_PATCH_FROM_PATCH       0
+#define LEPT_PATCH_FROM_COPY        1   /* freed */
+#define LEPT_PATCH_FROM_PREVIOUS    2   /* the TAKE just before, for move */
+
+/* enough to put things back as they were, kept until the whole patch is done */
+typedef struct {
+    int kind;
+    const char* path;           /* escaped, from the patch itself */
+    size_t len;
+    size_t index;               /* of the member or element */
+    int inserted;               /* PUT added a member or element rather than replacing one */
+    int origin;                 /* LEPT_PATCH_FROM_* of a PUT */
+    lept_value* source;
+    lept_member m;              /* what TAKE removed, or the value PUT replaced in m.v */
+}lept_patch_undo;
+
+typedef struct {
+    lept_value* doc;
+    lept_patch_undo* log;
+    size_t size, capacity;
+}lept_patch_context;
+
+static lept_patch_undo* lept_patch_log(lept_patch_context* c, int kind, const char* path, size_t len) {
+    lept_patch_undo* e;
+    size_t capacity;
+    if (c->size == c->capacity) {
+        capacity = lept_grow_capacity(c->capacity);
+        c->log = (lept_patch_undo*) realloc(c->log, sizeof(lept_patch_undo) * capacity);
+        LEPT_STATS_REALLOC(sizeof(lept_patch_undo) * c->capacity, sizeof(lept_patch_undo) * capacity);
+        assert(c->log != NULL);
+        c->capacity = capacity;
+    }
+    e = &c->log[c->size++];
+    memset(e, 0, sizeof(lept_patch_undo));
+    e->kind = kind;
+    e->path = path;
+    e->len = len;
+    lept_init(&e->m.v);
+    return e;
+}
+
+/* "" or "/..." with every '~' followed by 0 or 1 */
+static int lept_patch_path_is_valid(const char* path, size_t len) {
+    size_t i;
+    if (len > 0 && path[0] != '/') {
+        return 0;
+    }
+    for (i = 0; i < len; i++) {
+        if (path[i] == '~' && (i + 1 == len || (path[i + 1] != '0' && path[i + 1] != '1'))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* the token is compared still escaped, nothing is copied */
+static int lept_patch_token_is(const char* key, size_t klen, const char* t, size_t tlen) {
+    size_t i, j;
+    char ch;
+    for (i = j = 0; i < klen && j < tlen; i++, j++) {
+        ch = t[j];
+        if (ch == '~') {
+            ch = t[++j] == '0' ? '~' : '/';
+        }
+        if (key[i] != ch) {
+            return 0;
+        }
+    }
+    return i == klen && j == tlen;
+}
+
+/* a member or an element of v, false when there is none */
+static int lept_patch_find(lept_value* v, const char* t, size_t tlen, size_t* index) {
+    size_t i;
+    if (v->type == LEPT_OBJECT) {
+        for (i = 0; i < v->u.o.size; i++) {
+            if (lept_patch_token_is(LEPT_MEMBER_KEY(&v->u.o.m[i]), v->u.o.m[i].klen, t, tlen)) {
+                *index = i;
+                return 1;
+            }
+        }
+        return 0;
+    }
+    if (v->type != LEPT_ARRAY && v->type != LEPT_PACKED_ARRAY) {
+        return 0;
+    }
+    lept_unpack_array(v);
+    *index = lept_pointer_index(t, tlen);
+    return *index < v->u.a.size;
+}
+
+static lept_value* lept_patch_child(lept_value* v, size_t index) {
+    return v->type == LEPT_OBJECT ? &v->u.o.m[index].v : &v->u.a.e[index];
+}
+
+/* the container of the last token, which is left in token */
+static lept_value* lept_patch_parent(lept_value* doc, const char* path, size_t len, const char** token, size_t* tlen) {
+    const char* end = path + len;
+    const char* t;
+    size_t i;
+    assert(len > 0 && path[0] == '/');
+    for (;;) {
+        for (t = ++path; path < end && *path != '/'; path++)
+            ;
+        if (path == end) {
+            *token = t;
+            *tlen = path - t;
+            return doc;
+        }
+        if (!lept_patch_find(doc, t, path - t, &i)) {
+            return NULL;
+        }
+        doc = lept_patch_child(doc, i);
+    }
+}
+
+static lept_value* lept_patch_get(lept_value* doc, const char* path, size_t len) {
+    const char* t;
+    size_t tlen, i;
+    if (len == 0) {
+        return doc;
+    }
+    if ((doc = lept_patch_parent(doc, path, len, &t, &tlen)) == NULL || !lept_patch_find(doc, t, tlen, &i)) {
+        return NULL;
+    }
+    return lept_patch_child(doc, i);
+}
+
+static void lept_patch_set_key(lept_member* m, const char* t, size_t tlen) {
+    char* key;
+    size_t i, klen;
+    if (memchr(t, '~', tlen) == NULL) {
+        lept_member_set_key(m, t, tlen, NULL);
+        return;
+    }
+    key = (char*) malloc(tlen);
+    LEPT_STATS_ALLOC(tlen);
+    assert(key != NULL);
+    for (i = klen = 0; i < tlen; i++) {
+        key[klen++] = t[i] == '~' ? (t[++i] == '0' ? '~' : '/') : t[i];
+    }
+    lept_member_set_key(m, key, klen, NULL);
+    free(key);
+}
+
+/*
+ * moves *value to path. insert is add, which puts a new element into an
+ * array, otherwise it is replace and the target has to exist already.
+ */
+static int lept_patch_put(lept_patch_context* c, const char* path, size_t len, lept_value* value, int origin, int insert) {
+    lept_patch_undo* e = lept_patch_log(c, LEPT_PATCH_PUT, path, len);
+    lept_value* parent;
+    lept_member* m;
+    const char* t;
+    size_t tlen, i;
+    e->origin = origin;
+    e->source = value;
+    if (origin == LEPT_PATCH_FROM_PREVIOUS) {
+        value = &c->log[c->size - 2].m.v;
+    }
+    if (len == 0) {
+        lept_move(&e->m.v, c->doc);
+        lept_move(c->doc, value);
+        return LEPT_PATCH_OK;
+    }
+    if ((parent = lept_patch_parent(c->doc, path, len, &t, &tlen)) == NULL) {
+        c->size--;
+        return LEPT_PATCH_NOT_FOUND;
+    }
+    if (parent->type == LEPT_OBJECT) {
+        if (!lept_patch_find(parent, t, tlen, &i)) {
+            if (!insert) {
+                c->size--;
+                return LEPT_PATCH_NOT_FOUND;
+            }
+            if (parent->u.o.size == parent->u.o.capacity) {
+                lept_reserve_object(parent, lept_grow_capacity(parent->u.o.capacity));
+            }
+            i = parent->u.o.size++;
+            m = &parent->u.o.m[i];
+            lept_patch_set_key(m, t, tlen);
+            lept_init(&m->v);
+            e->inserted = 1;
+        }
+    }else if (parent->type == LEPT_ARRAY || parent->type == LEPT_PACKED_ARRAY) {
+        lept_unpack_array(parent);
+        i = tlen == 1 && *t == '-' ? parent->u.a.size : lept_pointer_index(t, tlen);
+        if (insert ? i > parent->u.a.size : i >= parent->u.a.size) {
+            c->size--;
+            return LEPT_PATCH_NOT_FOUND;
+        }
+        if (insert) {
+            lept_insert_array_element(parent, i);
+            e->inserted = 1;
+        }
+    }else {
+        c->size--;
+        return LEPT_PATCH_NOT_FOUND;
+    }
+    e->index = i;
+    if (!e->inserted) {
+        lept_move(&e->m.v, lept_patch_child(parent, i));
+    }
+    lept_move(lept_patch_child(parent, i), value);
+    return LEPT_PATCH_OK;
+}
+
+/* takes the member or element at path out, its key and value are kept in the log */
+static int lept_patch_take(lept_patch_context* c, const char* path, size_t len) {
+    lept_patch_undo* e;
+    lept_value* parent;
+    const char* t;
+    size_t tlen, i;
+    if (len == 0) {
+        return LEPT_PATCH_INVALID;
+    }
+    if ((parent = lept_patch_parent(c->doc, path, len, &t, &tlen)) == NULL || !lept_patch_find(parent, t, tlen, &i)) {
+        return LEPT_PATCH_NOT_FOUND;
+    }
+    e = lept_patch_log(c, LEPT_PATCH_TAKE, path, len);
+    e->index = i;
+    if (parent->type == LEPT_OBJECT) {
+        memcpy(&e->m, &parent->u.o.m[i], sizeof(lept_member));
+        memmove(&parent->u.o.m[i], &parent->u.o.m[i + 1], sizeof(lept_member) * (parent->u.o.size - i - 1));
+        parent->u.o.size--;
+    }else {
+        memcpy(&e->m.v, &parent->u.a.e[i], sizeof(lept_value));
+        memmove(&parent->u.a.e[i], &parent->u.a.e[i + 1], sizeof(lept_value) * (parent->u.a.size - i - 1));
+        parent->u.a.size--;
+    }
+    return LEPT_PATCH_OK;
+}
+
+/* the document is exactly as it was right after e, so the path still resolves */
+static void lept_patch_undo_entry(lept_patch_context* c, size_t k) {
+    lept_patch_undo* e = &c->log[k];
+    lept_value* parent = c->doc;
+    lept_value* current;
+    const char* t;
+    size_t tlen;
+    if (e->len > 0) {
+        parent = lept_patch_parent(c->doc, e->path, e->len, &t, &tlen);
+        assert(parent != NULL);
+    }
+    if (e->kind == LEPT_PATCH_TAKE) {
+        if (parent->type == LEPT_OBJECT) {
+            if (parent->u.o.size == parent->u.o.capacity) {
+                lept_reserve_object(parent, lept_grow_capacity(parent->u.o.capacity));
+            }
+            memmove(&parent->u.o.m[e->index + 1], &parent->u.o.m[e->index], sizeof(lept_member) * (parent->u.o.size - e->index));
+            memcpy(&parent->u.o.m[e->index], &e->m, sizeof(lept_member));
+            parent->u.o.size++;
+        }else {
+            memcpy(lept_insert_array_element(parent, e->index), &e->m.v, sizeof(lept_value));
+        }
+        return;
+    }
+    current = e->len == 0 ? c->doc : lept_patch_child(parent, e->index);
+    switch (e->origin) {
+        case LEPT_PATCH_FROM_PATCH:     lept_move(e->source, current); break;
+        case LEPT_PATCH_FROM_PREVIOUS:  lept_move(&c->log[k - 1].m.v, current); break;
+        default:                        lept_free(current); break;
+    }
+    if (e->inserted) {
+        if (parent->type == LEPT_OBJECT) {
+            lept_remove_object_value(parent, e->index);
+        }else {
+            lept_erase_array_element(parent, e->index, 1);
+        }
+    }else {
+        lept_move(current, &e->m.v);
+    }
+}
+
+static const char* lept_patch_member(const lept_value* op, const char* key, size_t* len) {
+    const lept_value* v = lept_find_object_value(op, key, strlen(key));
+    if (v == NULL || v->type != LEPT_STRING) {
+        return NULL;
+    }
+    *len = lept_get_string_length(v);
+    return lept_get_string(v);
+}
+
+static int lept_patch_apply_op(lept_patch_context* c, lept_value* op) {
+    const char *name, *path, *from = NULL;
+    size_t nlen, len, flen = 0;
+    lept_value* value = NULL;
+    lept_value copy;
+    int ret;
+    if (op->type != LEPT_OBJECT ||
+        (name = lept_patch_member(op, "op", &nlen)) == NULL ||
+        (path = lept_patch_member(op, "path", &len)) == NULL || !lept_patch_path_is_valid(path, len)) {
+        return LEPT_PATCH_INVALID;
+    }
+    if (nlen == 4 && (memcmp(name, "move", 4) == 0 || memcmp(name, "copy", 4) == 0)) {
+        if ((from = lept_patch_member(op, "from", &flen)) == NULL || !lept_patch_path_is_valid(from, flen)) {
+            return LEPT_PATCH_INVALID;
+        }
+    }else if ((value = lept_find_object_value(op, "value", 5)) == NULL && !(nlen == 6 && memcmp(name, "remove", 6) == 0)) {
+        return LEPT_PATCH_INVALID;
+    }
+    if (nlen == 3 && memcmp(name, "add", 3) == 0) {
+        return lept_patch_put(c, path, len, value, LEPT_PATCH_FROM_PATCH, 1);
+    }
+    if (nlen == 6 && memcmp(name, "remove", 6) == 0) {
+        return lept_patch_take(c, path, len);
+    }
+    if (nlen == 7 && memcmp(name, "replace", 7) == 0) {
+        return lept_patch_put(c, path, len, value, LEPT_PATCH_FROM_PATCH, 0);
+    }
+    if (nlen == 4 && memcmp(name, "test", 4) == 0) {
+        const lept_value* v = lept_patch_get(c->doc, path, len);
+        return v == NULL ? LEPT_PATCH_NOT_FOUND : lept_is_equal_unordered(v, value) ? LEPT_PATCH_OK : LEPT_PATCH_TEST_FAILED;
+    }
+    if (nlen == 4 && memcmp(name, "move", 4) == 0) {
+        if (flen == len && memcmp(from, path, len) == 0) {
+            return lept_patch_get(c->doc, from, flen) != NULL ? LEPT_PATCH_OK : LEPT_PATCH_NOT_FOUND;
+        }
+        /* not into one of its own children */
+        if (flen < len && memcmp(from, path, flen) == 0 && path[flen] == '/') {
+            return LEPT_PATCH_INVALID;
+        }
+        if ((ret = lept_patch_take(c, from, flen)) != LEPT_PATCH_OK) {
+            return ret;
+        }
+        if ((ret = lept_patch_put(c, path, len, NULL, LEPT_PATCH_FROM_PREVIOUS, 1)) != LEPT_PATCH_OK) {
+            lept_patch_undo_entry(c, --c->size);
+        }
+        return ret;
+    }
+    if (nlen == 4 && memcmp(name, "copy", 4) == 0) {
+        if ((value = lept_patch_get(c->doc, from, flen)) == NULL) {
+            return LEPT_PATCH_NOT_FOUND;
+        }
+        lept_init(&copy);
+        lept_copy(&copy, value);
+        if ((ret = lept_patch_put(c, path, len, &copy, LEPT_PATCH_FROM_COPY, 1)) != LEPT_PATCH_OK) {
+            lept_free(&copy);
+        }
+        return ret;
+    }
+    return LEPT_PATCH_INVALID;
+}
+
+/*
+ * RFC 6902, in place. values are moved out of the patch, not copied.
+ * when an operation fails the ones before it are undone, so both the
+ * document and the patch are left as they were.
+ */
+int lept_apply_patch(lept_value* doc, lept_value* patch) {
+    lept_patch_context c;
+    size_t i;
+    int ret = LEPT_PATCH_OK;
+    assert(doc != NULL && patch != NULL);
+    if (patch->type != LEPT_ARRAY) {
+        return patch->type == LEPT_PACKED_ARRAY && patch->u.p.size == 0 ? LEPT_PATCH_OK : LEPT_PATCH_INVALID;
+    }
+    c.doc = doc;
+    c.log = NULL;
+    c.size = c.capacity = 0;
+    for (i = 0; i < patch->u.a.size && ret == LEPT_PATCH_OK; i++) {
+        ret = lept_patch_apply_op(&c, &patch->u.a.e[i]);
+    }
+    if (ret != LEPT_PATCH_OK) {
+        while (c.size > 0) {
+            lept_patch_undo_entry(&c, --c.size);
+        }
+    }
+    for (i = 0; i < c.size; i++) {
+        if (c.log[i].kind == LEPT_PATCH_TAKE) {
+            lept_member_free_key(&c.log[i].m);
+        }
+        lept_free(&c.log[i].m.v);
+    }
+    free(c.log);
+    return ret;
+}
+
+/* RFC 7396, in place, it can not fail. the patch is left with nulls where its values were */
+void lept_apply_merge_patch(lept_value* doc, lept_value* patch) {
+    lept_member* m;
+    int i;
+    size_t j;
+    assert(doc != NULL && patch != NULL);
+    if (patch->type != LEPT_OBJECT) {
+        lept_move(doc, patch);
+        return;
+    }
+    if (doc->type != LEPT_OBJECT) {
+        lept_set_object(doc, patch->u.o.size);
+    }
+    for (j = 0; j < patch->u.o.size; j++) {
+        m = &patch->u.o.m[j];
+        if (m->v.type == LEPT_NULL) {
+            if ((i = lept_find_object_index(doc, LEPT_MEMBER_KEY(m), m->klen)) >= 0) {
+                lept_remove_object_value(doc, (size_t)i);
+            }
+        }else {
+            lept_apply_merge_patch(lept_set_object_value(doc, LEPT_MEMBER_KEY(m), m->klen), &m->v);
+        }
+    }
+}
+
+
+/****** diff ******/
+
+#ifndef LEPT_DIFF_LCS_MAX
+#define LEPT_DIFF_LCS_MAX   (1 << 16)   /* cells of the LCS table, longer runs are paired by position */
+#endif
+
+#define LEPT_DIFF_LINEAR    8           /* objects up to this size are matched without a table */
+
+typedef struct {
+    lept_value* patch;
+    char* path;
+    size_t len, capacity;
+}lept_diff_context;
+
+static void lept_diff_putc(lept_diff_context* c, char ch) {
+    size_t capacity;
+    if (c->len == c->capacity) {
+        capacity = lept_grow_capacity(c->capacity);
+        c->path = (char*) realloc(c->path, capacity);
+        LEPT_STATS_REALLOC(c->capacity, capacity);
+        assert(c->path != NULL);
+        c->capacity = capacity;
+    }
+    c->path[c->len++] = ch;
+}
+
+static void lept_diff_push_key(lept_diff_context* c, const char* key, size_t klen) {
+    size_t i;
+    lept_diff_putc(c, '/');
+    for (i = 0; i < klen; i++) {
+        switch (key[i]) {
+            case '~': lept_diff_putc(c, '~'); lept_diff_putc(c, '0'); break;
+            case '/': lept_diff_putc(c, '~'); lept_diff_putc(c, '1'); break;
+            default:  lept_diff_putc(c, key[i]);
+        }
+    }
+}
+
+static void lept_diff_push_index(lept_diff_context* c, size_t index) {
+    char buffer[24];
+    size_t i;
+    sprintf(buffer, "/%lu", (unsigned long)index);
+    for (i = 0; buffer[i] != '\0'; i++) {
+        lept_diff_putc(c, buffer[i]);
+    }
+}
+
+/* one operation at the current path, value is copied when given */
+static void lept_diff_emit(lept_diff_context* c, const char* op, const lept_value* value) {
+    lept_value* e = lept_pushback_array_element(c->patch);
+    lept_set_object(e, 3);
+    lept_set_string(lept_set_object_value(e, "op", 2), op, strlen(op));
+    lept_set_string(lept_set_object_value(e, "path", 4), c->path, c->len);
+    if (value != NULL) {
+        lept_copy(lept_set_object_value(e, "value", 5), value);
+    }
+}
+
+static void lept_diff_value(lept_diff_context* c, const lept_value* a, const lept_value* b);
+
+/* matched by key, through a table of b's keys once the objects get big */
+static void lept_diff_object(lept_diff_context* c, const lept_value* a, const lept_value* b) {
+    size_t i, j, h, mask = 0, len = c->len;
+    size_t* table = NULL;
+    unsigned char* matched;
+    const lept_member* m;
+    if (b->u.o.size > LEPT_DIFF_LINEAR) {
+        for (mask = 1; mask < b->u.o.size * 2; mask <<= 1)
+            ;
+        table = (size_t*) calloc(1, sizeof(size_t) * mask + b->u.o.size);
+        LEPT_STATS_ALLOC(sizeof(size_t) * mask + b->u.o.size);
+        assert(table != NULL);
+        matched = (unsigned char*)(table + mask);
+        mask--;
+        /* slots hold index + 1, 0 is empty */
+        for (j = 0; j < b->u.o.size; j++) {
+            m = &b->u.o.m[j];
+            for (h = lept_hash_bytes(LEPT_MEMBER_KEY(m), m->klen) & mask; table[h] != 0; h = (h + 1) & mask)
+                ;
+            table[h] = j + 1;
+        }
+    }else {
+        matched = (unsigned char*) calloc(1, b->u.o.size + 1);
+        LEPT_STATS_ALLOC(b->u.o.size + 1);
+        assert(matched != NULL);
+    }
+    for (i = 0; i < a->u.o.size; i++) {
+        m = &a->u.o.m[i];
+        j = b->u.o.size;
+        if (table == NULL) {
+            for (j = 0; j < b->u.o.size && !lept_member_key_equal(m, &b->u.o.m[j]); j++)
+                ;
+        }else {
+            for (h = lept_hash_bytes(LEPT_MEMBER_KEY(m), m->klen) & mask; table[h] != 0; h = (h + 1) & mask) {
+                if (lept_member_key_equal(m, &b->u.o.m[table[h] - 1])) {
+                    j = table[h] - 1;
+                    break;
+                }
+            }
+        }
+        lept_diff_push_key(c, LEPT_MEMBER_KEY(m), m->klen);
+        if (j == b->u.o.size) {
+            lept_diff_emit(c, "remove", NULL);
+        }else {
+            matched[j] = 1;
+            lept_diff_value(c, &m->v, &b->u.o.m[j].v);
+        }
+        c->len = len;
+    }
+    for (j = 0; j < b->u.o.size; j++) {
+        if (!matched[j]) {
+            m = &b->u.o.m[j];
+            lept_diff_push_key(c, LEPT_MEMBER_KEY(m), m->klen);
+            lept_diff_emit(c, "add", &m->v);
+            c->len = len;
+        }
+    }
+    free(table != NULL ? (void*)table : (void*)matched);
+}
+
+/* a[i] at position k of the array as patched so far becomes b[j] */
+static void lept_diff_element(lept_diff_context* c, size_t k, const lept_value* a, const lept_value* b) {
+    size_t len = c->len;
+    lept_diff_push_index(c, k);
+    if (a == NULL) {
+        lept_diff_emit(c, b != NULL ? "add" : "remove", b);
+    }else {
+        lept_diff_value(c, a, b);
+    }
+    c->len = len;
+}
+
+/*
+ * the common head and tail are cut off by hash, the middle is aligned by
+ * LCS over element hashes. an element left over on both sides at the same
+ * place is diffed in place, so a changed member deep inside stays small.
+ * packed elements are read into numbers on the stack.
+ */
+static void lept_diff_array(lept_diff_context* c, const lept_value* a, const lept_value* b) {
+    lept_value na, nb;
+    size_t m = a->u.a.size, n = b->u.a.size, head, i, j, k;
+    size_t *ha, *hb, *lcs = NULL;
+    ha = (size_t*) malloc(sizeof(size_t) * (m + n + 1));
+    LEPT_STATS_ALLOC(sizeof(size_t) * (m + n + 1));
+    assert(ha != NULL);
+    hb = ha + m;
+#define DIFF_A(i) lept_peek_array_element(a, i, &na)
+#define DIFF_B(j) lept_peek_array_element(b, j, &nb)
+    for (i = 0; i < m; i++) {
+        ha[i] = lept_hash(DIFF_A(i));
+    }
+    for (j = 0; j < n; j++) {
+        hb[j] = lept_hash(DIFF_B(j));
+    }
+#define DIFF_EQUAL(i, j) (ha[i] == hb[j] && lept_is_equal_unordered(DIFF_A(i), DIFF_B(j)))
+    for (head = 0; head < m && head < n && DIFF_EQUAL(head, head); head++)
+        ;
+    while (m > head && n > head && DIFF_EQUAL(m - 1, n - 1)) {
+        m--;
+        n--;
+    }
+    /* lcs[i * (n - head + 1) + j] is the LCS of a[head + i..m) and b[head + j..n) */
+#define DIFF_LCS(i, j) lcs[(i) * (n - head + 1) + (j)]
+    if ((m - head + 1) * (n - head + 1) <= LEPT_DIFF_LCS_MAX) {
+        lcs = (size_t*) malloc(sizeof(size_t) * (m - head + 1) * (n - head + 1));
+        LEPT_STATS_ALLOC(sizeof(size_t) * (m - head + 1) * (n - head + 1));
+        assert(lcs != NULL);
+        for (i = m - head + 1; i-- > 0; ) {
+            for (j = n - head + 1; j-- > 0; ) {
+                if (i == m - head || j == n - head) {
+                    DIFF_LCS(i, j) = 0;
+                }else if (DIFF_EQUAL(head + i, head + j)) {
+                    DIFF_LCS(i, j) = DIFF_LCS(i + 1, j + 1) + 1;
+                }else {
+                    DIFF_LCS(i, j) = DIFF_LCS(i + 1, j) > DIFF_LCS(i, j + 1) ? DIFF_LCS(i + 1, j) : DIFF_LCS(i, j + 1);
+                }
+            }
+        }
+    }
+    for (i = j = k = head; i < m || j < n; ) {
+        if (i < m && j < n && DIFF_EQUAL(i, j)) {
+            i++;
+            j++;
+            k++;
+        }else if (i < m && j < n && (lcs == NULL || DIFF_LCS(i - head, j - head) == DIFF_LCS(i - head + 1, j - head + 1))) {
+            /* pairing them up loses no match, so diff in place */
+            lept_diff_element(c, k++, DIFF_A(i), DIFF_B(j));
+            i++;
+            j++;
+        }else if (j == n || (i < m && DIFF_LCS(i - head + 1, j - head) >= DIFF_LCS(i - head, j - head + 1))) {
+            lept_diff_element(c, k, NULL, NULL);
+            i++;
+        }else {
+            lept_diff_element(c, k++, NULL, DIFF_B(j));
+            j++;
+        }
+    }
+#undef DIFF_LCS
+#undef DIFF_EQUAL
+#undef DIFF_B
+#undef DIFF_A
+    free(lcs);
+    free(ha);
+}
+
+static void lept_diff_value(lept_diff_context* c, const lept_value* a, const lept_value* b) {
+    lept_type type = lept_get_type(a);
+    if (type != lept_get_type(b)) {
+        lept_diff_emit(c, "replace", b);
+    }else if (type == LEPT_OBJECT) {
+        lept_diff_object(c, a, b);
+    }else if (type == LEPT_ARRAY) {
+        lept_diff_array(c, a, b);
+    }else if (!lept_is_equal(a, b)) {
+        lept_diff_emit(c, "replace", b);
+    }
+}
+
+/*
+ * patch is set to an RFC 6902 patch that turns a into b, members that are
+ * added go to the end. member order alone is not a difference.
+ */
+void lept_diff(const lept_value* a, const lept_value* b, lept_value* patch) {
+    lept_diff_context c;
+    assert(a != NULL && b != NULL && patch != NULL && patch != a && patch != b);
+    lept_set_array(patch, 0);
+    c.patch = patch;
+    c.path = NULL;
+    c.len = c.capacity = 0;
+    lept_diff_value(&c, a, b);
+    free(c.path);
+}
+
+
+/****** frozen documents ******/
+
+struct lept_doc {
+    volatile long ref;
+    lept_value root;
+};
+
+/*
+ * every heap block of a frozen tree (elements, members, long strings)
+ * counts the containers pointing at it, so versions made by
+ * lept_with_value() can share whatever they did not change.
+ */
+typedef union {
+    volatile long ref;
+    double align_double;
+    void* align_pointer;
+}lept_doc_block;
+
+#define LEPT_DOC_BLOCK(p)   ((lept_doc_block*)(p) - 1)
+
+static void* lept_doc_block_new(const void* src, size_t size, size_t capacity) {
+    lept_doc_block* b = (lept_doc_block*) malloc(sizeof(lept_doc_block) + capacity);
+    LEPT_STATS_ALLOC(sizeof(lept_doc_block) + capacity);
+    assert(b != NULL);
+    b->ref = 1;
+    if (size > 0) {
+        memcpy(b + 1, src, size);
+    }
+    return b + 1;
+}
+
+/* one more container points at the block of v */
+static void lept_doc_share(lept_value* v) {
+    if (v->type == LEPT_STRING && !LEPT_IS_SHORT_STRING(v)) {
+        LEPT_ATOMIC_INC(&LEPT_DOC_BLOCK(v->u.s.s)->ref);
+    }else if (v->type == LEPT_ARRAY && v->u.a.e != NULL) {
+        LEPT_ATOMIC_INC(&LEPT_DOC_BLOCK(v->u.a.e)->ref);
+    }else if (v->type == LEPT_OBJECT && v->u.o.m != NULL) {
+        LEPT_ATOMIC_INC(&LEPT_DOC_BLOCK(v->u.o.m)->ref);
+    }
+}
+
+/* lept_free() for a frozen tree, shared blocks are only let go of */
+static void lept_doc_free_value(lept_value* v) {
+    size_t i;
+    if (v->type == LEPT_STRING && !LEPT_IS_SHORT_STRING(v)) {
+        if (LEPT_ATOMIC_DEC(&LEPT_DOC_BLOCK(v->u.s.s)->ref) == 0) {
+            free(LEPT_DOC_BLOCK(v->u.s.s));
+        }
+    }else if (v->type == LEPT_ARRAY && v->u.a.e != NULL) {
+        if (LEPT_ATOMIC_DEC(&LEPT_DOC_BLOCK(v->u.a.e)->ref) == 0) {
+            for (i = 0; i < v->u.a.size; i++) {
+                lept_doc_free_value(&v->u.a.e[i]);
+            }
+            free(LEPT_DOC_BLOCK(v->u.a.e));
+        }
+    }else if (v->type == LEPT_OBJECT && v->u.o.m != NULL) {
+        if (LEPT_ATOMIC_DEC(&LEPT_DOC_BLOCK(v->u.o.m)->ref) == 0) {
+            for (i = 0; i < v->u.o.size; i++) {
+                lept_member_free_key(&v->u.o.m[i]);
+                lept_doc_free_value(&v->u.o.m[i].v);
+            }
+            free(LEPT_DOC_BLOCK(v->u.o.m));
+        }
+    }
+    lept_init(v);
+}
+
+/*
+ * after this nothing a reader does writes to the tree: packed arrays are
+ * unpacked so that lept_get_array_element() works on every array, and keys
+ * shared through a pool get a copy of their own so that freeing the
+ * document touches no other reference count.
+ * every heap block is moved into a counted lept_doc_block.
+ */
+static void lept_doc_prepare(lept_value* v) {
+    size_t i;
+    lept_member* m;
+    void* block;
+    char* key;
+    if (v->type == LEPT_PACKED_ARRAY) {
+        lept_unpack_array(v);
+    }
+    switch (v->type) {
+        case LEPT_STRING:
+            if (!LEPT_IS_SHORT_STRING(v)) {
+                block = lept_doc_block_new(v->u.s.s, v->u.s.len + 1, v->u.s.len + 1);
+                free(v->u.s.s);
+                v->u.s.s = (char*)block;
+            }
+            break;
+        case LEPT_ARRAY:
+            for (i = 0; i < v->u.a.size; i++) {
+                lept_doc_prepare(&v->u.a.e[i]);
+            }
+            block = NULL;
+            if (v->u.a.size > 0) {
+                block = lept_doc_block_new(v->u.a.e, sizeof(lept_value) * v->u.a.size, sizeof(lept_value) * v->u.a.size);
+            }
+            free(v->u.a.e);
+            v->u.a.e = (lept_value*)block;
+            v->u.a.capacity = v->u.a.size;
+            break;
+        case LEPT_OBJECT:
+            for (i = 0; i < v->u.o.size; i++) {
+                m = &v->u.o.m[i];
+                if (m->klen >= LEPT_SHORT_KEY_SIZE && LEPT_ATOMIC_GET(&LEPT_KEY(m->k.p)->ref) > 1) {
+                    key = lept_key_new(m->k.p, m->klen, LEPT_KEY(m->k.p)->hash);
+                    lept_key_release(m->k.p);
+                    m->k.p = key;
+                }
+                lept_doc_prepare(&m->v);
+            }
+            block = NULL;
+            if (v->u.o.size > 0) {
+                block = lept_doc_block_new(v->u.o.m, sizeof(lept_member) * v->u.o.size, sizeof(lept_member) * v->u.o.size);
+            }
+            free(v->u.o.m);
+            v->u.o.m = (lept_member*)block;
+            v->u.o.capacity = v->u.o.size;
+            break;
+        default:
+            break;
+    }
+}
+
+/* takes the tree out of v, which is left null. the handle starts with one reference */
+lept_doc* lept_doc_freeze(lept_value* v) {
+    lept_doc* d;
+    assert(v != NULL);
+    d = (lept_doc*) malloc(sizeof(lept_doc));
+    LEPT_STATS_ALLOC(sizeof(lept_doc));
+    assert(d != NULL);
+    d->ref = 1;
+    memcpy(&d->root, v, sizeof(lept_value));
+    lept_init(v);
+    lept_doc_prepare(&d->root);
+    return d;
+}
+
+lept_doc* lept_doc_retain(lept_doc* d) {
+    assert(d != NULL);
+    LEPT_ATOMIC_INC(&d->ref);
+    return d;
+}
+
+/* the last release frees the tree, in whichever thread that happens */
+void lept_doc_release(lept_doc* d) {
+    if (d != NULL && LEPT_ATOMIC_DEC(&d->ref) == 0) {
+        lept_doc_free_value(&d->root);
+        free(d);
+    }
+}
+
+/* any getter can be used on it from any number of threads at once */
+const lept_value* lept_doc_get_root(const lept_doc* d) {
+    assert(d != NULL);
+    return &d->root;
+}
+
+void lept_doc_slot_init(lept_doc_slot* s, lept_doc* d) {
+    assert(s != NULL);
+    s->doc = d;
+    s->version = 0;
+    s->readers[0] = s->readers[1] = 0;
+}
+
+void lept_doc_slot_destroy(lept_doc_slot* s) {
+    assert(s != NULL && s->readers[0] == 0 && s->readers[1] == 0);
+    lept_doc_release(s->doc);
+    s->doc = NULL;
+}
+
+/*
+ * never blocks. a reader is counted, in the counter the parity of the
+ * version picks, only for the few instructions between loading the pointer
+ * and taking a reference. if the version flips while it signs in it signs
+ * in again on the other side. release the result when done with it.
+ */
+lept_doc* lept_doc_slot_acquire(lept_doc_slot* s) {
+    lept_doc* d;
+    long e;
+    assert(s != NULL);
+    for (;;) {
+        e = LEPT_ATOMIC_GET(&s->version) & 1;
+        LEPT_ATOMIC_INC(&s->readers[e]);
+        if ((LEPT_ATOMIC_GET(&s->version) & 1) == e) {
+            break;
+        }
+        LEPT_ATOMIC_DEC(&s->readers[e]);
+    }
+    if ((d = (lept_doc*)LEPT_ATOMIC_LOAD(&s->doc)) != NULL) {
+        LEPT_ATOMIC_INC(&d->ref);
+    }
+    LEPT_ATOMIC_DEC(&s->readers[e]);
+    return d;
+}
+
+/*
+ * takes over the caller's reference to d. the version is flipped after the
+ * swap, so new readers count on the other side and the publisher only
+ * waits, yielding, for those already signed in on the old one. they can
+ * only have the old document or the new one, and a steady stream of
+ * readers can not hold it up. the old document is released then, readers
+ * that already hold a reference keep it alive as long as they need.
+ * publishers must take turns, only readers may run alongside.
+ */
+void lept_doc_slot_publish(lept_doc_slot* s, lept_doc* d) {
+    lept_doc* old;
+    long e;
+    assert(s != NULL);
+    old = (lept_doc*)LEPT_ATOMIC_EXCHANGE(&s->doc, d);
+    e = (LEPT_ATOMIC_INC(&s->version) - 1) & 1;
+    while (LEPT_ATOMIC_GET(&s->readers[e]) != 0) {
+        LEPT_ATOMIC_YIELD();
+    }
+    lept_doc_release(old);
+}
+
+/*
+ * v gets a block of its own with room for extra more, all children but
+ * the one at skip are shared with the old block. long keys are copied,
+ * so each version's keys are counted by that version alone.
+ */
+static void lept_doc_clone(lept_value* v, size_t skip, size_t extra) {
+    lept_member* m;
+    lept_value* e;
+    size_t i, size;
+    if (v->type == LEPT_OBJECT) {
+        size = v->u.o.size;
+        m = (lept_member*)lept_doc_block_new(v->u.o.m, sizeof(lept_member) * size, sizeof(lept_member) * (size + extra));
+        for (i = 0; i < size; i++) {
+            if (m[i].klen >= LEPT_SHORT_KEY_SIZE) {
+                m[i].k.p = lept_key_new(m[i].k.p, m[i].klen, LEPT_KEY(m[i].k.p)->hash);
+            }
+            if (i != skip) {
+                lept_doc_share(&m[i].v);
+            }
+        }
+        v->u.o.m = m;
+        v->u.o.capacity = (lept_size)(size + extra);
+    }else {
+        size = v->u.a.size;
+        e = (lept_value*)lept_doc_block_new(v->u.a.e, sizeof(lept_value) * size, sizeof(lept_value) * (size + extra));
+        for (i = 0; i < size; i++) {
+            if (i != skip) {
+                lept_doc_share(&e[i]);
+            }
+        }
+        v->u.a.e = e;
+        v->u.a.capacity = (lept_size)(size + extra);
+    }
+}
+
+/* the child of v for token t, the size of v when t would append */
+static size_t lept_doc_child_index(const lept_value* v, const lept_pointer_token* t) {
+    size_t i;
+    if (v->type == LEPT_OBJECT) {
+        for (i = 0; i < v->u.o.size && !lept_member_key_is(&v->u.o.m[i], t->key, t->klen); i++)
+            ;
+        return i;
+    }
+    if (t->klen == 1 && t->key[0] == '-') {
+        return v->u.a.size;
+    }
+    return t->index;
+}
+
+/*
+ * a new version of doc with value at path, or NULL when the parent of the
+ * last token does not resolve. only the containers along the path are
+ * copied, everything else is shared with doc, which is left as it was.
+ * value is moved in. an object gets the member appended if it is new,
+ * an array takes an index up to its size or "-" to append.
+ */
+lept_doc* lept_with_value(const lept_doc* doc, const lept_pointer* p, lept_value* value) {
+    const lept_value* v = &doc->root;
+    lept_value* w;
+    lept_doc* d;
+    size_t i, index, size;
+    assert(doc != NULL && p != NULL && value != NULL);
+    for (i = 0; i < p->size; i++) {
+        if (v->type != LEPT_OBJECT && v->type != LEPT_ARRAY) {
+            return NULL;
+        }
+        index = lept_doc_child_index(v, &p->token[i]);
+        size = v->type == LEPT_OBJECT ? v->u.o.size : v->u.a.size;
+        if (index >= size) {
+            if (i + 1 < p->size || (v->type == LEPT_ARRAY && index > size)) {
+                return NULL;
+            }
+            break;
+        }
+        v = lept_patch_child((lept_value*)v, index);
+    }
+    d = (lept_doc*) malloc(sizeof(lept_doc));
+    LEPT_STATS_ALLOC(sizeof(lept_doc));
+    assert(d != NULL);
+    d->ref = 1;
+    lept_doc_prepare(value);
+    memcpy(&d->root, &doc->root, sizeof(lept_value));
+    if (p->size == 0) {
+        memcpy(&d->root, value, sizeof(lept_value));
+        lept_init(value);
+        return d;
+    }
+    /* w still points into doc, without a reference of its own, until it is cloned */
+    for (w = &d->root, i = 0; ; i++) {
+        index = lept_doc_child_index(w, &p->token[i]);
+        size = w->type == LEPT_OBJECT ? w->u.o.size : w->u.a.size;
+        if (i + 1 < p->size) {
+            lept_doc_clone(w, index, 0);
+            w = lept_patch_child(w, index);
+            continue;
+        }
+        lept_doc_clone(w, index, index == size);
+        if (index == size) {
+            if (w->type == LEPT_OBJECT) {
+                lept_member_set_key(&w->u.o.m[w->u.o.size++], p->token[i].key, p->token[i].klen, NULL);
+            }else {
+                w->u.a.size++;
+            }
+        }
+        memcpy(lept_patch_child(w, index), value, sizeof(lept_value));
+        lept_init(value);
+        return d;
+    }
+}
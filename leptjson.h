@@ -7,20 +7,54 @@ typedef enum { LEPT_NULL = 100, LEPT_FALSE, LEPT_TRUE, LEPT_NUMBER, LEPT_STRING,
 
 typedef struct lept_value lept_value;  /* forward declare */
 typedef struct lept_member lept_member;
+typedef struct lept_key_pool lept_key_pool;  /* opaque */
+typedef struct lept_parser lept_parser;      /* opaque */
+typedef struct lept_pointer lept_pointer;    /* opaque */
+typedef struct lept_decoder lept_decoder;    /* opaque */
+typedef struct lept_schema lept_schema;      /* opaque */
+typedef struct lept_query lept_query;        /* opaque */
+typedef struct lept_doc lept_doc;            /* opaque, read-only and reference counted */
+
+/*
+ * define LEPT_COMPACT to build the compact layout: 32-bit sizes and lengths
+ * and a 1-byte type tag, 24 instead of 32 bytes per lept_value on LP64.
+ * it must be defined the same way for the library and its users.
+ */
+#ifdef LEPT_COMPACT
+typedef unsigned int    lept_size;
+typedef unsigned char   lept_tag;
+#else
+typedef size_t          lept_size;
+typedef int             lept_tag;   /* a lept_type, or an internal subtype */
+#endif
+
+/* the longest string or key, and the most elements or members, a value holds */
+#ifndef LEPT_SIZE_MAX
+#define LEPT_SIZE_MAX           ((size_t)(lept_size)-1)
+#endif
+
+/* strings shorter than this are stored inline, without allocation */
+#define LEPT_SHORT_STRING_SIZE  (sizeof(lept_value*) + sizeof(lept_size))
+#define LEPT_SHORT_KEY_SIZE     (sizeof(char*))
 
 struct lept_value {
     union {
-        struct { lept_member* m; size_t size; } o;  /* object */
-        struct { lept_value* e; size_t size;} a;    /* array */
-        struct { char* s; size_t len; } s;          /* string */
-        double n;                                   /* double */
+        struct { lept_member* m; lept_size size, capacity; } o; /* object */
+        struct { lept_value* e; lept_size size, capacity; } a;  /* array */
+        struct { double* n; lept_size size, capacity; } p;      /* array packed as numbers */
+        struct { lept_size len; char* s; } s;                   /* string */
+        struct { lept_size len; char s[LEPT_SHORT_STRING_SIZE]; } ss; /* short string */
+        double n;                                               /* double */
     }u;
-    lept_type type;
+    lept_tag type;
 };
 
 struct lept_member {
-    char*       k;      /* key           */  
-    size_t      klen;   /* length of key */
+    union {
+        char*   p;                          /* key, may be shared through a lept_key_pool */
+        char    s[LEPT_SHORT_KEY_SIZE];     /* short key */
+    }k;
+    lept_size   klen;   /* length of key */
     lept_value  v;      /* value         */
 };
 
@@ -42,20 +76,139 @@ enum {
     /* object */
     LEPT_PARSE_MISS_KEY,
     LEPT_PARSE_MISS_COLON,
-    LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET
+    LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET,
+    /* validate */
+    LEPT_PARSE_TOO_DEEP,
+    /* strict UTF-8 */
+    LEPT_PARSE_INVALID_UTF8,
+    /* binary */
+    LEPT_PARSE_INVALID_BINARY,
+    /* typed decoding */
+    LEPT_PARSE_TYPE_MISMATCH,
+    LEPT_PARSE_STRING_TOO_LONG      /* longer than the field, or than LEPT_SIZE_MAX */
+};
+
+/* parse options */
+enum {
+    LEPT_PARSE_STRICT_UTF8 = 1 << 0,    /* reject ill-formed UTF-8 and lone surrogates */
+    LEPT_PARSE_PACK_NUMBERS = 1 << 1    /* keep arrays of numbers only as packed doubles */
+};
+
+/* where a parse failed, line and column start at 1 */
+typedef struct {
+    int code;
+    size_t offset;
+    size_t line, column;
+}lept_parse_result;
+
+#ifdef LEPT_ENABLE_STATS
+/*
+ * counters of the calling thread, define LEPT_ENABLE_STATS to build them in.
+ * no thread sees another's counters: for a total over all threads, each
+ * thread calls lept_stats_get() and merges the result into a shared
+ * lept_stats with lept_stats_merge(), under a lock of the caller's own.
+ */
+typedef struct {
+    size_t parsed, stringified;         /* documents */
+    size_t bytes_in, bytes_out;
+    size_t nodes[7];                    /* parsed values, by lept_type - LEPT_NULL */
+    size_t allocations, allocated;      /* calls and bytes, a realloc adds what it grows by */
+    size_t stack_reallocs, stack_peak;  /* growth of the parse and stringify stack */
+    size_t max_depth;
+    size_t escapes;                     /* backslash escapes decoded */
+    double parse_time, stringify_time;  /* seconds of a monotonic wall clock, where there is one */
+}lept_stats;
+#endif
+
+/* column types for lept_to_columns() */
+enum {
+    LEPT_COLUMN_DOUBLE,
+    LEPT_COLUMN_LONG,       /* integral numbers that fit a long */
+    LEPT_COLUMN_BOOLEAN,
+    LEPT_COLUMN_STRING
+};
+
+/* key, klen and type are set by the caller, the rest by lept_to_columns() */
+typedef struct {
+    const char* key;
+    size_t klen;
+    int type;
+    union {
+        double* d;
+        long* l;
+        unsigned char* b;
+        size_t* offsets;    /* string i is bytes[offsets[i]] up to bytes[offsets[i + 1]] */
+    }data;
+    char* bytes;
+    unsigned char* nulls;   /* bit i % 8 of nulls[i / 8] is set when row i has no such value */
+}lept_column;
+
+/* field types for lept_decode() */
+enum {
+    LEPT_FIELD_DOUBLE,
+    LEPT_FIELD_LONG,
+    LEPT_FIELD_INT,
+    LEPT_FIELD_BOOLEAN,     /* an int, 0 or 1 */
+    LEPT_FIELD_STRING,      /* a char array of size bytes, '\0' terminated */
+    LEPT_FIELD_OBJECT       /* a struct, decoded by nested */
 };
 
+/* one member of a struct, offset is offsetof() the member */
+typedef struct {
+    const char* key;
+    int type;
+    size_t offset;
+    size_t size;
+    const lept_decoder* nested;
+}lept_field;
+
+/* a value inside an encoded buffer, read in place */
+typedef struct {
+    const char* p;
+}lept_binary_view;
+
 enum {
     LEPT_STRINGIFY_OK = 200,
-    LEPT_STRINGIFY_INVALID_TYPE
+    LEPT_STRINGIFY_INVALID_TYPE     /* also infinity and NaN, JSON has no text for them */
 };
 
 int         lept_parse(lept_value* v, const char* json);
+int         lept_parse_ex(lept_value* v, const char* json, lept_parse_result* result);
+
+/*
+ * key interning, every distinct key is stored once in the pool. a pool is
+ * used by one thread at a time; values parsed with it share its keys through
+ * atomic reference counts, so they may be copied and freed on any thread.
+ */
+lept_key_pool* lept_key_pool_create(void);
+void        lept_key_pool_destroy(lept_key_pool* pool);
+size_t      lept_key_pool_size(const lept_key_pool* pool);
+const char* lept_key_pool_intern(lept_key_pool* pool, const char* key, size_t klen);
+int         lept_parse_interned(lept_value* v, const char* json, lept_key_pool* pool);
+
+/* reusable parser, keeps its scratch stack between calls. use one per thread */
+lept_parser* lept_parser_create(void);
+void        lept_parser_destroy(lept_parser* p);
+void        lept_parser_reset(lept_parser* p);
+void        lept_parser_set_max_retained(lept_parser* p, size_t size);
+size_t      lept_parser_get_retained(const lept_parser* p);
+void        lept_parser_set_options(lept_parser* p, int options);
+void        lept_parser_set_key_pool(lept_parser* p, lept_key_pool* pool);
+int         lept_parser_parse(lept_parser* p, lept_value* v, const char* json);
+int         lept_parser_parse_ex(lept_parser* p, lept_value* v, const char* json, lept_parse_result* result);
+
+/* grammar check only, nothing is allocated */
+int         lept_validate(const char* json, size_t len);
+int         lept_validate_ex(const char* json, size_t len, int options);
 
 void        lept_free(lept_value* v);
 
 #define     lept_init(v) do{(v)->type = LEPT_NULL;}while(0)
 
+void        lept_copy(lept_value* dst, const lept_value* src);
+void        lept_move(lept_value* dst, lept_value* src);
+void        lept_swap(lept_value* lhs, lept_value* rhs);
+
 lept_type   lept_get_type(const lept_value* v);
 
 #define     lept_set_null(v) lept_free(v)
@@ -73,23 +226,143 @@ size_t      lept_get_string_length(const lept_value* v);
 void        lept_set_string(lept_value* v, const char* s, size_t len);
 
 /* array */
+void        lept_set_array(lept_value* v, size_t capacity);
 size_t      lept_get_array_size(const lept_value* v);
-lept_value* lept_get_array_element(const lept_value*v , size_t index);
+size_t      lept_get_array_capacity(const lept_value* v);
+void        lept_reserve_array(lept_value* v, size_t capacity);
+void        lept_shrink_array(lept_value* v);
+void        lept_clear_array(lept_value* v);
+lept_value* lept_get_array_element(const lept_value* v, size_t index);
+const lept_value* lept_peek_array_element(const lept_value* v, size_t index, lept_value* number);
+lept_value* lept_pushback_array_element(lept_value* v);
+void        lept_popback_array_element(lept_value* v);
+lept_value* lept_insert_array_element(lept_value* v, size_t index);
+void        lept_erase_array_element(lept_value* v, size_t index, size_t count);
+const double* lept_get_array_doubles(const lept_value* v);
+void        lept_set_array_doubles(lept_value* v, const double* n, size_t size);
+int         lept_pack_array(lept_value* v);
+void        lept_unpack_array(lept_value* v);
 
 /* object */
+void        lept_set_object(lept_value* v, size_t capacity);
 size_t      lept_get_object_size(const lept_value* v);
+size_t      lept_get_object_capacity(const lept_value* v);
+void        lept_reserve_object(lept_value* v, size_t capacity);
+void        lept_shrink_object(lept_value* v);
+void        lept_clear_object(lept_value* v);
 const char* lept_get_object_key(const lept_value* v, size_t index);
 size_t      lept_get_object_key_length(const lept_value* v, size_t index);
 lept_value* lept_get_object_value(const lept_value* v, size_t index);
 
 int         lept_find_object_index(const lept_value* v, const char* key, size_t klen);
 lept_value* lept_find_object_value(const lept_value* v, const char* key, size_t klen);
+lept_value* lept_set_object_value(lept_value* v, const char* key, size_t klen);
+void        lept_remove_object_value(lept_value* v, size_t index);
 
 /* stringify */
 /* char*       lept_stringify(const lept_value* v, size_t* length); */
 int         lept_stringify(const lept_value* v, char** json, size_t* length);
+int         lept_stringify_canonical(const lept_value* v, char** json, size_t* length);
+
+/* binary encoding */
+int         lept_encode_binary(const lept_value* v, char** buffer, size_t* length);
+int         lept_decode_binary(lept_value* v, const char* buffer, size_t length);
+int         lept_binary_view_init(lept_binary_view* view, const char* buffer, size_t length);
+lept_type   lept_binary_get_type(const lept_binary_view* view);
+int         lept_binary_get_boolean(const lept_binary_view* view);
+double      lept_binary_get_number(const lept_binary_view* view);
+const char* lept_binary_get_string(const lept_binary_view* view, size_t* len);
+size_t      lept_binary_get_size(const lept_binary_view* view);
+int         lept_binary_get_element(const lept_binary_view* view, size_t index, lept_binary_view* e);
+int         lept_binary_get_member(const lept_binary_view* view, size_t index, const char** key, size_t* klen, lept_binary_view* value);
+int         lept_binary_find_member(const lept_binary_view* view, const char* key, size_t klen, lept_binary_view* value);
+
+#ifdef LEPT_ENABLE_STATS
+void        lept_stats_get(lept_stats* stats);
+void        lept_stats_reset(void);
+void        lept_stats_merge(lept_stats* total, const lept_stats* stats);
+#endif
+
+/* decoding straight into C structs */
+lept_decoder* lept_decoder_create(const lept_field* fields, size_t n);
+void        lept_decoder_destroy(lept_decoder* d);
+int         lept_decode(const lept_decoder* d, void* out, const char* json, lept_parse_result* result);
+
+/* schema validation, results of lept_schema_validate() */
+enum {
+    LEPT_SCHEMA_OK = 0,
+    LEPT_SCHEMA_TYPE,
+    LEPT_SCHEMA_REQUIRED,
+    LEPT_SCHEMA_ENUM,
+    LEPT_SCHEMA_MINIMUM,
+    LEPT_SCHEMA_MAXIMUM,
+    LEPT_SCHEMA_MIN_LENGTH,
+    LEPT_SCHEMA_MAX_LENGTH,
+    LEPT_SCHEMA_MIN_ITEMS,
+    LEPT_SCHEMA_MAX_ITEMS
+};
+
+/* type, properties, required, items, enum, (exclusive)minimum/maximum, min/maxLength, min/maxItems */
+lept_schema* lept_schema_compile(const lept_value* schema);
+void        lept_schema_free(lept_schema* s);
+/* path gets the JSON pointer of the failing value, or of the missing member */
+int         lept_schema_validate(const lept_schema* s, const lept_value* v, char* path, size_t size);
+
+/* JSONPath queries: $, .name, ['name'], .*, [*], .., [n], [start:end:step], [?(@.a.b op literal)] */
+typedef int (*lept_query_callback)(const lept_value* v, void* context);   /* non-zero to stop */
+lept_query* lept_query_compile(const char* query);
+void        lept_query_free(lept_query* q);
+size_t      lept_query_run(const lept_query* q, const lept_value* v, lept_query_callback callback, void* context);
+
+/* patches, results of lept_apply_patch() */
+enum {
+    LEPT_PATCH_OK = 0,
+    LEPT_PATCH_INVALID,         /* not an array of well-formed operations */
+    LEPT_PATCH_NOT_FOUND,       /* a path or from does not resolve */
+    LEPT_PATCH_TEST_FAILED
+};
+
+int         lept_apply_patch(lept_value* doc, lept_value* patch);
+void        lept_apply_merge_patch(lept_value* doc, lept_value* patch);
+void        lept_diff(const lept_value* a, const lept_value* b, lept_value* patch);
+
+/* where readers pick up the current lept_doc while a writer swaps in new ones */
+typedef struct {
+    lept_doc* volatile doc;
+    volatile long version;
+    volatile long readers[2];   /* signing in, by parity of version */
+}lept_doc_slot;
+
+/* frozen documents, shared by threads without locks */
+lept_doc*   lept_doc_freeze(lept_value* v);
+lept_doc*   lept_doc_retain(lept_doc* d);
+void        lept_doc_release(lept_doc* d);
+const lept_value* lept_doc_get_root(const lept_doc* d);
+void        lept_doc_slot_init(lept_doc_slot* s, lept_doc* d);
+void        lept_doc_slot_destroy(lept_doc_slot* s);
+lept_doc*   lept_doc_slot_acquire(lept_doc_slot* s);
+void        lept_doc_slot_publish(lept_doc_slot* s, lept_doc* d);
+/* persistent update, a new version sharing all it did not change with doc */
+lept_doc*   lept_with_value(const lept_doc* doc, const lept_pointer* p, lept_value* value);
+
+/* columnar extraction from an array of objects */
+size_t      lept_to_columns(const lept_value* v, lept_column* columns, size_t n);
+void        lept_free_columns(lept_column* columns, size_t n);
 
 /* compare */
 int lept_is_equal(const lept_value* lhs, const lept_value* rhs);
+int lept_is_equal_unordered(const lept_value* lhs, const lept_value* rhs);
+size_t lept_hash(const lept_value* v);
+
+/* JSON pointer (RFC 6901), compile once and resolve against many values */
+lept_pointer* lept_pointer_compile(const char* path, size_t len);
+void        lept_pointer_free(lept_pointer* p);
+size_t      lept_pointer_get_size(const lept_pointer* p);
+const char* lept_pointer_get_token(const lept_pointer* p, size_t index, size_t* klen);
+lept_value* lept_pointer_get(const lept_value* v, const lept_pointer* p);
+const lept_value* lept_pointer_peek(const lept_value* v, const lept_pointer* p, lept_value* number);
+
+/* parse only what the paths reach, the rest is skipped undecoded, v is null if nothing is reached */
+int         lept_parse_projected(lept_value* v, const char* json, const lept_pointer* const* paths, size_t n);
 
 #endif /* LEPTJSON_H__ */
@@ -6,6 +6,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>  /* offsetof() */
+#include <math.h>    /* HUGE_VAL */
+#include <limits.h>  /* LONG_MAX */
 #include "leptjson.h"
 
 static int main_ret = 0;
@@ -36,6 +39,8 @@ static int test_pass = 0;
 #define EXPECT_TRUE(actual) EXPECT_EQ_BASE((actual) != 0, "true", "false", "%s")
 #define EXPECT_FALSE(actual) EXPECT_EQ_BASE((actual) == 0, "false", "true", "%s")
 
+#define LEPT_VALIDATE_DEPTH_TEST 1000
+
 #define EXPECT_EQ_SIZE_T(expect, actual) EXPECT_EQ_BASE((expect) == (actual), (size_t)expect, (size_t)actual, "%ld")
 
 #define TEST_ERROR(error, json)  \
@@ -45,14 +50,32 @@ static int test_pass = 0;
         v.type = LEPT_FALSE;   \
         EXPECT_EQ_INT(error, lept_parse(&v, json));   \
         EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v));  \
+        EXPECT_EQ_INT(error, lept_validate(json, strlen(json)));  \
         lept_free(&v);  \
     }while(0)
 
+#define TEST_ERROR_AT(error, json, eoffset, eline, ecolumn) \
+    do {   \
+        lept_value v;   \
+        lept_parse_result r;    \
+        lept_init(&v);  \
+        EXPECT_EQ_INT(error, lept_parse_ex(&v, json, &r));  \
+        EXPECT_EQ_INT(error, r.code);   \
+        EXPECT_EQ_SIZE_T(eoffset, r.offset);    \
+        EXPECT_EQ_SIZE_T(eline, r.line);    \
+        EXPECT_EQ_SIZE_T(ecolumn, r.column);    \
+        EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v));  \
+        lept_free(&v);  \
+    }while(0)
+
+#define TEST_VALIDATE(error, json) EXPECT_EQ_INT(error, lept_validate(json, strlen(json)))
+
 #define TEST_NUMBER(expect, json) \
     do {    \
         lept_value v;   \
         lept_init(&v);  \
         EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));   \
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_validate(json, strlen(json)));  \
         EXPECT_EQ_INT(LEPT_NUMBER, lept_get_type(&v));        \
         EXPECT_EQ_DOUBLE(expect, lept_get_number(&v));        \
         lept_free(&v);  \
@@ -63,6 +86,7 @@ static int test_pass = 0;
         lept_value v;   \
         lept_init(&v);  \
         EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json)); \
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_validate(json, strlen(json)));  \
         EXPECT_EQ_INT(LEPT_STRING, lept_get_type(&v));      \
         EXPECT_EQ_STRING(expect, lept_get_string(&v), lept_get_string_length(&v));  \
         lept_free(&v);  \
@@ -75,6 +99,7 @@ static int test_pass = 0;
         size_t length;  \
         lept_init(&v);  \
         EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));  \
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_validate(json, strlen(json)));  \
         EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify(&v, &json2, &length));  \
         EXPECT_EQ_STRING(json, json2, length);  \
         lept_free(&v);  \
@@ -203,8 +228,19 @@ static void test_parse_number() {
 }
 
 static void test_parse_number_too_big() {
+    char json[311];
     TEST_ERROR(LEPT_PARSE_NUMBER_TOO_BIG, "1e10000");
     TEST_ERROR(LEPT_PARSE_NUMBER_TOO_BIG, "-1e10000");
+    TEST_ERROR(LEPT_PARSE_NUMBER_TOO_BIG, "0.18e309");
+    TEST_ERROR(LEPT_PARSE_NUMBER_TOO_BIG, "0.5e309");
+    TEST_ERROR(LEPT_PARSE_NUMBER_TOO_BIG, "0.0018e311");
+    /* 309 digits, more than the 1.8e308 a double holds */
+    memset(json, '9', 309);
+    json[309] = '\0';
+    TEST_ERROR(LEPT_PARSE_NUMBER_TOO_BIG, json);
+    json[0] = '1';
+    memset(json + 1, '0', 308);
+    TEST_NUMBER(1e308, json);
 }
 
 /************ test string **************/
@@ -426,6 +462,126 @@ static void test_parse_object() {
 }
 
 
+static void test_parse_miss_comma_or_square_bracket() {
+    TEST_ERROR(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "[1");
+    TEST_ERROR(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "[1}");
+    TEST_ERROR(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "[1 2");
+    TEST_ERROR(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "[[]");
+    TEST_ERROR(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "[\"abc\",[\"def\",{\"g\":\"hijklmnopqrstuvwxyz\"}]");
+}
+
+static void test_parse_miss_key() {
+    TEST_ERROR(LEPT_PARSE_MISS_KEY, "{:1,");
+    TEST_ERROR(LEPT_PARSE_MISS_KEY, "{1:1,");
+    TEST_ERROR(LEPT_PARSE_MISS_KEY, "{true:1,");
+    TEST_ERROR(LEPT_PARSE_MISS_KEY, "{\"a\":1,}");
+    TEST_ERROR(LEPT_PARSE_MISS_KEY, "{\"a\":1,[]:1}");
+}
+
+static void test_parse_miss_colon() {
+    TEST_ERROR(LEPT_PARSE_MISS_COLON, "{\"a\"}");
+    TEST_ERROR(LEPT_PARSE_MISS_COLON, "{\"a\",\"b\"}");
+    TEST_ERROR(LEPT_PARSE_MISS_COLON, "{\"a_long_key_name\" 1}");
+}
+
+static void test_parse_miss_comma_or_curly_bracket() {
+    TEST_ERROR(LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET, "{\"a\":1");
+    TEST_ERROR(LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET, "{\"a\":1]");
+    TEST_ERROR(LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET, "{\"a\":1 \"b\"");
+    TEST_ERROR(LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET, "{\"a\":{}");
+    TEST_ERROR(LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET, "{\"a\":\"a long string value\",\"b\":[1,{\"c\":\"d\"}]");
+}
+
+static void test_parse_error_location() {
+    TEST_ERROR_AT(LEPT_PARSE_EXPECT_VALUE, "", 0, 1, 1);
+    TEST_ERROR_AT(LEPT_PARSE_INVALID_VALUE, "nul", 3, 1, 4);
+    TEST_ERROR_AT(LEPT_PARSE_INVALID_VALUE, "[1,tru]", 6, 1, 7);
+    TEST_ERROR_AT(LEPT_PARSE_INVALID_VALUE, "[1.]", 3, 1, 4);
+    TEST_ERROR_AT(LEPT_PARSE_ROOT_NOT_SINGULAR, "[1] x", 4, 1, 5);
+    TEST_ERROR_AT(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "[\n  1,\n  2\n", 11, 4, 1);
+    TEST_ERROR_AT(LEPT_PARSE_MISS_COLON, "{\n\"a\" 1}", 6, 2, 5);
+    TEST_ERROR_AT(LEPT_PARSE_INVALID_STRING_ESCAPE, "\"ab\\v\"", 4, 1, 5);
+    TEST_ERROR_AT(LEPT_PARSE_INVALID_STRING_CHAR, "{\"k\":\n\"\x01\"}", 7, 2, 2);
+    TEST_ERROR_AT(LEPT_PARSE_MISS_QUOTATION_MARK, "\"abc", 4, 1, 5);
+    TEST_ERROR_AT(LEPT_PARSE_INVALID_UNICODE_HEX, "\"\\u00G0\"", 2, 1, 3);
+}
+
+static void test_validate() {
+    char json[LEPT_VALIDATE_DEPTH_TEST * 2 + 1];
+    size_t i;
+
+    TEST_VALIDATE(LEPT_PARSE_OK, " [ null , false , true , 123 , \"abc\" ] ");
+    TEST_VALIDATE(LEPT_PARSE_OK, "{\"a\":[1,{\"b\":{}},[]],\"c\":\"\\uD834\\uDD1E\"}");
+    TEST_VALIDATE(LEPT_PARSE_OK, "\"a string long enough for the word loop\"");
+    TEST_VALIDATE(LEPT_PARSE_OK, "1.7976931348623157e+308");
+    TEST_VALIDATE(LEPT_PARSE_OK, "0.00017976931348623157e+312");
+    TEST_VALIDATE(LEPT_PARSE_NUMBER_TOO_BIG, "1.7976931348623159e+308");
+    TEST_VALIDATE(LEPT_PARSE_NUMBER_TOO_BIG, "-10e308");
+    TEST_VALIDATE(LEPT_PARSE_OK, "0e999999999999");
+
+    /* only len bytes are looked at */
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_validate("[1,2]garbage", 5));
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, lept_validate("[1,2]", 4));
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_VALUE, lept_validate("true", 3));
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_VALUE, lept_validate("1.5", 2));
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_QUOTATION_MARK, lept_validate("\"abc\"", 4));
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_UNICODE_HEX, lept_validate("\"\\u123", 6));
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_STRING_CHAR, lept_validate("\"a\0b\"", 5));
+    EXPECT_EQ_INT(LEPT_PARSE_EXPECT_VALUE, lept_validate(NULL, 0));
+
+    /* nesting is limited by LEPT_VALIDATE_MAX_DEPTH */
+    for (i = 0; i < LEPT_VALIDATE_DEPTH_TEST; i++) {
+        json[i] = '[';
+        json[LEPT_VALIDATE_DEPTH_TEST * 2 - 1 - i] = ']';
+    }
+    json[LEPT_VALIDATE_DEPTH_TEST * 2] = '\0';
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_validate(json, LEPT_VALIDATE_DEPTH_TEST * 2));
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, lept_validate(json, LEPT_VALIDATE_DEPTH_TEST * 2 - 1));
+    json[0] = '{';
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_KEY, lept_validate(json, LEPT_VALIDATE_DEPTH_TEST * 2));
+}
+
+#define TEST_UTF8(error, json) \
+    do {    \
+        lept_parser* p = lept_parser_create();  \
+        lept_value v;   \
+        lept_init(&v);  \
+        lept_parser_set_options(p, LEPT_PARSE_STRICT_UTF8);  \
+        EXPECT_EQ_INT(error, lept_parser_parse(p, &v, json));    \
+        EXPECT_EQ_INT(error, lept_validate_ex(json, strlen(json), LEPT_PARSE_STRICT_UTF8));  \
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_validate(json, strlen(json)));  \
+        lept_free(&v);  \
+        lept_parser_destroy(p); \
+    } while(0)
+
+static void test_parse_invalid_utf8() {
+    TEST_UTF8(LEPT_PARSE_OK, "\"\xC2\xA2 \xE2\x82\xAC \xF0\x9D\x84\x9E \xED\x9F\xBF \xF4\x8F\xBF\xBF\"");
+    TEST_UTF8(LEPT_PARSE_OK, "{\"\xE2\x82\xAC\":[\"plain ascii long enough to take the word loop\xC2\xA2\"]}");
+    TEST_UTF8(LEPT_PARSE_INVALID_UTF8, "\"\x80\"");                 /* lone continuation */
+    TEST_UTF8(LEPT_PARSE_INVALID_UTF8, "\"\xC0\xAF\"");             /* overlong '/' */
+    TEST_UTF8(LEPT_PARSE_INVALID_UTF8, "\"\xC1\xBF\"");
+    TEST_UTF8(LEPT_PARSE_INVALID_UTF8, "\"\xE0\x9F\xBF\"");         /* overlong 3 bytes */
+    TEST_UTF8(LEPT_PARSE_INVALID_UTF8, "\"\xF0\x8F\xBF\xBF\"");     /* overlong 4 bytes */
+    TEST_UTF8(LEPT_PARSE_INVALID_UTF8, "\"\xED\xA0\x80\"");         /* encoded surrogate */
+    TEST_UTF8(LEPT_PARSE_INVALID_UTF8, "\"\xF4\x90\x80\x80\"");     /* above U+10FFFF */
+    TEST_UTF8(LEPT_PARSE_INVALID_UTF8, "\"\xF5\x80\x80\x80\"");
+    TEST_UTF8(LEPT_PARSE_INVALID_UTF8, "\"\xFF\"");
+    TEST_UTF8(LEPT_PARSE_INVALID_UTF8, "\"\xE2\x82\"");             /* truncated */
+    TEST_UTF8(LEPT_PARSE_INVALID_UTF8, "[\"ok\",{\"a\xC3\":1}]");
+    TEST_UTF8(LEPT_PARSE_INVALID_UNICODE_SURROGATE, "\"\\uDC00\"");  /* lone low surrogate */
+    /* a sequence cut by the end of input */
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_UTF8, lept_validate_ex("\"\xE2\x82", 3, LEPT_PARSE_STRICT_UTF8));
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_UTF8, lept_validate_ex("\"\xE2\x82\xAC\"", 3, LEPT_PARSE_STRICT_UTF8));
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_QUOTATION_MARK, lept_validate_ex("\"\xE2\x82\xAC\"", 4, LEPT_PARSE_STRICT_UTF8));
+}
+
+static void test_validate_too_deep() {
+    char json[2049];
+    memset(json, '[', 2048);
+    json[2048] = '\0';
+    EXPECT_EQ_INT(LEPT_PARSE_TOO_DEEP, lept_validate(json, 2048));
+}
+
 /*********** access test *************/
 
 static void test_access_string() {
@@ -438,6 +594,15 @@ static void test_access_string() {
     EXPECT_EQ_STRING("hello", lept_get_string(&v), lept_get_string_length(&v) );
     lept_set_string(&v, "hello world", 11);
     EXPECT_EQ_STRING("hello world", lept_get_string(&v), lept_get_string_length(&v) );
+    /* around the short string limit */
+    lept_set_string(&v, "0123456789abcdefghijklmnopqrstuvwxyz", LEPT_SHORT_STRING_SIZE - 1);
+    EXPECT_EQ_SIZE_T(LEPT_SHORT_STRING_SIZE - 1, lept_get_string_length(&v));
+    EXPECT_TRUE(memcmp("0123456789abcdefghijklmnopqrstuvwxyz", lept_get_string(&v), LEPT_SHORT_STRING_SIZE - 1) == 0);
+    EXPECT_TRUE(lept_get_string(&v)[LEPT_SHORT_STRING_SIZE - 1] == '\0');
+    lept_set_string(&v, "0123456789abcdefghijklmnopqrstuvwxyz", LEPT_SHORT_STRING_SIZE);
+    EXPECT_EQ_SIZE_T(LEPT_SHORT_STRING_SIZE, lept_get_string_length(&v));
+    EXPECT_TRUE(memcmp("0123456789abcdefghijklmnopqrstuvwxyz", lept_get_string(&v), LEPT_SHORT_STRING_SIZE) == 0);
+    EXPECT_TRUE(lept_get_string(&v)[LEPT_SHORT_STRING_SIZE] == '\0');
     /* test end */
     lept_free(&v);
 }
@@ -474,6 +639,1350 @@ static void test_access_null() {
     lept_free(&v);
 }
 
+static void test_copy() {
+    lept_value v1, v2;
+    lept_init(&v1);
+    lept_parse(&v1, "{\"t\":true,\"f\":false,\"n\":null,\"d\":1.5,\"s\":\"abc\",\"a\":[1,2,[3]],\"o\":{\"1\":1}}");
+    lept_init(&v2);
+    lept_copy(&v2, &v1);
+    EXPECT_TRUE(lept_is_equal(&v2, &v1));
+    /* copy over a non-null value */
+    lept_copy(&v2, lept_find_object_value(&v1, "a", 1));
+    EXPECT_TRUE(lept_is_equal(&v2, lept_find_object_value(&v1, "a", 1)));
+    /* copy a part of dst over dst */
+    lept_copy(&v2, lept_get_array_element(&v2, 2));
+    EXPECT_EQ_SIZE_T(1, lept_get_array_size(&v2));
+    EXPECT_EQ_DOUBLE(3.0, lept_get_number(lept_get_array_element(&v2, 0)));
+    lept_copy(&v1, lept_find_object_value(&v1, "o", 1));
+    EXPECT_EQ_SIZE_T(1, lept_get_object_size(&v1));
+    EXPECT_EQ_DOUBLE(1.0, lept_get_number(lept_find_object_value(&v1, "1", 1)));
+    lept_free(&v1);
+    lept_free(&v2);
+}
+
+static void test_move() {
+    lept_value v1, v2, v3;
+    lept_init(&v1);
+    lept_parse(&v1, "{\"t\":true,\"f\":false,\"n\":null,\"d\":1.5,\"a\":[1,2,3]}");
+    lept_init(&v2);
+    lept_copy(&v2, &v1);
+    lept_init(&v3);
+    lept_move(&v3, &v2);
+    EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v2));
+    EXPECT_TRUE(lept_is_equal(&v3, &v1));
+    /* move a part of dst over dst */
+    lept_move(&v3, lept_find_object_value(&v3, "a", 1));
+    EXPECT_EQ_SIZE_T(3, lept_get_array_size(&v3));
+    EXPECT_TRUE(lept_is_equal(&v3, lept_find_object_value(&v1, "a", 1)));
+    lept_free(&v1);
+    lept_free(&v2);
+    lept_free(&v3);
+}
+
+static void test_swap() {
+    lept_value v1, v2;
+    lept_init(&v1);
+    lept_init(&v2);
+    lept_set_string(&v1, "Hello",  5);
+    lept_set_string(&v2, "World!", 6);
+    lept_swap(&v1, &v2);
+    EXPECT_EQ_STRING("World!", lept_get_string(&v1), lept_get_string_length(&v1));
+    EXPECT_EQ_STRING("Hello",  lept_get_string(&v2), lept_get_string_length(&v2));
+    lept_swap(&v1, &v1);
+    EXPECT_EQ_STRING("World!", lept_get_string(&v1), lept_get_string_length(&v1));
+    lept_free(&v1);
+    lept_free(&v2);
+}
+
+static void test_access_array() {
+    lept_value a, e;
+    size_t i, j;
+
+    lept_init(&a);
+
+    for (j = 0; j <= 5; j += 5) {
+        lept_set_array(&a, j);
+        EXPECT_EQ_SIZE_T(0, lept_get_array_size(&a));
+        EXPECT_EQ_SIZE_T(j, lept_get_array_capacity(&a));
+        for (i = 0; i < 10; i++) {
+            lept_set_number(lept_pushback_array_element(&a), (double)i);
+        }
+        EXPECT_EQ_SIZE_T(10, lept_get_array_size(&a));
+        for (i = 0; i < 10; i++) {
+            EXPECT_EQ_DOUBLE((double)i, lept_get_number(lept_get_array_element(&a, i)));
+        }
+    }
+
+    lept_popback_array_element(&a);
+    EXPECT_EQ_SIZE_T(9, lept_get_array_size(&a));
+    for (i = 0; i < 9; i++) {
+        EXPECT_EQ_DOUBLE((double)i, lept_get_number(lept_get_array_element(&a, i)));
+    }
+
+    lept_erase_array_element(&a, 4, 0);
+    EXPECT_EQ_SIZE_T(9, lept_get_array_size(&a));
+    for (i = 0; i < 9; i++) {
+        EXPECT_EQ_DOUBLE((double)i, lept_get_number(lept_get_array_element(&a, i)));
+    }
+
+    lept_erase_array_element(&a, 8, 1);
+    EXPECT_EQ_SIZE_T(8, lept_get_array_size(&a));
+    for (i = 0; i < 8; i++) {
+        EXPECT_EQ_DOUBLE((double)i, lept_get_number(lept_get_array_element(&a, i)));
+    }
+
+    lept_erase_array_element(&a, 0, 2);
+    EXPECT_EQ_SIZE_T(6, lept_get_array_size(&a));
+    for (i = 0; i < 6; i++) {
+        EXPECT_EQ_DOUBLE((double)i + 2, lept_get_number(lept_get_array_element(&a, i)));
+    }
+
+    for (i = 0; i < 2; i++) {
+        lept_set_number(lept_insert_array_element(&a, i), (double)i);
+    }
+    EXPECT_EQ_SIZE_T(8, lept_get_array_size(&a));
+    for (i = 0; i < 8; i++) {
+        EXPECT_EQ_DOUBLE((double)i, lept_get_number(lept_get_array_element(&a, i)));
+    }
+
+    EXPECT_TRUE(lept_get_array_capacity(&a) > 8);
+    lept_shrink_array(&a);
+    EXPECT_EQ_SIZE_T(8, lept_get_array_capacity(&a));
+    EXPECT_EQ_SIZE_T(8, lept_get_array_size(&a));
+    for (i = 0; i < 8; i++) {
+        EXPECT_EQ_DOUBLE((double)i, lept_get_number(lept_get_array_element(&a, i)));
+    }
+
+    lept_init(&e);
+    lept_set_string(&e, "Hello", 5);
+    lept_move(lept_pushback_array_element(&a), &e);     /* Test if element is freed */
+    lept_free(&e);
+
+    i = lept_get_array_capacity(&a);
+    lept_clear_array(&a);
+    EXPECT_EQ_SIZE_T(0, lept_get_array_size(&a));
+    EXPECT_EQ_SIZE_T(i, lept_get_array_capacity(&a));   /* capacity remains unchanged */
+    lept_shrink_array(&a);
+    EXPECT_EQ_SIZE_T(0, lept_get_array_capacity(&a));
+
+    lept_free(&a);
+}
+
+static void test_access_object() {
+    lept_value o, v, *pv;
+    size_t i, j;
+    int index;
+
+    lept_init(&o);
+
+    for (j = 0; j <= 5; j += 5) {
+        lept_set_object(&o, j);
+        EXPECT_EQ_SIZE_T(0, lept_get_object_size(&o));
+        EXPECT_EQ_SIZE_T(j, lept_get_object_capacity(&o));
+        for (i = 0; i < 10; i++) {
+            char key[2] = "a";
+            key[0] += i;
+            lept_init(&v);
+            lept_set_number(&v, (double)i);
+            lept_move(lept_set_object_value(&o, key, 1), &v);
+            lept_free(&v);
+        }
+        EXPECT_EQ_SIZE_T(10, lept_get_object_size(&o));
+        for (i = 0; i < 10; i++) {
+            char key[] = "a";
+            key[0] += i;
+            index = lept_find_object_index(&o, key, 1);
+            EXPECT_TRUE(index >= 0);
+            pv = lept_get_object_value(&o, index);
+            EXPECT_EQ_DOUBLE((double)i, lept_get_number(pv));
+        }
+    }
+
+    /* set an existing key replaces in place */
+    pv = lept_set_object_value(&o, "j", 1);
+    EXPECT_EQ_DOUBLE(9.0, lept_get_number(pv));
+    lept_set_string(pv, "j", 1);
+    EXPECT_EQ_SIZE_T(10, lept_get_object_size(&o));
+    EXPECT_EQ_STRING("j", lept_get_string(lept_find_object_value(&o, "j", 1)), 1);
+
+    index = lept_find_object_index(&o, "j", 1);
+    EXPECT_TRUE(index >= 0);
+    lept_remove_object_value(&o, index);
+    index = lept_find_object_index(&o, "j", 1);
+    EXPECT_TRUE(index < 0);
+    EXPECT_EQ_SIZE_T(9, lept_get_object_size(&o));
+
+    index = lept_find_object_index(&o, "a", 1);
+    EXPECT_TRUE(index >= 0);
+    lept_remove_object_value(&o, index);
+    index = lept_find_object_index(&o, "a", 1);
+    EXPECT_TRUE(index < 0);
+    EXPECT_EQ_SIZE_T(8, lept_get_object_size(&o));
+    EXPECT_EQ_STRING("b", lept_get_object_key(&o, 0), lept_get_object_key_length(&o, 0));
+
+    EXPECT_TRUE(lept_get_object_capacity(&o) > 8);
+    lept_shrink_object(&o);
+    EXPECT_EQ_SIZE_T(8, lept_get_object_capacity(&o));
+    EXPECT_EQ_SIZE_T(8, lept_get_object_size(&o));
+    for (i = 0; i < 8; i++) {
+        char key[] = "a";
+        key[0] += i + 1;
+        EXPECT_EQ_DOUBLE((double)i + 1, lept_get_number(lept_get_object_value(&o, lept_find_object_index(&o, key, 1))));
+    }
+
+    lept_set_string(&v, "Hello", 5);
+    lept_move(lept_set_object_value(&o, "World", 5), &v); /* Test if element is freed */
+    lept_free(&v);
+
+    pv = lept_find_object_value(&o, "World", 5);
+    EXPECT_TRUE(pv != NULL);
+    EXPECT_EQ_STRING("Hello", lept_get_string(pv), lept_get_string_length(pv));
+
+    i = lept_get_object_capacity(&o);
+    lept_clear_object(&o);
+    EXPECT_EQ_SIZE_T(0, lept_get_object_size(&o));
+    EXPECT_EQ_SIZE_T(i, lept_get_object_capacity(&o)); /* capacity remains unchanged */
+    lept_shrink_object(&o);
+    EXPECT_EQ_SIZE_T(0, lept_get_object_capacity(&o));
+
+    lept_free(&o);
+}
+
+static void test_key_pool() {
+    lept_key_pool* pool;
+    lept_value v1, v2, e;
+    const char* id;
+
+    pool = lept_key_pool_create();
+    lept_init(&v1);
+    lept_init(&v2);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_interned(&v1, "[{\"record_id\":1,\"display_name\":\"a\"},{\"record_id\":2,\"display_name\":\"b\"}]", pool));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_interned(&v2, "{\"display_name\":\"c\",\"record_id\":3}", pool));
+    EXPECT_EQ_SIZE_T(2, lept_key_pool_size(pool));
+
+    /* same key, same storage */
+    EXPECT_TRUE(lept_get_object_key(lept_get_array_element(&v1, 0), 0) == lept_get_object_key(lept_get_array_element(&v1, 1), 0));
+    EXPECT_TRUE(lept_get_object_key(lept_get_array_element(&v1, 0), 0) == lept_get_object_key(&v2, 1));
+
+    id = lept_key_pool_intern(pool, "record_id", 9);
+    EXPECT_EQ_SIZE_T(2, lept_key_pool_size(pool));
+    EXPECT_TRUE(id == lept_get_object_key(&v2, 1));
+    /* a key with an embedded NUL is not its prefix */
+    EXPECT_TRUE(lept_key_pool_intern(pool, "record_id\0x", 11) != id);
+    EXPECT_TRUE(lept_key_pool_intern(pool, "record_id\0x", 11) == lept_key_pool_intern(pool, "record_id\0x", 11));
+    EXPECT_EQ_SIZE_T(3, lept_key_pool_size(pool));
+    EXPECT_EQ_DOUBLE(3.0, lept_get_number(lept_find_object_value(&v2, id, 9)));
+    EXPECT_TRUE(lept_is_equal(lept_get_array_element(&v1, 0), lept_get_array_element(&v1, 0)));
+    EXPECT_FALSE(lept_is_equal(lept_get_array_element(&v1, 0), lept_get_array_element(&v1, 1)));
+
+    /* a failed parse gives its keys back */
+    lept_init(&e);
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_COLON, lept_parse_interned(&e, "{\"record_id\" 1}", pool));
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_VALUE, lept_parse_interned(&e, "{\"record_id\":1,\"tag\":?}", pool));
+    EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&e));
+
+    /* the values keep their keys alive */
+    lept_key_pool_destroy(pool);
+    EXPECT_EQ_STRING("display_name", lept_get_object_key(&v2, 0), lept_get_object_key_length(&v2, 0));
+    lept_copy(&v2, &v1);
+    EXPECT_TRUE(lept_is_equal(&v2, &v1));
+    lept_free(&v1);
+    EXPECT_EQ_STRING("display_name", lept_get_object_key(lept_get_array_element(&v2, 1), 1), 12);
+    lept_free(&v2);
+}
+
+static void test_parser() {
+    lept_parser* p;
+    lept_key_pool* pool;
+    lept_value v1, v2;
+    size_t retained;
+
+    p = lept_parser_create();
+    lept_init(&v1);
+    lept_init(&v2);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parser_parse(p, &v1, "[\"abc\",{\"k\":[1,2,3]}]"));
+    EXPECT_EQ_SIZE_T(2, lept_get_array_size(&v1));
+    retained = lept_parser_get_retained(p);
+    EXPECT_TRUE(retained > 0);
+
+    /* the scratch stack is reused, not grown again */
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parser_parse(p, &v2, "[\"abc\",{\"k\":[1,2,3]}]"));
+    EXPECT_EQ_SIZE_T(retained, lept_parser_get_retained(p));
+    EXPECT_TRUE(lept_is_equal(&v1, &v2));
+    lept_free(&v2);
+
+    /* errors leave the parser usable */
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, lept_parser_parse(p, &v2, "[1,2"));
+    EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v2));
+    EXPECT_EQ_INT(LEPT_PARSE_ROOT_NOT_SINGULAR, lept_parser_parse(p, &v2, "[1,2] x"));
+    EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v2));
+
+    /* cap the retained capacity */
+    lept_parser_set_max_retained(p, 0);
+    EXPECT_EQ_SIZE_T(0, lept_parser_get_retained(p));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parser_parse(p, &v2, "\"Hello\""));
+    EXPECT_EQ_SIZE_T(0, lept_parser_get_retained(p));
+    lept_free(&v2);
+
+    pool = lept_key_pool_create();
+    lept_parser_set_key_pool(p, pool);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parser_parse(p, &v2, "{\"long_key_name\":1}"));
+    EXPECT_EQ_SIZE_T(1, lept_key_pool_size(pool));
+    EXPECT_TRUE(lept_key_pool_intern(pool, "long_key_name", 13) == lept_get_object_key(&v2, 0));
+    lept_key_pool_destroy(pool);
+
+    lept_parser_destroy(p);
+    lept_free(&v1);
+    lept_free(&v2);
+}
+
+#define TEST_POINTER(expect, v, path) \
+    do {    \
+        lept_pointer* p = lept_pointer_compile(path, strlen(path));  \
+        lept_value* pv; \
+        EXPECT_TRUE(p != NULL); \
+        pv = lept_pointer_get(v, p);    \
+        EXPECT_TRUE(pv != NULL);    \
+        if (pv != NULL) {   \
+            EXPECT_EQ_DOUBLE(expect, lept_get_number(pv)); \
+        }   \
+        lept_pointer_free(p);   \
+    } while(0)
+
+#define TEST_POINTER_MISS(v, path) \
+    do {    \
+        lept_pointer* p = lept_pointer_compile(path, strlen(path));  \
+        EXPECT_TRUE(p != NULL); \
+        EXPECT_TRUE(lept_pointer_get(v, p) == NULL);   \
+        lept_pointer_free(p);   \
+    } while(0)
+
+static void test_pointer() {
+    lept_value v;
+    lept_pointer* p;
+    const char* key;
+    size_t klen;
+
+    /* RFC 6901 section 5 */
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v,
+        "{\"foo\":[\"bar\",\"baz\"],\"\":0,\"a/b\":1,\"c%d\":2,\"e^f\":3,\"g|h\":4,"
+        "\"i\\\\j\":5,\"k\\\"l\":6,\" \":7,\"m~n\":8,\"a_long_member_name\":{\"x\":[10,11,[12]]}}"));
+
+    p = lept_pointer_compile("", 0);
+    EXPECT_TRUE(lept_pointer_get(&v, p) == &v);
+    EXPECT_EQ_SIZE_T(0, lept_pointer_get_size(p));
+    lept_pointer_free(p);
+
+    p = lept_pointer_compile("/foo/0", 6);
+    EXPECT_EQ_SIZE_T(2, lept_pointer_get_size(p));
+    EXPECT_EQ_STRING("bar", lept_get_string(lept_pointer_get(&v, p)), lept_get_string_length(lept_pointer_get(&v, p)));
+    lept_pointer_free(p);
+
+    TEST_POINTER(0.0, &v, "/");
+    TEST_POINTER(1.0, &v, "/a~1b");
+    TEST_POINTER(2.0, &v, "/c%d");
+    TEST_POINTER(3.0, &v, "/e^f");
+    TEST_POINTER(4.0, &v, "/g|h");
+    TEST_POINTER(5.0, &v, "/i\\j");
+    TEST_POINTER(6.0, &v, "/k\"l");
+    TEST_POINTER(7.0, &v, "/ ");
+    TEST_POINTER(8.0, &v, "/m~0n");
+    TEST_POINTER(11.0, &v, "/a_long_member_name/x/1");
+    TEST_POINTER(12.0, &v, "/a_long_member_name/x/2/0");
+
+    TEST_POINTER_MISS(&v, "/bar");
+    TEST_POINTER_MISS(&v, "/foo/2");
+    TEST_POINTER_MISS(&v, "/foo/-");
+    TEST_POINTER_MISS(&v, "/foo/01");
+    TEST_POINTER_MISS(&v, "/foo/+1");
+    TEST_POINTER_MISS(&v, "/foo/0/x");
+    TEST_POINTER_MISS(&v, "/a_long_member_name/y");
+    TEST_POINTER_MISS(&v, "/foo/99999999999999999999999");
+
+    /* tokens are unescaped once, at compile time */
+    p = lept_pointer_compile("/m~0n/~01/a~1b", 14);
+    EXPECT_EQ_SIZE_T(3, lept_pointer_get_size(p));
+    key = lept_pointer_get_token(p, 1, &klen);
+    EXPECT_EQ_STRING("~1", key, klen);
+    key = lept_pointer_get_token(p, 2, &klen);
+    EXPECT_EQ_STRING("a/b", key, klen);
+    lept_pointer_free(p);
+
+    EXPECT_TRUE(lept_pointer_compile("foo", 3) == NULL);
+    EXPECT_TRUE(lept_pointer_compile("/~2", 3) == NULL);
+    EXPECT_TRUE(lept_pointer_compile("/a~", 3) == NULL);
+
+    lept_free(&v);
+}
+
+#define TEST_UNORDERED(expect, json1, json2) \
+    do {    \
+        lept_value v1, v2;  \
+        lept_init(&v1); \
+        lept_init(&v2); \
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v1, json1)); \
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v2, json2)); \
+        EXPECT_EQ_INT(expect, lept_is_equal_unordered(&v1, &v2)); \
+        if (expect) {   \
+            EXPECT_TRUE(lept_hash(&v1) == lept_hash(&v2)); \
+        }   \
+        lept_free(&v1); \
+        lept_free(&v2); \
+    } while(0)
+
+static void test_equal_unordered() {
+    lept_value v1, v2;
+
+    TEST_UNORDERED(1, "{\"a\":1,\"b\":2}", "{\"b\":2,\"a\":1}");
+    TEST_UNORDERED(1, "{\"a_long_member_name\":[1,{\"x\":null,\"y\":true}],\"b\":\"s\"}",
+                      "{\"b\":\"s\",\"a_long_member_name\":[1,{\"y\":true,\"x\":null}]}");
+    TEST_UNORDERED(1, "[0]", "[-0]");
+    TEST_UNORDERED(1, "{}", "{}");
+    TEST_UNORDERED(1, "\"a string longer than a machine word\"", "\"a string longer than a machine word\"");
+    TEST_UNORDERED(0, "{\"a\":1,\"b\":2}", "{\"b\":1,\"a\":2}");
+    TEST_UNORDERED(0, "{\"a\":1,\"b\":2}", "{\"a\":1,\"c\":2}");
+    TEST_UNORDERED(0, "{\"a\":1}", "{\"a\":1,\"b\":2}");
+    TEST_UNORDERED(0, "[1,2]", "[2,1]");
+    TEST_UNORDERED(0, "[{\"a\":1}]", "[{\"a\":\"1\"}]");
+
+    /* a few hashes that should not collide */
+    lept_init(&v1);
+    lept_init(&v2);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v1, "[1,2]"));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v2, "[2,1]"));
+    EXPECT_TRUE(lept_hash(&v1) != lept_hash(&v2));
+    lept_free(&v2);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v2, "[[1,2]]"));
+    EXPECT_TRUE(lept_hash(&v1) != lept_hash(&v2));
+    lept_free(&v1);
+    lept_free(&v2);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v1, "{\"a\":\"b\"}"));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v2, "{\"b\":\"a\"}"));
+    EXPECT_TRUE(lept_hash(&v1) != lept_hash(&v2));
+    lept_free(&v1);
+    lept_free(&v2);
+}
+
+static void test_parse_projected() {
+    static const char* json =
+        "{\"user\":{\"id\":42,\"name\":\"a \\\"quoted\\\" ]} name\",\"tags\":[1,2,3]},"
+        " \"event\":{\"ts\":1000,\"payload\":{\"big\":[[{}],[true,false,null],\"\\u0041{\"]}},"
+        " \"list\":[{\"a\":1},{\"a\":2},{\"a\":3,\"b\":4}], \"scalar\":5}";
+    static const char* path[] = { "/user/id", "/event/ts", "/list/2/a", "/missing", "/scalar/x", "/user/tags/9" };
+    lept_pointer* p[6];
+    lept_pointer* many[200];
+    lept_value v, expect;
+    char* text;
+    char* deep;
+    size_t i;
+
+    for (i = 0; i < 6; i++) {
+        p[i] = lept_pointer_compile(path[i], strlen(path[i]));
+    }
+    lept_init(&expect);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&expect,
+        "{\"user\":{\"id\":42},\"event\":{\"ts\":1000},\"list\":[null,null,{\"a\":3}]}"));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_projected(&v, json, (const lept_pointer* const*)p, 6));
+    EXPECT_TRUE(lept_is_equal(&v, &expect));
+    EXPECT_EQ_DOUBLE(3.0, lept_get_number(lept_pointer_get(&v, p[2])));
+    lept_free(&v);
+    lept_free(&expect);
+
+    /* the empty path asks for the whole document */
+    lept_pointer_free(p[5]);
+    p[5] = lept_pointer_compile("", 0);
+    lept_init(&expect);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&expect, json));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_projected(&v, json, (const lept_pointer* const*)p, 6));
+    EXPECT_TRUE(lept_is_equal(&v, &expect));
+    lept_free(&v);
+    lept_free(&expect);
+
+    /* nothing asked, nothing built */
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_projected(&v, json, NULL, 0));
+    EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v));
+
+    /* a missing index drops its array like a missing key drops its object */
+    many[0] = lept_pointer_compile("/user/tags/9", 12);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_projected(&v, "{\"user\":{\"tags\":[1],\"id\":{}}}", (const lept_pointer* const*)many, 1));
+    EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v));
+    lept_pointer_free(many[0]);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_projected(&v, "{\"user\":{\"tags\":[1],\"id\":{}}}", (const lept_pointer* const*)p, 1));
+    lept_init(&expect);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&expect, "{\"user\":{\"id\":{}}}"));
+    EXPECT_TRUE(lept_is_equal(&v, &expect));
+    lept_free(&v);
+    lept_free(&expect);
+
+    /* skipped subtrees nest as deep as lept_parse() takes */
+    deep = text = (char*)malloc(7 * 4096 + 32);
+    text += sprintf(text, "{\"list\":");
+    for (i = 0; i < 4096; i++) {
+        text += sprintf(text, "[{\"\":");
+    }
+    *text++ = '0';
+    for (i = 0; i < 4096; i++) {
+        text += sprintf(text, "}]");
+    }
+    sprintf(text, ",\"event\":{\"ts\":1}}");
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, deep));
+    lept_free(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_projected(&v, deep, (const lept_pointer* const*)p + 1, 1));
+    EXPECT_EQ_DOUBLE(1.0, lept_get_number(lept_pointer_get(&v, p[1])));
+    lept_free(&v);
+    free(deep);
+
+    /* errors outside skipped subtrees are still reported */
+    EXPECT_EQ_INT(LEPT_PARSE_ROOT_NOT_SINGULAR, lept_parse_projected(&v, "{\"user\":{\"id\":1}} x", (const lept_pointer* const*)p, 1));
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET, lept_parse_projected(&v, "{\"user\":{\"id\":1 \"x\":2}}", (const lept_pointer* const*)p, 1));
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET, lept_parse_projected(&v, "{\"user\":{\"id\":1,\"x\":[1,{2]}}", (const lept_pointer* const*)p, 1));
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_QUOTATION_MARK, lept_parse_projected(&v, "{\"event\":\"abc}", (const lept_pointer* const*)p, 1));
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_VALUE, lept_parse_projected(&v, "{\"list\":[{},{\"a\":nul},{\"a\":nul}]}", (const lept_pointer* const*)p + 2, 1));
+
+    for (i = 0; i < 6; i++) {
+        lept_pointer_free(p[i]);
+    }
+
+    /* enough paths that the index lists outgrow the first stack */
+    for (i = 0; i < 200; i++) {
+        char buffer[16];
+        sprintf(buffer, "/a/%u", (unsigned)i);
+        many[i] = lept_pointer_compile(buffer, strlen(buffer));
+    }
+    lept_init(&expect);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&expect, "{\"a\":[0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,"
+        "25,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40,41,42,43,44,45,46,47,48,49]}"));
+    EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify(&expect, &text, NULL));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_projected(&v, text, (const lept_pointer* const*)many, 200));
+    EXPECT_TRUE(lept_is_equal(&v, &expect));
+    free(text);
+    lept_free(&v);
+    lept_free(&expect);
+    for (i = 0; i < 200; i++) {
+        lept_pointer_free(many[i]);
+    }
+}
+
+static void test_packed_array() {
+    static const double n[] = { 1.0, 2.5, -3.0 };
+    lept_parser* p = lept_parser_create();
+    lept_value v, v2, *e;
+    lept_pointer* ptr;
+    char *json, *buffer;
+    size_t length;
+
+    lept_parser_set_options(p, LEPT_PARSE_PACK_NUMBERS);
+    lept_init(&v);
+    lept_init(&v2);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parser_parse(p, &v, "[1, 2.5, -3]"));
+    EXPECT_EQ_INT(LEPT_ARRAY, lept_get_type(&v));
+    EXPECT_EQ_SIZE_T(3, lept_get_array_size(&v));
+    EXPECT_TRUE(lept_get_array_doubles(&v) != NULL);
+    EXPECT_TRUE(memcmp(n, lept_get_array_doubles(&v), sizeof(n)) == 0);
+    EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify(&v, &json, &length));
+    EXPECT_EQ_STRING("[1,2.5,-3]", json, length);
+    free(json);
+
+    /* packed or not, the same value */
+    lept_set_array_doubles(&v2, n, 3);
+    EXPECT_TRUE(lept_is_equal(&v, &v2));
+    lept_free(&v2);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v2, "[1,2.5,-3]"));
+    EXPECT_TRUE(lept_get_array_doubles(&v2) == NULL);
+    EXPECT_TRUE(lept_is_equal(&v, &v2));
+    EXPECT_TRUE(lept_is_equal(&v2, &v));
+    EXPECT_TRUE(lept_is_equal_unordered(&v, &v2));
+    EXPECT_TRUE(lept_hash(&v) == lept_hash(&v2));
+    EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_encode_binary(&v, &buffer, &length));
+    lept_free(&v2);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_decode_binary(&v2, buffer, length));
+    EXPECT_TRUE(lept_is_equal(&v, &v2));
+    free(buffer);
+    lept_copy(&v2, &v);
+    EXPECT_TRUE(lept_get_array_doubles(&v2) != NULL);
+    EXPECT_TRUE(lept_is_equal(&v, &v2));
+    lept_free(&v2);
+
+    /* reading leaves it packed, only lept_unpack_array() and the setters unpack */
+    EXPECT_EQ_DOUBLE(-3.0, lept_get_number(lept_peek_array_element(&v, 2, &v2)));
+    EXPECT_TRUE(lept_get_array_doubles(&v) != NULL);
+    lept_unpack_array(&v);
+    e = lept_get_array_element(&v, 1);
+    EXPECT_EQ_DOUBLE(2.5, lept_get_number(e));
+    EXPECT_TRUE(lept_get_array_doubles(&v) == NULL);
+    EXPECT_TRUE(lept_pack_array(&v));
+    EXPECT_TRUE(memcmp(n, lept_get_array_doubles(&v), sizeof(n)) == 0);
+    lept_set_number(lept_pushback_array_element(&v), 4.0);
+    EXPECT_EQ_SIZE_T(4, lept_get_array_size(&v));
+    lept_set_string(lept_pushback_array_element(&v), "x", 1);
+    EXPECT_FALSE(lept_pack_array(&v));
+    lept_free(&v);
+
+    /* a non-number turns the numbers before it back into lept_value */
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parser_parse(p, &v, "[[1,2],[3,\"x\",[4]],[],5]"));
+    EXPECT_TRUE(lept_get_array_doubles(&v) == NULL);
+    EXPECT_TRUE(lept_get_array_doubles(lept_get_array_element(&v, 0)) != NULL);
+    e = lept_get_array_element(&v, 1);
+    EXPECT_TRUE(lept_get_array_doubles(e) == NULL);
+    EXPECT_EQ_DOUBLE(3.0, lept_get_number(lept_get_array_element(e, 0)));
+    EXPECT_EQ_STRING("x", lept_get_string(lept_get_array_element(e, 1)), 1);
+    EXPECT_TRUE(lept_get_array_doubles(lept_get_array_element(e, 2)) != NULL);
+    EXPECT_TRUE(lept_get_array_doubles(lept_get_array_element(&v, 2)) == NULL);
+    EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify(&v, &json, &length));
+    EXPECT_EQ_STRING("[[1,2],[3,\"x\",[4]],[],5]", json, length);
+    free(json);
+    ptr = lept_pointer_compile("/1/2/0", 6);
+    EXPECT_TRUE(lept_pointer_get(&v, ptr) == NULL);
+    EXPECT_EQ_DOUBLE(4.0, lept_get_number(lept_pointer_peek(&v, ptr, &v2)));
+    EXPECT_TRUE(lept_get_array_doubles(lept_get_array_element(e, 2)) != NULL);
+    lept_pointer_free(ptr);
+    ptr = lept_pointer_compile("/1/2/1", 6);
+    EXPECT_TRUE(lept_pointer_peek(&v, ptr, &v2) == NULL);
+    lept_pointer_free(ptr);
+    ptr = lept_pointer_compile("/1/0", 4);
+    EXPECT_TRUE(lept_pointer_peek(&v, ptr, &v2) == lept_pointer_get(&v, ptr));
+    lept_pointer_free(ptr);
+    lept_free(&v);
+
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_VALUE, lept_parser_parse(p, &v, "[[1,2],{\"a\":[3]},?]"));
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, lept_parser_parse(p, &v, "[1,2"));
+    lept_parser_destroy(p);
+}
+
+#define EXPECT_COLUMN_NULL(expect, col, row) \
+    EXPECT_EQ_INT(expect, ((col).nulls[(row) / 8] >> ((row) % 8)) & 1)
+
+static void test_to_columns() {
+    lept_value v;
+    lept_column col[4];
+    size_t rows;
+
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "["
+        "{\"id\":1,\"price\":2.5,\"name\":\"apple\",\"fresh\":true},"
+        "{\"id\":2,\"price\":0.75,\"name\":\"fig\",\"fresh\":false},"
+        "{\"name\":\"\",\"fresh\":null,\"price\":1,\"id\":3.5},"
+        "42,"
+        "{\"id\":-5,\"price\":\"n/a\",\"name\":\"kiwi\"}]"));
+    col[0].key = "id";      col[0].klen = 2;    col[0].type = LEPT_COLUMN_LONG;
+    col[1].key = "price";   col[1].klen = 5;    col[1].type = LEPT_COLUMN_DOUBLE;
+    col[2].key = "name";    col[2].klen = 4;    col[2].type = LEPT_COLUMN_STRING;
+    col[3].key = "fresh";   col[3].klen = 5;    col[3].type = LEPT_COLUMN_BOOLEAN;
+    rows = lept_to_columns(&v, col, 4);
+    EXPECT_EQ_SIZE_T(5, rows);
+
+    EXPECT_TRUE(col[0].data.l[0] == 1 && col[0].data.l[1] == 2 && col[0].data.l[4] == -5);
+    EXPECT_COLUMN_NULL(0, col[0], 0);
+    EXPECT_COLUMN_NULL(1, col[0], 2);   /* 3.5 is not a long */
+    EXPECT_COLUMN_NULL(1, col[0], 3);   /* not an object */
+
+    EXPECT_EQ_DOUBLE(2.5, col[1].data.d[0]);
+    EXPECT_EQ_DOUBLE(0.75, col[1].data.d[1]);
+    EXPECT_EQ_DOUBLE(1.0, col[1].data.d[2]);
+    EXPECT_COLUMN_NULL(0, col[1], 2);
+    EXPECT_COLUMN_NULL(1, col[1], 4);
+
+    EXPECT_EQ_STRING("applefigkiwi", col[2].bytes, col[2].data.offsets[5]);
+    EXPECT_EQ_SIZE_T(5, col[2].data.offsets[1]);
+    EXPECT_EQ_SIZE_T(8, col[2].data.offsets[2]);
+    EXPECT_EQ_SIZE_T(8, col[2].data.offsets[3]);
+    EXPECT_EQ_SIZE_T(8, col[2].data.offsets[4]);
+    EXPECT_COLUMN_NULL(0, col[2], 2);   /* "" is a value */
+    EXPECT_COLUMN_NULL(1, col[2], 3);
+
+    EXPECT_TRUE(col[3].data.b[0] == 1 && col[3].data.b[1] == 0);
+    EXPECT_COLUMN_NULL(0, col[3], 1);
+    EXPECT_COLUMN_NULL(1, col[3], 2);
+    EXPECT_COLUMN_NULL(1, col[3], 4);
+
+    lept_free_columns(col, 4);
+    lept_free(&v);
+
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "[]"));
+    EXPECT_EQ_SIZE_T(0, lept_to_columns(&v, col, 4));
+    EXPECT_EQ_SIZE_T(0, col[2].data.offsets[0]);
+    lept_free_columns(col, 4);
+    lept_free(&v);
+}
+
+typedef struct {
+    double x, y;
+}test_point;
+
+typedef struct {
+    long id;
+    char name[8];
+    int active;
+    int age;
+    double score;
+    test_point pos;
+}test_user;
+
+static void test_decode() {
+    static const lept_field point_fields[] = {
+        { "x", LEPT_FIELD_DOUBLE, offsetof(test_point, x), 0, NULL },
+        { "y", LEPT_FIELD_DOUBLE, offsetof(test_point, y), 0, NULL }
+    };
+    lept_field user_fields[] = {
+        { "id",     LEPT_FIELD_LONG,    offsetof(test_user, id),     0, NULL },
+        { "name",   LEPT_FIELD_STRING,  offsetof(test_user, name),   8, NULL },
+        { "active", LEPT_FIELD_BOOLEAN, offsetof(test_user, active), 0, NULL },
+        { "age",    LEPT_FIELD_INT,     offsetof(test_user, age),    0, NULL },
+        { "score",  LEPT_FIELD_DOUBLE,  offsetof(test_user, score),  0, NULL },
+        { "pos",    LEPT_FIELD_OBJECT,  offsetof(test_user, pos),    0, NULL }
+    };
+    lept_field many[200];
+    char keys[200][16];
+    double values[200];
+    char json[200 * 24];
+    char* p;
+    lept_decoder* point = lept_decoder_create(point_fields, 2);
+    lept_decoder* user;
+    lept_parse_result result;
+    test_user u;
+    size_t i;
+
+    user_fields[5].nested = point;
+    user = lept_decoder_create(user_fields, 6);
+    EXPECT_TRUE(user != NULL);
+
+    memset(&u, 0, sizeof(u));
+    u.age = 7;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_decode(user, &u,
+        " {\"id\":12345678,\"extra\":{\"deep\":[1,{\"x\":\"}\"}]},\"na\\u006de\":\"Ann\\n\",\"active\":true,"
+        "\"age\":null,\"pos\":{\"y\":-2.5,\"z\":0,\"x\":1e2},\"score\":0.5,\"tags\":[\"a\",\"b\"]} ", NULL));
+    EXPECT_TRUE(u.id == 12345678);
+    EXPECT_EQ_STRING("Ann\n", u.name, strlen(u.name));
+    EXPECT_EQ_INT(1, u.active);
+    EXPECT_EQ_INT(7, u.age);
+    EXPECT_EQ_DOUBLE(0.5, u.score);
+    EXPECT_EQ_DOUBLE(100.0, u.pos.x);
+    EXPECT_EQ_DOUBLE(-2.5, u.pos.y);
+
+    EXPECT_EQ_INT(LEPT_PARSE_TYPE_MISMATCH, lept_decode(user, &u, "{\"id\":\"1\"}", &result));
+    EXPECT_EQ_SIZE_T(6, result.offset);
+    EXPECT_EQ_INT(LEPT_PARSE_TYPE_MISMATCH, lept_decode(user, &u, "{\"age\":1.5}", NULL));
+    EXPECT_EQ_INT(LEPT_PARSE_TYPE_MISMATCH, lept_decode(user, &u, "{\"active\":1}", NULL));
+    EXPECT_EQ_INT(LEPT_PARSE_TYPE_MISMATCH, lept_decode(user, &u, "{\"pos\":[1,2]}", NULL));
+    EXPECT_EQ_INT(LEPT_PARSE_TYPE_MISMATCH, lept_decode(user, &u, "[]", NULL));
+    EXPECT_EQ_INT(LEPT_PARSE_STRING_TOO_LONG, lept_decode(user, &u, "{\"name\":\"12345678\"}", NULL));
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_COLON, lept_decode(user, &u, "{\"name\" 1}", NULL));
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET, lept_decode(user, &u, "{\"other\":[1,2] \"id\":1}", NULL));
+    EXPECT_EQ_INT(LEPT_PARSE_ROOT_NOT_SINGULAR, lept_decode(user, &u, "{} {}", NULL));
+    EXPECT_EQ_INT(LEPT_PARSE_EXPECT_VALUE, lept_decode(user, &u, " ", NULL));
+
+    /* duplicate keys can not be told apart */
+    user_fields[1].key = "id";
+    EXPECT_TRUE(lept_decoder_create(user_fields, 6) == NULL);
+    lept_decoder_destroy(user);
+    lept_decoder_destroy(point);
+
+    /* a wide table, every key has to be found and nothing else */
+    p = json;
+    *p++ = '{';
+    for (i = 0; i < 200; i++) {
+        sprintf(keys[i], "field_%u", (unsigned)i);
+        many[i].key = keys[i];
+        many[i].type = LEPT_FIELD_DOUBLE;
+        many[i].offset = i * sizeof(double);
+        many[i].size = 0;
+        many[i].nested = NULL;
+        p += sprintf(p, "\"field_%u\":%u,", (unsigned)(199 - i), (unsigned)(199 - i));
+    }
+    strcpy(p, "\"field_200\":-1,\"field_\":-1}");
+    point = lept_decoder_create(many, 200);
+    EXPECT_TRUE(point != NULL);
+    memset(values, 0, sizeof(values));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_decode(point, values, json, NULL));
+    for (i = 0; i < 200; i++) {
+        EXPECT_EQ_DOUBLE((double)i, values[i]);
+    }
+    lept_decoder_destroy(point);
+}
+
+#define TEST_SCHEMA(expect, expect_path, json)\
+    do {\
+        lept_value v;\
+        char path[64];\
+        lept_init(&v);\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));\
+        EXPECT_EQ_INT(expect, lept_schema_validate(s, &v, path, sizeof(path)));\
+        EXPECT_EQ_STRING(expect_path, path, strlen(path));\
+        lept_free(&v);\
+    } while(0)
+
+static void test_schema() {
+    lept_value schema;
+    lept_schema* s;
+    char path[8];
+    lept_init(&schema);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&schema,
+        "{\"type\":\"object\",\"required\":[\"id\",\"a/b\"],\"properties\":{"
+        "\"id\":{\"type\":\"integer\",\"minimum\":1},"
+        "\"name\":{\"type\":\"string\",\"minLength\":1,\"maxLength\":3},"
+        "\"kind\":{\"enum\":[\"a\",1,null,[true],{\"x\":1,\"y\":{\"p\":0,\"q\":1}}]},"
+        "\"ratio\":{\"type\":[\"number\",\"null\"],\"exclusiveMaximum\":1},"
+        "\"tags\":{\"type\":\"array\",\"maxItems\":2,\"items\":{\"type\":\"string\"}},"
+        "\"points\":{\"items\":{\"type\":\"object\",\"required\":[\"x\"],\"properties\":{\"x\":{\"maximum\":9}}}},"
+        "\"none\":false,"
+        "\"any\":true}}"));
+    s = lept_schema_compile(&schema);
+    lept_free(&schema);
+    EXPECT_TRUE(s != NULL);
+
+    TEST_SCHEMA(LEPT_SCHEMA_OK, "", "{\"id\":3,\"a/b\":0,\"name\":\"\\u20ac\\u20ac\\u20ac\",\"kind\":[true],\"ratio\":null,"
+        "\"tags\":[\"x\"],\"points\":[{\"x\":9},{\"x\":1,\"y\":\"?\"}],\"any\":{},\"other\":1}");
+    TEST_SCHEMA(LEPT_SCHEMA_TYPE, "", "[]");
+    TEST_SCHEMA(LEPT_SCHEMA_REQUIRED, "/a~1b", "{\"id\":3}");
+    TEST_SCHEMA(LEPT_SCHEMA_TYPE, "/id", "{\"id\":3.5,\"a/b\":0}");
+    TEST_SCHEMA(LEPT_SCHEMA_TYPE, "/id", "{\"id\":4503599627370495.5,\"a/b\":0}");
+    TEST_SCHEMA(LEPT_SCHEMA_OK, "", "{\"id\":1e300,\"a/b\":0}");
+    TEST_SCHEMA(LEPT_SCHEMA_MINIMUM, "/id", "{\"id\":0,\"a/b\":0}");
+    TEST_SCHEMA(LEPT_SCHEMA_MIN_LENGTH, "/name", "{\"id\":1,\"a/b\":0,\"name\":\"\"}");
+    TEST_SCHEMA(LEPT_SCHEMA_MAX_LENGTH, "/name", "{\"id\":1,\"a/b\":0,\"name\":\"abcd\"}");
+    TEST_SCHEMA(LEPT_SCHEMA_ENUM, "/kind", "{\"id\":1,\"a/b\":0,\"kind\":\"b\"}");
+    TEST_SCHEMA(LEPT_SCHEMA_OK, "", "{\"id\":1,\"a/b\":0,\"kind\":{\"y\":{\"q\":1,\"p\":0},\"x\":1}}");
+    TEST_SCHEMA(LEPT_SCHEMA_ENUM, "/kind", "{\"id\":1,\"a/b\":0,\"kind\":{\"y\":{\"q\":1,\"p\":1},\"x\":1}}");
+    TEST_SCHEMA(LEPT_SCHEMA_MAXIMUM, "/ratio", "{\"id\":1,\"a/b\":0,\"ratio\":1}");
+    TEST_SCHEMA(LEPT_SCHEMA_TYPE, "/ratio", "{\"id\":1,\"a/b\":0,\"ratio\":true}");
+    TEST_SCHEMA(LEPT_SCHEMA_MAX_ITEMS, "/tags", "{\"id\":1,\"a/b\":0,\"tags\":[\"a\",\"b\",\"c\"]}");
+    TEST_SCHEMA(LEPT_SCHEMA_TYPE, "/tags/1", "{\"id\":1,\"a/b\":0,\"tags\":[\"a\",2]}");
+    TEST_SCHEMA(LEPT_SCHEMA_REQUIRED, "/points/1/x", "{\"id\":1,\"a/b\":0,\"points\":[{\"x\":1},{}]}");
+    TEST_SCHEMA(LEPT_SCHEMA_MAXIMUM, "/points/0/x", "{\"id\":1,\"a/b\":0,\"points\":[{\"x\":10}]}");
+    TEST_SCHEMA(LEPT_SCHEMA_TYPE, "/none", "{\"id\":1,\"a/b\":0,\"none\":null}");
+
+    /* the path is cut short, never overrun */
+    lept_init(&schema);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&schema, "{\"id\":1,\"a/b\":0,\"points\":[{\"x\":10}]}"));
+    EXPECT_EQ_INT(LEPT_SCHEMA_MAXIMUM, lept_schema_validate(s, &schema, path, sizeof(path)));
+    EXPECT_EQ_STRING("/points", path, strlen(path));
+    EXPECT_EQ_INT(LEPT_SCHEMA_MAXIMUM, lept_schema_validate(s, &schema, NULL, 0));
+    lept_free(&schema);
+    lept_schema_free(s);
+
+    /* packed elements are checked one by one like any other */
+    lept_init(&schema);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&schema, "{\"items\":{\"type\":\"integer\",\"maximum\":10}}"));
+    s = lept_schema_compile(&schema);
+    lept_free(&schema);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&schema, "[1,2,30]"));
+    EXPECT_TRUE(lept_pack_array(&schema));
+    EXPECT_EQ_INT(LEPT_SCHEMA_MAXIMUM, lept_schema_validate(s, &schema, path, sizeof(path)));
+    EXPECT_EQ_STRING("/2", path, strlen(path));
+    lept_free(&schema);
+    lept_schema_free(s);
+
+    /* inclusive and exclusive bounds both hold, whatever order the keys come in */
+    lept_init(&schema);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&schema, "{\"exclusiveMinimum\":3,\"minimum\":5,\"maximum\":9,\"exclusiveMaximum\":7}"));
+    s = lept_schema_compile(&schema);
+    lept_free(&schema);
+    TEST_SCHEMA(LEPT_SCHEMA_OK, "", "5");
+    TEST_SCHEMA(LEPT_SCHEMA_OK, "", "6.5");
+    TEST_SCHEMA(LEPT_SCHEMA_MINIMUM, "", "4");
+    TEST_SCHEMA(LEPT_SCHEMA_MAXIMUM, "", "7");
+    lept_schema_free(s);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&schema, "{\"minimum\":5,\"exclusiveMinimum\":3,\"exclusiveMaximum\":7,\"maximum\":9}"));
+    s = lept_schema_compile(&schema);
+    lept_free(&schema);
+    TEST_SCHEMA(LEPT_SCHEMA_OK, "", "5");
+    TEST_SCHEMA(LEPT_SCHEMA_MINIMUM, "", "4");
+    TEST_SCHEMA(LEPT_SCHEMA_MAXIMUM, "", "7");
+    lept_schema_free(s);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&schema, "{\"minimum\":3,\"exclusiveMinimum\":3}"));
+    s = lept_schema_compile(&schema);
+    lept_free(&schema);
+    TEST_SCHEMA(LEPT_SCHEMA_MINIMUM, "", "3");
+    TEST_SCHEMA(LEPT_SCHEMA_OK, "", "3.5");
+    lept_schema_free(s);
+
+    lept_init(&schema);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&schema, "{\"type\":\"text\"}"));
+    EXPECT_TRUE(lept_schema_compile(&schema) == NULL);
+    lept_free(&schema);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&schema, "{\"properties\":{\"a\":{\"minLength\":-1}}}"));
+    EXPECT_TRUE(lept_schema_compile(&schema) == NULL);
+    lept_free(&schema);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&schema, "{\"minimum\":\"1\"}"));
+    EXPECT_TRUE(lept_schema_compile(&schema) == NULL);
+    lept_free(&schema);
+}
+
+/* writes the matches into one array */
+static int test_query_collect(const lept_value* v, void* context) {
+    lept_value* a = (lept_value*)context;
+    lept_copy(lept_pushback_array_element(a), v);
+    return 0;
+}
+
+static int test_query_first(const lept_value* v, void* context) {
+    *(const lept_value**)context = v;
+    return 1;
+}
+
+#define TEST_QUERY(expect, query, json)\
+    do {\
+        lept_value v, a, e;\
+        lept_query* q = lept_query_compile(query);\
+        lept_init(&v);\
+        lept_init(&a);\
+        lept_init(&e);\
+        EXPECT_TRUE(q != NULL);\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&e, expect));\
+        lept_set_array(&a, 0);\
+        EXPECT_EQ_SIZE_T(lept_get_array_size(&e), lept_query_run(q, &v, test_query_collect, &a));\
+        EXPECT_TRUE(lept_is_equal(&e, &a));\
+        lept_query_free(q);\
+        lept_free(&v);\
+        lept_free(&a);\
+        lept_free(&e);\
+    } while(0)
+
+static void test_query() {
+    static const char* const store =
+        "{\"store\":{\"items\":[{\"id\":1,\"price\":5,\"tag\":\"a\"},{\"id\":2,\"price\":12.5,\"tag\":\"b\"},"
+        "{\"id\":3,\"price\":20,\"sale\":true}],\"owner\":{\"id\":\"x\"},\"a b\":[0,1,2,3,4,5]}}";
+    static const char* const bad[] = {
+        "", "store", "$.", "$..", "$[", "$[1", "$['a]", "$[1:2:]x", "$[?(@.a >)]", "$[?(@.a == 'x']",
+        "$[?(a == 1)]", "$.a[?(@.b = 1)]", "$[99999999999999999999]", "$[?(@[x] == 1)]", "$ .a"
+    };
+    lept_value v;
+    const lept_value* first = NULL;
+    lept_query* q;
+    char huge[64];
+    size_t i;
+
+    TEST_QUERY("[1,2,3]", "$.store.items[*].id", store);
+    TEST_QUERY("[2,3]", "$.store.items[?(@.price > 10)].id", store);
+    TEST_QUERY("[2,3]", "$['store'][\"items\"][?@.price>=12.5].id", store);
+    TEST_QUERY("[1]", "$.store.items[?(@.price <= 10 && @.tag == 'a')].id", store);
+    TEST_QUERY("[1,3]", "$.store.items[?(@.tag == 'a' || @.sale == true)].id", store);
+    TEST_QUERY("[1,3]", "$.store.items[?(@.tag != 'b')].id", store);
+    TEST_QUERY("[3]", "$.store.items[?(@.sale)].id", store);
+    TEST_QUERY("[]", "$.store.items[?(@.tag < 1)].id", store);
+    TEST_QUERY("[1,2,3,\"x\"]", "$..id", store);
+    TEST_QUERY("[1,2,3,\"x\"]", "$.store..['id']", store);
+    TEST_QUERY("[{\"id\":3,\"price\":20,\"sale\":true}]", "$.store.items[-1]", store);
+    TEST_QUERY("[]", "$.store.items[3]", store);
+    TEST_QUERY("[1,2,3]", "$.store['a b'][1:4]", store);
+    TEST_QUERY("[0,2,4]", "$.store['a b'][::2]", store);
+    TEST_QUERY("[5,3,1]", "$.store['a b'][::-2]", store);
+    TEST_QUERY("[4,5]", "$.store['a b'][-2:]", store);
+    TEST_QUERY("[3,2]", "$.store['a b'][3:1:-1]", store);
+    TEST_QUERY("[]", "$.store['a b'][1:4:0]", store);
+    /* the step must not overflow past the end */
+    sprintf(huge, "$[1::%ld]", LONG_MAX);
+    TEST_QUERY("[1]", huge, "[0,1,2,3]");
+    sprintf(huge, "$[2::-%ld]", LONG_MAX);
+    TEST_QUERY("[2]", huge, "[0,1,2,3]");
+    TEST_QUERY("[2]", "$[*][?(@[0] == 'x')][2]", "{\"a\":[[\"x\",1,2],[\"y\"]]}");
+    TEST_QUERY("[\"q\"]", "$[?(@['it\\'s'] == 'a\\'b')].v", "[{\"it's\":\"a'b\",\"v\":\"q\"}]");
+    TEST_QUERY("[{\"a\":1}]", "$", "{\"a\":1}");
+
+    /* stop at the first match */
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, store));
+    q = lept_query_compile("$..price");
+    EXPECT_EQ_SIZE_T(3, lept_query_run(q, &v, NULL, NULL));
+    EXPECT_EQ_SIZE_T(1, lept_query_run(q, &v, test_query_first, &first));
+    EXPECT_EQ_DOUBLE(5.0, lept_get_number(first));
+    lept_query_free(q);
+
+    /* packed arrays are read as they are */
+    EXPECT_TRUE(lept_pack_array(lept_find_object_value(lept_find_object_value(&v, "store", 5), "a b", 3)));
+    q = lept_query_compile("$.store['a b'][?(@ > 3)]");
+    EXPECT_EQ_SIZE_T(2, lept_query_run(q, &v, NULL, NULL));
+    lept_query_free(q);
+    q = lept_query_compile("$..['a b'][-1:0:-2]");
+    EXPECT_EQ_SIZE_T(3, lept_query_run(q, &v, NULL, NULL));
+    lept_query_free(q);
+    EXPECT_TRUE(lept_get_array_doubles(lept_find_object_value(lept_find_object_value(&v, "store", 5), "a b", 3)) != NULL);
+    lept_free(&v);
+
+    for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        EXPECT_TRUE(lept_query_compile(bad[i]) == NULL);
+    }
+}
+
+#define TEST_PATCH(expect_ret, expect, json, patch)\
+    do {\
+        lept_value v, p, e, p0;\
+        lept_init(&v);\
+        lept_init(&p);\
+        lept_init(&e);\
+        lept_init(&p0);\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&p, patch));\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&e, expect));\
+        lept_copy(&p0, &p);\
+        EXPECT_EQ_INT(expect_ret, lept_apply_patch(&v, &p));\
+        EXPECT_TRUE(lept_is_equal_unordered(&e, &v));\
+        if (expect_ret != LEPT_PATCH_OK) {\
+            EXPECT_TRUE(lept_is_equal(&e, &v));\
+            EXPECT_TRUE(lept_is_equal(&p0, &p));\
+        }\
+        lept_free(&v);\
+        lept_free(&p);\
+        lept_free(&e);\
+        lept_free(&p0);\
+    } while(0)
+
+#define TEST_MERGE_PATCH(expect, json, patch)\
+    do {\
+        lept_value v, p, e;\
+        lept_init(&v);\
+        lept_init(&p);\
+        lept_init(&e);\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&p, patch));\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&e, expect));\
+        lept_apply_merge_patch(&v, &p);\
+        EXPECT_TRUE(lept_is_equal_unordered(&e, &v));\
+        lept_free(&v);\
+        lept_free(&p);\
+        lept_free(&e);\
+    } while(0)
+
+static void test_patch() {
+    /* the examples of RFC 6902 appendix A */
+    TEST_PATCH(LEPT_PATCH_OK, "{\"baz\":\"qux\",\"foo\":\"bar\"}",
+        "{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/baz\",\"value\":\"qux\"}]");
+    TEST_PATCH(LEPT_PATCH_OK, "{\"foo\":[\"bar\",\"qux\",\"baz\"]}",
+        "{\"foo\":[\"bar\",\"baz\"]}", "[{\"op\":\"add\",\"path\":\"/foo/1\",\"value\":\"qux\"}]");
+    TEST_PATCH(LEPT_PATCH_OK, "{\"foo\":\"bar\"}",
+        "{\"baz\":\"qux\",\"foo\":\"bar\"}", "[{\"op\":\"remove\",\"path\":\"/baz\"}]");
+    TEST_PATCH(LEPT_PATCH_OK, "{\"foo\":[\"bar\",\"baz\"]}",
+        "{\"foo\":[\"bar\",\"qux\",\"baz\"]}", "[{\"op\":\"remove\",\"path\":\"/foo/1\"}]");
+    TEST_PATCH(LEPT_PATCH_OK, "{\"baz\":\"boo\",\"foo\":\"bar\"}",
+        "{\"baz\":\"qux\",\"foo\":\"bar\"}", "[{\"op\":\"replace\",\"path\":\"/baz\",\"value\":\"boo\"}]");
+    TEST_PATCH(LEPT_PATCH_OK, "{\"foo\":{\"bar\":\"baz\"},\"qux\":{\"corge\":\"grault\",\"thud\":\"fred\"}}",
+        "{\"foo\":{\"bar\":\"baz\",\"waldo\":\"fred\"},\"qux\":{\"corge\":\"grault\"}}",
+        "[{\"op\":\"move\",\"from\":\"/foo/waldo\",\"path\":\"/qux/thud\"}]");
+    TEST_PATCH(LEPT_PATCH_OK, "{\"foo\":[\"all\",\"cows\",\"eat\",\"grass\"]}",
+        "{\"foo\":[\"all\",\"grass\",\"cows\",\"eat\"]}", "[{\"op\":\"move\",\"from\":\"/foo/1\",\"path\":\"/foo/3\"}]");
+    TEST_PATCH(LEPT_PATCH_OK, "{\"baz\":\"qux\",\"foo\":[\"a\",2,\"c\"]}", "{\"baz\":\"qux\",\"foo\":[\"a\",2,\"c\"]}",
+        "[{\"op\":\"test\",\"path\":\"/baz\",\"value\":\"qux\"},{\"op\":\"test\",\"path\":\"/foo/1\",\"value\":2}]");
+    TEST_PATCH(LEPT_PATCH_TEST_FAILED, "{\"baz\":\"qux\"}", "{\"baz\":\"qux\"}",
+        "[{\"op\":\"test\",\"path\":\"/baz\",\"value\":\"bar\"}]");
+    TEST_PATCH(LEPT_PATCH_OK, "{\"a\":1,\"b\":2}", "{\"a\":1,\"b\":2}",
+        "[{\"op\":\"test\",\"path\":\"\",\"value\":{\"b\":2,\"a\":1}}]");
+    TEST_PATCH(LEPT_PATCH_OK, "{\"foo\":\"bar\",\"child\":{\"grandchild\":{}}}", "{\"foo\":\"bar\"}",
+        "[{\"op\":\"add\",\"path\":\"/child\",\"value\":{\"grandchild\":{}}}]");
+    TEST_PATCH(LEPT_PATCH_NOT_FOUND, "{\"foo\":\"bar\"}", "{\"foo\":\"bar\"}",
+        "[{\"op\":\"add\",\"path\":\"/baz/bat\",\"value\":\"qux\"}]");
+    TEST_PATCH(LEPT_PATCH_OK, "{\"/\":9,\"~1\":10}", "{\"/\":9,\"~1\":10}",
+        "[{\"op\":\"test\",\"path\":\"/~01\",\"value\":10}]");
+    TEST_PATCH(LEPT_PATCH_OK, "{\"foo\":[\"bar\",[\"abc\",\"def\"]]}", "{\"foo\":[\"bar\"]}",
+        "[{\"op\":\"add\",\"path\":\"/foo/-\",\"value\":[\"abc\",\"def\"]}]");
+
+    /* copy, the root, packed arrays and escaped new keys */
+    TEST_PATCH(LEPT_PATCH_OK, "{\"a\":[1,2],\"b\":{\"c\":[1,2]}}", "{\"a\":[1,2],\"b\":{}}",
+        "[{\"op\":\"copy\",\"from\":\"/a\",\"path\":\"/b/c\"}]");
+    TEST_PATCH(LEPT_PATCH_OK, "[1]", "{\"a\":1}", "[{\"op\":\"replace\",\"path\":\"\",\"value\":[1]}]");
+    TEST_PATCH(LEPT_PATCH_OK, "{\"m~n/o\":1}", "{}", "[{\"op\":\"add\",\"path\":\"/m~0n~1o\",\"value\":1}]");
+    TEST_PATCH(LEPT_PATCH_OK, "{\"a\":\"b\"}", "{\"a\":\"b\"}", "[]");
+
+    /* anything that fails undoes everything before it */
+    TEST_PATCH(LEPT_PATCH_NOT_FOUND, "{\"a\":{\"b\":[1,2,3]},\"c\":\"a long string value\"}",
+        "{\"a\":{\"b\":[1,2,3]},\"c\":\"a long string value\"}",
+        "[{\"op\":\"remove\",\"path\":\"/a/b/0\"},"
+        "{\"op\":\"add\",\"path\":\"/a/b/-\",\"value\":{\"x\":[4]}},"
+        "{\"op\":\"replace\",\"path\":\"/c\",\"value\":\"another long string\"},"
+        "{\"op\":\"add\",\"path\":\"/a/new key long enough\",\"value\":[5]},"
+        "{\"op\":\"move\",\"from\":\"/a/b\",\"path\":\"/b\"},"
+        "{\"op\":\"copy\",\"from\":\"/b\",\"path\":\"/d\"},"
+        "{\"op\":\"remove\",\"path\":\"/a\"},"
+        "{\"op\":\"replace\",\"path\":\"\",\"value\":null},"
+        "{\"op\":\"remove\",\"path\":\"/missing\"}]");
+    TEST_PATCH(LEPT_PATCH_NOT_FOUND, "{\"a\":[1,2]}", "{\"a\":[1,2]}",
+        "[{\"op\":\"move\",\"from\":\"/a/0\",\"path\":\"/a/5\"}]");
+    TEST_PATCH(LEPT_PATCH_INVALID, "{\"a\":{}}", "{\"a\":{}}",
+        "[{\"op\":\"add\",\"path\":\"/b\",\"value\":1},{\"op\":\"move\",\"from\":\"/a\",\"path\":\"/a/b\"}]");
+    TEST_PATCH(LEPT_PATCH_INVALID, "{}", "{}", "[{\"op\":\"add\",\"path\":\"/a\"}]");
+    TEST_PATCH(LEPT_PATCH_INVALID, "{}", "{}", "[{\"op\":\"jump\",\"path\":\"/a\",\"value\":1}]");
+    TEST_PATCH(LEPT_PATCH_INVALID, "{}", "{}", "[{\"op\":\"add\",\"path\":\"a\",\"value\":1}]");
+    TEST_PATCH(LEPT_PATCH_INVALID, "{}", "{}", "[{\"op\":\"add\",\"path\":\"/~2\",\"value\":1}]");
+    TEST_PATCH(LEPT_PATCH_INVALID, "{}", "{}", "{\"op\":\"add\"}");
+    TEST_PATCH(LEPT_PATCH_NOT_FOUND, "[1]", "[1]", "[{\"op\":\"replace\",\"path\":\"/01\",\"value\":1}]");
+    TEST_PATCH(LEPT_PATCH_NOT_FOUND, "[1]", "[1]", "[{\"op\":\"add\",\"path\":\"/2\",\"value\":1}]");
+    TEST_PATCH(LEPT_PATCH_NOT_FOUND, "{}", "{}", "[{\"op\":\"replace\",\"path\":\"/a\",\"value\":1}]");
+
+    /* the example of RFC 7396 */
+    TEST_MERGE_PATCH("{\"title\":\"Hello!\",\"author\":{\"givenName\":\"John\"},\"tags\":[\"example\"],\"content\":\"This will be unchanged\",\"phoneNumber\":\"+01-123-456-7890\"}",
+        "{\"title\":\"Goodbye!\",\"author\":{\"givenName\":\"John\",\"familyName\":\"Doe\"},\"tags\":[\"example\",\"sample\"],\"content\":\"This will be unchanged\"}",
+        "{\"title\":\"Hello!\",\"phoneNumber\":\"+01-123-456-7890\",\"author\":{\"familyName\":null},\"tags\":[\"example\"]}");
+    TEST_MERGE_PATCH("{\"a\":\"c\"}", "{\"a\":\"b\"}", "{\"a\":\"c\"}");
+    TEST_MERGE_PATCH("{\"a\":\"b\",\"b\":\"c\"}", "{\"a\":\"b\"}", "{\"b\":\"c\"}");
+    TEST_MERGE_PATCH("{}", "{\"a\":\"b\"}", "{\"a\":null}");
+    TEST_MERGE_PATCH("{\"a\":[1]}", "{\"a\":[{\"b\":\"c\"}]}", "{\"a\":[1]}");
+    TEST_MERGE_PATCH("{\"a\":{\"bb\":{}}}", "{\"a\":{\"bb\":{\"ccc\":null}}}", "{\"a\":{\"bb\":{\"ccc\":null}}}");
+    TEST_MERGE_PATCH("[\"c\"]", "{\"a\":\"foo\"}", "[\"c\"]");
+    TEST_MERGE_PATCH("{\"a\":\"foo\"}", "[1,2]", "{\"a\":\"foo\",\"b\":null}");
+}
+
+#define TEST_DIFF(expect_size, a, b)\
+    do {\
+        lept_value va, vb, patch;\
+        lept_init(&va);\
+        lept_init(&vb);\
+        lept_init(&patch);\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&va, a));\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&vb, b));\
+        lept_diff(&va, &vb, &patch);\
+        EXPECT_EQ_SIZE_T(expect_size, lept_get_array_size(&patch));\
+        EXPECT_EQ_INT(LEPT_PATCH_OK, lept_apply_patch(&va, &patch));\
+        EXPECT_TRUE(lept_is_equal_unordered(&va, &vb));\
+        lept_free(&va);\
+        lept_free(&vb);\
+        lept_free(&patch);\
+    } while(0)
+
+static void test_diff() {
+    lept_value a, b, patch;
+    char key[16];
+    size_t i;
+
+    TEST_DIFF(0, "{\"a\":[1,{\"b\":null}],\"c\":\"d\"}", "{\"c\":\"d\",\"a\":[1,{\"b\":null}]}");
+    TEST_DIFF(1, "1", "true");
+    TEST_DIFF(1, "{\"a\":1}", "[\"a\",1]");
+    TEST_DIFF(1, "{\"a\":1,\"b\":2}", "{\"a\":1,\"b\":3}");
+    TEST_DIFF(2, "{\"a\":1,\"b\":2}", "{\"b\":2,\"c\":1}");
+    TEST_DIFF(1, "{\"a/b\":{\"~\":[1,2]}}", "{\"a/b\":{\"~\":[1,2,3]}}");
+    TEST_DIFF(1, "[1,2,3,4,5]", "[1,2,4,5]");
+    TEST_DIFF(1, "[1,2,3,4,5]", "[0,1,2,3,4,5]");
+    TEST_DIFF(2, "[1,2,3,4,5]", "[2,3,4,5,6]");
+    TEST_DIFF(4, "[1,2,3]", "[\"a\",\"b\",\"c\",\"d\"]");
+    TEST_DIFF(4, "[1,2,3,4]", "[]");
+    TEST_DIFF(2, "[]", "[[],{}]");
+    TEST_DIFF(1, "[{\"id\":1,\"v\":\"x\"},{\"id\":2,\"v\":\"y\"},{\"id\":3,\"v\":\"z\"}]",
+                 "[{\"id\":1,\"v\":\"x\"},{\"id\":2,\"v\":\"w\"},{\"id\":3,\"v\":\"z\"}]");
+    TEST_DIFF(4, "[\"a\",\"b\",\"c\",\"d\",\"e\",\"f\"]", "[\"b\",\"a\",\"c\",\"e\",\"x\",\"f\"]");
+
+    /* a big object goes through the key table, packed arrays are diffed too */
+    lept_init(&a);
+    lept_init(&b);
+    lept_init(&patch);
+    lept_set_object(&a, 0);
+    lept_set_object(&b, 0);
+    for (i = 0; i < 100; i++) {
+        sprintf(key, "key %u", (unsigned)i);
+        lept_set_number(lept_set_object_value(&a, key, strlen(key)), (double)i);
+        lept_set_number(lept_set_object_value(&b, key, strlen(key)), (double)(i == 50 ? 0 : i));
+    }
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(lept_set_object_value(&a, "n", 1), "[1,2,3]"));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(lept_set_object_value(&b, "n", 1), "[1,3]"));
+    EXPECT_TRUE(lept_pack_array(lept_find_object_value(&a, "n", 1)));
+    EXPECT_TRUE(lept_pack_array(lept_find_object_value(&b, "n", 1)));
+    lept_diff(&a, &b, &patch);
+    EXPECT_EQ_SIZE_T(2, lept_get_array_size(&patch));
+    /* neither side is unpacked by looking at it */
+    EXPECT_TRUE(lept_get_array_doubles(lept_find_object_value(&a, "n", 1)) != NULL);
+    EXPECT_TRUE(lept_get_array_doubles(lept_find_object_value(&b, "n", 1)) != NULL);
+    EXPECT_EQ_INT(LEPT_PATCH_OK, lept_apply_patch(&a, &patch));
+    EXPECT_TRUE(lept_is_equal(&a, &b));
+    lept_free(&a);
+    lept_free(&b);
+    lept_free(&patch);
+}
+
+static void test_doc() {
+    lept_key_pool* pool = lept_key_pool_create();
+    lept_value v;
+    lept_doc *d, *r, *old;
+    lept_doc_slot slot;
+    const lept_value* root;
+
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_interned(&v, "{\"a long shared key\":[1,2,3],\"b\":{\"a long shared key\":\"x\"}}", pool));
+    EXPECT_TRUE(lept_pack_array(lept_find_object_value(&v, "a long shared key", 17)));
+    d = lept_doc_freeze(&v);
+    EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v));
+    /* the pool can go, the document has keys of its own */
+    lept_key_pool_destroy(pool);
+
+    root = lept_doc_get_root(d);
+    EXPECT_EQ_INT(LEPT_OBJECT, lept_get_type(root));
+    EXPECT_TRUE(lept_get_array_doubles(lept_find_object_value(root, "a long shared key", 17)) == NULL);
+    EXPECT_EQ_DOUBLE(3.0, lept_get_number(lept_get_array_element(lept_find_object_value(root, "a long shared key", 17), 2)));
+    EXPECT_EQ_STRING("x", lept_get_string(lept_find_object_value(lept_find_object_value(root, "b", 1), "a long shared key", 17)), 1);
+
+    EXPECT_TRUE(lept_doc_retain(d) == d);
+    lept_doc_release(d);
+
+    /* a reader keeps its document through a publish */
+    lept_doc_slot_init(&slot, d);
+    r = lept_doc_slot_acquire(&slot);
+    EXPECT_TRUE(r == d);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "[true]"));
+    lept_doc_slot_publish(&slot, lept_doc_freeze(&v));
+    EXPECT_EQ_INT(LEPT_OBJECT, lept_get_type(lept_doc_get_root(r)));
+    lept_doc_release(r);
+    r = lept_doc_slot_acquire(&slot);
+    EXPECT_EQ_INT(LEPT_ARRAY, lept_get_type(lept_doc_get_root(r)));
+    old = r;
+    lept_doc_slot_publish(&slot, NULL);
+    EXPECT_TRUE(lept_doc_slot_acquire(&slot) == NULL);
+    EXPECT_EQ_INT(LEPT_TRUE, lept_get_type(lept_peek_array_element(lept_doc_get_root(old), 0, &v)));
+    lept_doc_release(old);
+    lept_doc_slot_destroy(&slot);
+}
+
+static lept_doc* test_with_value(const lept_doc* doc, const char* path, const char* json) {
+    lept_pointer* p = lept_pointer_compile(path, strlen(path));
+    lept_value v;
+    lept_doc* d;
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));
+    d = lept_with_value(doc, p, &v);
+    lept_pointer_free(p);
+    lept_free(&v);
+    return d;
+}
+
+#define EXPECT_DOC(expect, d)\
+    do {\
+        lept_value e;\
+        lept_init(&e);\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&e, expect));\
+        EXPECT_TRUE(lept_is_equal(&e, lept_doc_get_root(d)));\
+        lept_free(&e);\
+    } while(0)
+
+static void test_persistent() {
+    static const char* const json =
+        "{\"user\":{\"name\":\"a name long enough\",\"tags\":[\"x\",\"y\"]},\"items\":[{\"id\":1},{\"id\":2}],\"n\":[1,2]}";
+    lept_value v;
+    lept_doc *d, *d1, *d2, *d3, *d4;
+    lept_doc* versions[16];
+    char value[8];
+    size_t i;
+
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));
+    EXPECT_TRUE(lept_pack_array(lept_find_object_value(&v, "n", 1)));
+    d = lept_doc_freeze(&v);
+
+    d1 = test_with_value(d, "/items/1/id", "20");
+    d2 = test_with_value(d1, "/user/tags/-", "\"a tag long enough\"");
+    d3 = test_with_value(d2, "/user/mail", "\"m\"");
+    d4 = test_with_value(d3, "", "[]");
+    EXPECT_TRUE(test_with_value(d, "/missing/x", "1") == NULL);
+    EXPECT_TRUE(test_with_value(d, "/items/3", "1") == NULL);
+    EXPECT_TRUE(test_with_value(d, "/user/name/x", "1") == NULL);
+
+    /* old versions are untouched, untouched subtrees are shared */
+    EXPECT_DOC(json, d);
+    EXPECT_DOC("{\"user\":{\"name\":\"a name long enough\",\"tags\":[\"x\",\"y\"]},\"items\":[{\"id\":1},{\"id\":20}],\"n\":[1,2]}", d1);
+    EXPECT_DOC("{\"user\":{\"name\":\"a name long enough\",\"tags\":[\"x\",\"y\",\"a tag long enough\"],\"mail\":\"m\"},"
+               "\"items\":[{\"id\":1},{\"id\":20}],\"n\":[1,2]}", d3);
+    EXPECT_DOC("[]", d4);
+    EXPECT_TRUE(lept_find_object_value(lept_doc_get_root(d), "n", 1) != lept_find_object_value(lept_doc_get_root(d3), "n", 1));
+    EXPECT_TRUE(lept_get_array_element(lept_find_object_value(lept_doc_get_root(d), "n", 1), 0) ==
+                lept_get_array_element(lept_find_object_value(lept_doc_get_root(d3), "n", 1), 0));
+    EXPECT_TRUE(lept_get_string(lept_find_object_value(lept_find_object_value(lept_doc_get_root(d), "user", 4), "name", 4)) ==
+                lept_get_string(lept_find_object_value(lept_find_object_value(lept_doc_get_root(d3), "user", 4), "name", 4)));
+
+    /* any order of release frees everything once */
+    lept_doc_release(d2);
+    lept_doc_release(d);
+    lept_doc_release(d4);
+    EXPECT_DOC("{\"user\":{\"name\":\"a name long enough\",\"tags\":[\"x\",\"y\"]},\"items\":[{\"id\":1},{\"id\":20}],\"n\":[1,2]}", d1);
+    lept_doc_release(d1);
+    EXPECT_DOC("{\"user\":{\"name\":\"a name long enough\",\"tags\":[\"x\",\"y\",\"a tag long enough\"],\"mail\":\"m\"},"
+               "\"items\":[{\"id\":1},{\"id\":20}],\"n\":[1,2]}", d3);
+
+    /* a chain of versions, each one step on from the last */
+    versions[0] = d3;
+    for (i = 1; i < 16; i++) {
+        sprintf(value, "%u", (unsigned)i);
+        versions[i] = test_with_value(versions[i - 1], i % 2 ? "/items/0/id" : "/count", value);
+    }
+    EXPECT_EQ_DOUBLE(15.0, lept_get_number(lept_find_object_value(lept_get_array_element(
+        lept_find_object_value(lept_doc_get_root(versions[15]), "items", 5), 0), "id", 2)));
+    EXPECT_EQ_DOUBLE(14.0, lept_get_number(lept_find_object_value(lept_doc_get_root(versions[15]), "count", 5)));
+    for (i = 0; i < 16; i += 2) {
+        lept_doc_release(versions[i]);
+    }
+    for (i = 1; i < 16; i += 2) {
+        lept_doc_release(versions[i]);
+    }
+}
+
+#ifdef LEPT_ENABLE_STATS
+static void test_stats() {
+    lept_value v;
+    lept_column col;
+    lept_stats s, total;
+    char* json;
+    size_t length;
+
+    lept_stats_reset();
+    lept_stats_get(&s);
+    EXPECT_EQ_SIZE_T(0, s.parsed);
+    EXPECT_EQ_SIZE_T(0, s.allocations);
+
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "{\"a\":[1,\"x\\ny\",[null,true]],\"b\":{}} "));
+    EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify(&v, &json, &length));
+    lept_stats_get(&s);
+    EXPECT_EQ_SIZE_T(1, s.parsed);
+    EXPECT_EQ_SIZE_T(1, s.stringified);
+    EXPECT_EQ_SIZE_T(36, s.bytes_in);
+    EXPECT_EQ_SIZE_T(length, s.bytes_out);
+    EXPECT_EQ_SIZE_T(1, s.nodes[LEPT_NULL - LEPT_NULL]);
+    EXPECT_EQ_SIZE_T(1, s.nodes[LEPT_TRUE - LEPT_NULL]);
+    EXPECT_EQ_SIZE_T(1, s.nodes[LEPT_NUMBER - LEPT_NULL]);
+    EXPECT_EQ_SIZE_T(1, s.nodes[LEPT_STRING - LEPT_NULL]);
+    EXPECT_EQ_SIZE_T(2, s.nodes[LEPT_ARRAY - LEPT_NULL]);
+    EXPECT_EQ_SIZE_T(2, s.nodes[LEPT_OBJECT - LEPT_NULL]);
+    EXPECT_EQ_SIZE_T(4, s.max_depth);
+    EXPECT_EQ_SIZE_T(1, s.escapes);
+    EXPECT_TRUE(s.allocations >= 4);    /* two arrays, the root object, the parse stack */
+    EXPECT_TRUE(s.stack_reallocs >= 1 && s.stack_peak >= 256);
+    free(json);
+    lept_free(&v);
+
+    /* failed documents count too, and so do the values done before the error, not the open array */
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_VALUE, lept_parse(&v, "[1,?]"));
+    lept_stats_get(&total);
+    EXPECT_EQ_SIZE_T(2, total.parsed);
+    EXPECT_EQ_SIZE_T(2, total.nodes[LEPT_NUMBER - LEPT_NULL]);
+    EXPECT_EQ_SIZE_T(2, total.nodes[LEPT_ARRAY - LEPT_NULL]);
+
+    lept_stats_merge(&total, &s);
+    EXPECT_EQ_SIZE_T(3, total.parsed);
+    EXPECT_EQ_SIZE_T(4, total.max_depth);
+
+    /* growing in place adds only the difference, shrinking adds nothing */
+    lept_stats_reset();
+    lept_set_array(&v, 0);
+    lept_reserve_array(&v, 4);
+    lept_reserve_array(&v, 8);
+    lept_pushback_array_element(&v);
+    lept_shrink_array(&v);
+    lept_stats_get(&s);
+    EXPECT_EQ_SIZE_T(3, s.allocations);
+    EXPECT_EQ_SIZE_T(8 * sizeof(lept_value), s.allocated);
+    lept_free(&v);
+
+    /* a string column: rows + 1 offsets and a byte, the null bits, the per column state */
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "[{},{}]"));
+    col.key = "s";
+    col.klen = 1;
+    col.type = LEPT_COLUMN_STRING;
+    lept_stats_reset();
+    EXPECT_EQ_SIZE_T(2, lept_to_columns(&v, &col, 1));
+    lept_stats_get(&s);
+    EXPECT_EQ_SIZE_T(3, s.allocations);
+    EXPECT_EQ_SIZE_T(3 * sizeof(size_t) + 1 + 1 + 2 * sizeof(size_t), s.allocated);
+    lept_free_columns(&col, 1);
+    lept_free(&v);
+    lept_stats_reset();
+}
+#endif
+
 /***** main test function ****/
 static void test_parse() {
     
@@ -495,6 +2004,14 @@ static void test_parse() {
     
     test_parse_invalid_unicode_hex();
     test_parse_invalid_unicode_surrogate();
+    test_parse_miss_comma_or_square_bracket();
+    test_parse_miss_key();
+    test_parse_miss_colon();
+    test_parse_miss_comma_or_curly_bracket();
+    test_parse_error_location();
+    test_validate();
+    test_validate_too_deep();
+    test_parse_invalid_utf8();
 
 }
 
@@ -503,6 +2020,49 @@ static void test_access() {
     test_access_boolean();
     test_access_number();
     test_access_string();
+    test_access_array();
+    test_access_object();
+}
+
+static void test_layout() {
+    lept_value v;
+    char* json;
+    size_t n;
+
+    /* the sizes leptjson.h promises on LP64 */
+#ifdef LEPT_COMPACT
+    EXPECT_EQ_SIZE_T(4, sizeof(lept_size));
+    EXPECT_EQ_SIZE_T(1, sizeof(lept_tag));
+    if (sizeof(void*) == 8) {
+        EXPECT_EQ_SIZE_T(24, sizeof(lept_value));
+        EXPECT_EQ_SIZE_T(40, sizeof(lept_member));
+    }
+#else
+    EXPECT_EQ_SIZE_T(sizeof(size_t), sizeof(lept_size));
+    if (sizeof(void*) == 8) {
+        EXPECT_EQ_SIZE_T(32, sizeof(lept_value));
+        EXPECT_EQ_SIZE_T(48, sizeof(lept_member));
+    }
+#endif
+    EXPECT_TRUE(LEPT_SIZE_MAX <= (size_t)(lept_size)-1);
+
+    /* a string over the limit is an error, not a wrapped length; only tried when that is small */
+    if (LEPT_SIZE_MAX < 65536) {
+        n = LEPT_SIZE_MAX + 1;
+        json = (char*)malloc(n + 3);
+        json[0] = '"';
+        memset(json + 1, 'a', n);
+        json[n + 1] = '"';
+        json[n + 2] = '\0';
+        lept_init(&v);
+        EXPECT_EQ_INT(LEPT_PARSE_STRING_TOO_LONG, lept_parse(&v, json));
+        json[n] = '"';
+        json[n + 1] = '\0';
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));
+        EXPECT_EQ_SIZE_T(LEPT_SIZE_MAX, lept_get_string_length(&v));
+        lept_free(&v);
+        free(json);
+    }
 }
 
 static void test_stringify_number() {
@@ -545,6 +2105,188 @@ static void test_stringify_object() {
     TEST_ROUNDTRIP("{}");
     TEST_ROUNDTRIP("{\"n\":null,\"f\":false,\"t\":true,\"i\":123,\"s\":\"abc\",\"a\":[1,2,3],\"o\":{\"1\":1,\"2\":2,\"3\":3}}");
 }
+#define TEST_CANONICAL(expect, json) \
+    do { \
+        lept_value v;   \
+        char* json2;    \
+        size_t length;  \
+        lept_init(&v);  \
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));  \
+        EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify_canonical(&v, &json2, &length));  \
+        EXPECT_EQ_STRING(expect, json2, length);  \
+        lept_free(&v);  \
+        free(json2);    \
+    }while(0)
+
+static void test_stringify_canonical() {
+    lept_value v;
+    char* json;
+    size_t length;
+
+    /* numbers, as in RFC 8785 appendix B */
+    TEST_CANONICAL("0", "0");
+    TEST_CANONICAL("0", "-0");
+    TEST_CANONICAL("1", "1.0");
+    TEST_CANONICAL("-1.5", "-15e-1");
+    TEST_CANONICAL("4.5", "4.50");
+    TEST_CANONICAL("0.002", "2e-3");
+    TEST_CANONICAL("0.000001", "1e-6");
+    TEST_CANONICAL("1e-7", "0.0000001");
+    TEST_CANONICAL("1e-27", "1e-27");
+    TEST_CANONICAL("1e+30", "1e30");
+    TEST_CANONICAL("0.1", "0.1");
+    TEST_CANONICAL("333333333.3333333", "333333333.33333329");
+    TEST_CANONICAL("123000000000000000000", "123e18");
+    TEST_CANONICAL("1e+21", "1e21");
+    TEST_CANONICAL("9007199254740992", "9007199254740992");
+    TEST_CANONICAL("1.0000000000000002", "1.0000000000000002");
+    TEST_CANONICAL("5e-324", "4.9406564584124654e-324");
+    TEST_CANONICAL("1.7976931348623157e+308", "1.7976931348623157e+308");
+    TEST_CANONICAL("-2.2250738585072014e-308", "-2.2250738585072014e-308");
+    TEST_CANONICAL("2.225073858507201e-308", "2.2250738585072009e-308");
+
+    /* strings, only what has to be escaped is */
+    TEST_CANONICAL("\"\\u001f/\xe2\x82\xac\\n\\\"\"", "\"\\u001F\\/\\u20AC\\n\\\"\"");
+
+    /* keys, in UTF-16 order */
+    TEST_CANONICAL("{\"\\r\":0,\"1\":1,\"\xc2\x80\":2,\"\xc3\xb6\":3,\"\xe2\x82\xac\":4,\"\xf0\x9f\x98\x80\":5,\"\xef\xac\xb3\":6}",
+        "{\"\\u20ac\":4,\"\\r\":0,\"\\ufb33\":6,\"1\":1,\"\\ud83d\\ude00\":5,\"\\u0080\":2,\"\\u00f6\":3}");
+    TEST_CANONICAL("{\"a\":[{\"b\":1,\"c\":{\"d\":true,\"e\":null}}],\"ab\":\"x\"}",
+        "{\"ab\":\"x\", \"a\":[{\"c\":{\"e\":null,\"d\":true},\"b\":1.0}]}");
+
+    /* the source keeps its member order */
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "{\"b\":1,\"a\":2}"));
+    EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_stringify_canonical(&v, &json, &length));
+    EXPECT_EQ_STRING("{\"a\":2,\"b\":1}", json, length);
+    free(json);
+    EXPECT_EQ_STRING("b", lept_get_object_key(&v, 0), lept_get_object_key_length(&v, 0));
+    lept_free(&v);
+
+    /* infinity and NaN have no JSON text */
+    lept_init(&v);
+    lept_set_number(&v, HUGE_VAL);
+    json = (char*)&v;
+    EXPECT_EQ_INT(LEPT_STRINGIFY_INVALID_TYPE, lept_stringify_canonical(&v, &json, &length));
+    EXPECT_TRUE(json == NULL);
+    lept_set_number(&v, -HUGE_VAL);
+    EXPECT_EQ_INT(LEPT_STRINGIFY_INVALID_TYPE, lept_stringify_canonical(&v, &json, &length));
+    lept_set_number(&v, HUGE_VAL - HUGE_VAL);
+    EXPECT_EQ_INT(LEPT_STRINGIFY_INVALID_TYPE, lept_stringify_canonical(&v, &json, &length));
+    EXPECT_EQ_INT(LEPT_STRINGIFY_INVALID_TYPE, lept_stringify(&v, &json, &length));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "[1,null]"));
+    lept_set_number(lept_get_array_element(&v, 1), HUGE_VAL);
+    EXPECT_EQ_INT(LEPT_STRINGIFY_INVALID_TYPE, lept_stringify_canonical(&v, &json, &length));
+    lept_free(&v);
+}
+
+#define TEST_BINARY_ROUNDTRIP(json) \
+    do { \
+        lept_value v1, v2;  \
+        char* buffer;   \
+        size_t length;  \
+        lept_init(&v1); \
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v1, json));  \
+        EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_encode_binary(&v1, &buffer, &length));  \
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_decode_binary(&v2, buffer, length));  \
+        EXPECT_TRUE(lept_is_equal(&v1, &v2));   \
+        lept_free(&v1); \
+        lept_free(&v2); \
+        free(buffer);   \
+    }while(0)
+
+static void test_binary() {
+    static const char* json = "{\"id\":42,\"name\":\"a string that is not short\",\"ok\":true,"
+        "\"tags\":[null,false,\"x\",[],{}],\"nested_member\":{\"pi\":3.25,\"\":\"\\u0000\"}}";
+    lept_value v, v2;
+    lept_binary_view root, e, m;
+    double n[2];
+    char* buffer;
+    const char* s;
+    size_t i, length, len;
+
+    TEST_BINARY_ROUNDTRIP("null");
+    TEST_BINARY_ROUNDTRIP("-1.7976931348623157e+308");
+    TEST_BINARY_ROUNDTRIP("\"Hello\\u0000World\"");
+    TEST_BINARY_ROUNDTRIP("[[[[]]],[1,2,3],{\"a\":{\"b\":[]}}]");
+    TEST_BINARY_ROUNDTRIP(json);
+
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));
+    EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_encode_binary(&v, &buffer, &length));
+    lept_free(&v);
+
+    /* read in place */
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_binary_view_init(&root, buffer, length));
+    EXPECT_EQ_INT(LEPT_OBJECT, lept_binary_get_type(&root));
+    EXPECT_EQ_SIZE_T(5, lept_binary_get_size(&root));
+    EXPECT_TRUE(lept_binary_find_member(&root, "id", 2, &m));
+    EXPECT_EQ_DOUBLE(42.0, lept_binary_get_number(&m));
+    EXPECT_TRUE(lept_binary_find_member(&root, "name", 4, &m));
+    s = lept_binary_get_string(&m, &len);
+    EXPECT_EQ_STRING("a string that is not short", s, len);
+    EXPECT_TRUE(s >= buffer && s < buffer + length);
+    EXPECT_TRUE(lept_binary_find_member(&root, "ok", 2, &m));
+    EXPECT_TRUE(lept_binary_get_boolean(&m));
+    EXPECT_FALSE(lept_binary_find_member(&root, "o", 1, &m));
+    EXPECT_TRUE(lept_binary_get_member(&root, 3, &s, &len, &m));
+    EXPECT_EQ_STRING("tags", s, len);
+    EXPECT_EQ_INT(LEPT_ARRAY, lept_binary_get_type(&m));
+    EXPECT_EQ_SIZE_T(5, lept_binary_get_size(&m));
+    EXPECT_TRUE(lept_binary_get_element(&m, 2, &e));
+    s = lept_binary_get_string(&e, &len);
+    EXPECT_EQ_STRING("x", s, len);
+    EXPECT_TRUE(lept_binary_get_element(&m, 4, &e));
+    EXPECT_EQ_INT(LEPT_OBJECT, lept_binary_get_type(&e));
+    EXPECT_FALSE(lept_binary_get_element(&m, 5, &e));
+    EXPECT_TRUE(lept_binary_get_member(&root, 4, NULL, NULL, &m));
+    EXPECT_TRUE(lept_binary_find_member(&m, "", 0, &e));
+    s = lept_binary_get_string(&e, &len);
+    EXPECT_EQ_STRING("\0", s, len);
+
+    /* every truncation and trailing garbage are caught */
+    for (i = 0; i < length; i++) {
+        EXPECT_EQ_INT(LEPT_PARSE_INVALID_BINARY, lept_decode_binary(&v, buffer, i));
+    }
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_BINARY, lept_binary_view_init(&root, buffer, length - 1));
+    buffer[0] = 'X';
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_BINARY, lept_decode_binary(&v, buffer, length));
+    free(buffer);
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_BINARY, lept_decode_binary(&v, "LJB\1\7", 5));
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_BINARY, lept_decode_binary(&v, "LJB\1\0\0", 6));
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_BINARY, lept_decode_binary(&v, "LJB\1\5\377\0\0\0\0", 10));
+    /* NaN, infinity and -infinity */
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_BINARY, lept_decode_binary(&v, "LJB\1\3\0\0\0\0\0\0\370\177", 13));
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_BINARY, lept_decode_binary(&v, "LJB\1\3\0\0\0\0\0\0\360\177", 13));
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_BINARY, lept_binary_view_init(&root, "LJB\1\3\0\0\0\0\0\0\360\377", 13));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_decode_binary(&v, "LJB\1\3\0\0\0\0\0\0\360\77", 13));
+    EXPECT_EQ_DOUBLE(1.0, lept_get_number(&v));
+    lept_free(&v);
+
+    /* and they are not written either, so whatever is encoded decodes */
+    lept_set_number(&v, HUGE_VAL - HUGE_VAL);
+    buffer = (char*)&v;
+    EXPECT_EQ_INT(LEPT_STRINGIFY_INVALID_TYPE, lept_encode_binary(&v, &buffer, &length));
+    EXPECT_TRUE(buffer == NULL);
+    EXPECT_EQ_SIZE_T(0, length);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "{\"a\":[1,null]}"));
+    lept_set_number(lept_get_array_element(lept_find_object_value(&v, "a", 1), 1), -HUGE_VAL);
+    EXPECT_EQ_INT(LEPT_STRINGIFY_INVALID_TYPE, lept_encode_binary(&v, &buffer, &length));
+    lept_set_number(lept_get_array_element(lept_find_object_value(&v, "a", 1), 1), 2.0);
+    EXPECT_TRUE(lept_pack_array(lept_find_object_value(&v, "a", 1)));
+    EXPECT_EQ_INT(LEPT_STRINGIFY_OK, lept_encode_binary(&v, &buffer, &length));
+    lept_init(&v2);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_decode_binary(&v2, buffer, length));
+    EXPECT_TRUE(lept_is_equal(&v, &v2));
+    free(buffer);
+    n[0] = 1.0;
+    n[1] = HUGE_VAL;
+    lept_set_array_doubles(&v, n, 2);
+    EXPECT_EQ_INT(LEPT_STRINGIFY_INVALID_TYPE, lept_encode_binary(&v, &buffer, &length));
+    lept_free(&v);
+    lept_free(&v2);
+}
+
 static void test_stringify() {
     TEST_ROUNDTRIP("false");
     TEST_ROUNDTRIP("true");
@@ -561,6 +2303,8 @@ static void test_stringify() {
     test_stringify_string();
     test_stringify_array();
     test_stringify_object();
+    test_stringify_canonical();
+    test_binary();
 }
 
 static void test_roundtrip_real() {
@@ -576,8 +2320,29 @@ static void test_roundtrip_real() {
 int main() {
     test_parse();
     test_access();
+    test_layout();
     test_stringify();
     test_roundtrip_real();
+    test_copy();
+    test_move();
+    test_swap();
+    test_key_pool();
+    test_parser();
+    test_equal_unordered();
+    test_pointer();
+    test_parse_projected();
+    test_packed_array();
+    test_to_columns();
+    test_decode();
+    test_schema();
+    test_query();
+    test_patch();
+    test_diff();
+    test_doc();
+    test_persistent();
+#ifdef LEPT_ENABLE_STATS
+    test_stats();
+#endif
     printf("%d/%d (%3.2f%%) passed\n", test_pass, test_count, test_pass * 100.0 / test_count);
     return main_ret;
 }